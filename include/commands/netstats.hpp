@@ -0,0 +1,80 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft__COMMANDS__NETSTATS_H_
+#define _hCraft__COMMANDS__NETSTATS_H_
+
+#include "command.hpp"
+
+
+namespace hCraft {
+	namespace commands {
+		
+		/* 
+		 * /netstats
+		 * 
+		 * Displays statistics about the server's network path.
+		 * 
+		 * Permissions:
+		 *   - command.info.netstats
+		 *       Needed to execute the command.
+		 */
+		class c_netstats: public command
+		{
+			void show_handlers (player *pl);
+			
+		public:
+			const char* get_name () { return "netstats"; }
+			
+			const char*
+			get_summary ()
+				{ return "Displays packet allocation and network statistics."; }
+			
+			const char*
+			get_help ()
+			{ return
+				".TH NETSTATS 1 \"/netstats\" \"Revision 1\" \"INFO COMMANDS\" "
+				".SH NAME "
+				"netstats - Display network statistics. "
+				".PP "
+				".SH SYNOPSIS "
+				"$g/netstats $G[handlers] "
+				".PP "
+				".SH DESCRIPTION "
+				"Displays the packet pool's allocation counters: how many packet "
+				"buffers were requested, how many of those were served from the pool "
+				"rather than the heap, and how much memory the pool currently caches. "
+				"Also displays how many packets were sent, and how many socket writes "
+				"it took to send them, and how much of that was player movement. "
+				".PP "
+				"If handlers is given, lists every packet id received so far, along "
+				"with the median and 99th percentile of the time packets spent waiting "
+				"in their player's queue, and of the time their handler took to run "
+				"(both in microseconds). "
+				;}
+			
+			const char* get_exec_permission () { return "command.info.netstats"; }
+			
+		//----
+			void execute (player *pl, command_reader& reader);
+		};
+	}
+}
+
+#endif
+
@@ -40,6 +40,7 @@ namespace hCraft {
 		 *   - command.info.status.logins
 		 *   - command.info.status.blockstats
 		 *   - command.info.status.balance
+		 *   - command.info.status.physics
 		 */
 		class c_status: public command
 		{
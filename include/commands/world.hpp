@@ -53,6 +53,8 @@ namespace hCraft {
 		 *       Required to regenerate the world.
 		 *   - commands.world.world.save
 		 *       Required to save the world.
+		 *   - commands.world.world.defrag
+		 *       Required to defragment the world's file.
 		 *   - commands.world.world.time
 		 *       Required to change the time of the world.
 		 *   - commands.world.world.pvp
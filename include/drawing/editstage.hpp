@@ -179,6 +179,12 @@ namespace hCraft {
 		virtual blocki get (int x, int y, int z) override;
 		virtual void reset (int x, int y, int z) override;
 		
+		/* 
+		 * Same as get (), but only succeeds if the block has been modified in
+		 * this edit stage (the underlying world is not queried).
+		 */
+		bool get_staged (int x, int y, int z, blocki& out);
+		
 		virtual int mod_count_at (int cx, int cz) override;
 		
 		
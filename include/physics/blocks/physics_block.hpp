@@ -20,7 +20,9 @@
 #define _hCraft__PHYSICS_BLOCK_H_
 
 #include <random>
+#include <vector>
 #include "slot/blocks.hpp"
+#include "physics/bulk.hpp"
 
 
 namespace hCraft {
@@ -65,6 +67,20 @@ namespace hCraft {
 		virtual void tick (world &w, int x, int y, int z, int data,
 				void *ptr, std::minstd_rand& rnd) { }
 		
+		/* 
+		 * Bulk mode.
+		 * When a large number of blocks of this type are pending in the same
+		 * subchunk, the physics workers call bulk_tick () once for all of them
+		 * instead of calling tick () on each block.  The kernel reads from a
+		 * snapshot of the subchunk and must produce the same changes that
+		 * tick () would have (tick () remains the reference implementation).
+		 */
+		virtual bool has_bulk_tick () { return false; }
+		virtual physics_snapshot_source bulk_source () { return PSS_WORLD; }
+		virtual void bulk_tick (physics_snapshot& snap,
+			const physics_bulk_entry *blocks, int count,
+			std::vector<physics_change>& out, std::minstd_rand& rnd) { }
+		
 		/* 
 		 * Called when a neighbouring block is destroyed\changed.
 		 */
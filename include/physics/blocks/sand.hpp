@@ -39,6 +39,10 @@ namespace hCraft {
 				void *ptr, std::minstd_rand& rnd) override;
 			virtual void on_neighbour_modified (world &w, int x, int y, int z,
 				int nx, int ny, int nz) override;
+			virtual bool has_bulk_tick () override { return true; }
+			virtual void bulk_tick (physics_snapshot& snap,
+				const physics_bulk_entry *blocks, int count,
+				std::vector<physics_change>& out, std::minstd_rand& rnd) override;
 		};
 	}
 }
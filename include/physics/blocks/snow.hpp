@@ -36,6 +36,11 @@ namespace hCraft {
 		
 			virtual void tick (world &w, int x, int y, int z, int data,
 				void *ptr, std::minstd_rand& rnd) override;
+			virtual bool has_bulk_tick () override { return true; }
+			virtual physics_snapshot_source bulk_source () override { return PSS_FINAL; }
+			virtual void bulk_tick (physics_snapshot& snap,
+				const physics_bulk_entry *blocks, int count,
+				std::vector<physics_change>& out, std::minstd_rand& rnd) override;
 		};
 	}
 }
@@ -0,0 +1,121 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft__PHYSICS__BULK_H_
+#define _hCraft__PHYSICS__BULK_H_
+
+#include "slot/blocks.hpp"
+#include <vector>
+
+
+namespace hCraft {
+	
+	class world;
+	
+	
+	/* 
+	 * A pending physics update handed to a bulk kernel.
+	 */
+	struct physics_bulk_entry
+	{
+		int x, y, z;
+		int data;
+	};
+	
+	/* 
+	 * A single block modification produced by a bulk kernel.
+	 */
+	struct physics_change
+	{
+		int x, y, z;
+		unsigned short id;
+		unsigned char meta;
+	};
+	
+	
+	enum physics_snapshot_source
+	{
+		// the blocks currently stored in the world's chunks (what
+		// world::get_block () returns).
+		PSS_WORLD,
+		
+		// the world's blocks with the edit stage applied on top (what
+		// world::get_final_block () returns).
+		PSS_FINAL,
+	};
+	
+	
+	/* 
+	 * A copy of the IDs and meta values of a 16x16x16 subchunk along with a one
+	 * block wide border around it (18x18x18 blocks in total).  Bulk physics
+	 * kernels operate on a snapshot instead of querying the world block by
+	 * block.
+	 */
+	class physics_snapshot
+	{
+	public:
+		static const int dim = 18;
+		
+	private:
+		int ox, oy, oz; // world coordinates of the first (border) block
+		unsigned short ids[dim * dim * dim];
+		unsigned char meta[dim * dim * dim];
+		
+	private:
+		inline int
+		index (int x, int y, int z) const
+			{ return (((y - oy) * dim) + (z - oz)) * dim + (x - ox); }
+		
+	public:
+		/* 
+		 * Copies the subchunk located at the given chunk coordinates and
+		 * subchunk index (and its border) from the specified world.
+		 */
+		void load (world &w, int cx, int sy, int cz, physics_snapshot_source src);
+		
+		/* 
+		 * Checks whether the given world coordinates are covered by the snapshot.
+		 */
+		inline bool
+		contains (int x, int y, int z) const
+		{
+			return (x >= ox) && (x < (ox + dim))
+					&& (y >= oy) && (y < (oy + dim))
+					&& (z >= oz) && (z < (oz + dim));
+		}
+		
+		/* 
+		 * Block retrieval\modification (in world coordinates).
+		 * Blocks outside the snapshot are treated as air.
+		 */
+		blocki get (int x, int y, int z) const;
+		unsigned short get_id (int x, int y, int z) const;
+		void set (int x, int y, int z, unsigned short id, unsigned char meta = 0);
+	};
+	
+	
+	
+	/* 
+	 * Queues all of the given block changes in the specified world under a
+	 * single acquisition of its update lock.
+	 */
+	void physics_commit_changes (world &w, const std::vector<physics_change>& changes);
+}
+
+#endif
+
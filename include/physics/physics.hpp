@@ -28,8 +28,12 @@
 #include <chrono>
 #include <unordered_map>
 #include <random>
+#include <atomic>
+#include <functional>
 #include "util/position.hpp"
+#include "physics/bulk.hpp"
 #include "tbb/concurrent_queue.h"
+#include "tbb/concurrent_unordered_map.h"
 
 
 namespace hCraft {
@@ -88,6 +92,7 @@ namespace hCraft {
 						int x, y, z;
 						int data;
 						physics_block_callback cb;
+						bool once; // marked in the membership map, see queue_physics_once ()
 					} blk;
 				
 				struct
@@ -115,32 +120,134 @@ namespace hCraft {
 //-----
 	/* 
 	 * These structures are used to store block memberships in chunks.
+	 * 
+	 * Every subchunk is represented by a 4096-bit map (512 bytes), where a set
+	 * bit means that an update queued through queue_physics_once () is pending
+	 * for the block.  Plain queue_physics () updates are not tracked.  Bits are tested
+	 * and modified with atomic operations, so checking or marking a block does
+	 * not require taking any lock.
 	 */
 	
 	struct ph_mem_subchunk {
-		unsigned short blocks[4096];
+		std::atomic<unsigned long long> bits[64];
+		std::atomic<int> count; // number of set bits
 		
 	//----
 		ph_mem_subchunk ();
+		
+		/* 
+		 * Sets the bit at the given index.
+		 * Returns true if the bit was previously clear.
+		 */
+		bool test_and_set (unsigned int index);
+		
+		bool test (unsigned int index) const;
+		void clear (unsigned int index);
+	};
+	
+	struct ph_mem_key {
+		world *w;
+		int cx, cz;
+		
+		bool
+		operator== (const ph_mem_key& other) const
+			{ return (w == other.w) && (cx == other.cx) && (cz == other.cz); }
 	};
 	
 	struct ph_mem_chunk {
-		ph_mem_subchunk *subs[16];
+		ph_mem_key key;
+		std::atomic<ph_mem_chunk *> next; // in the same bucket
+		std::atomic<ph_mem_subchunk *> subs[16];
+		
+		// set whenever a block in this chunk is marked, and cleared by the
+		// memory sweeper.  used to detect idle regions.
+		std::atomic<bool> touched;
+		
+		// number of threads marking blocks in this chunk.  the sweeper sets
+		// dead before it checks that there are none, and a marking thread
+		// checks dead after it has registered, so that no mark can go to a
+		// chunk that is being unlinked.
+		std::atomic<int> writers;
+		std::atomic<bool> dead;
 		
 		// constructor
-		ph_mem_chunk () {
+		ph_mem_chunk (const ph_mem_key& key)
+			: key (key)
+		{
+			next = nullptr;
 			for (int i = 0; i < 16; ++i)
 				subs[i] = nullptr;
+			touched = true;
+			writers = 0;
+			dead = false;
 		}
 		
 		// destructor
 		~ph_mem_chunk () {
 			for (int i = 0; i < 16; ++i)
-				delete subs[i];
+				delete subs[i].load ();
+		}
+	};
+	
+	class ph_mem_key_hash
+	{
+		std::hash<world *> ptr_hash;
+		chunk_pos_hash cpos_hash;
+		
+	public:
+		std::size_t
+		operator() (const ph_mem_key& key) const
+		{
+			return ptr_hash (key.w) ^ (cpos_hash ({key.cx, key.cz}) << 1);
 		}
 	};
 //-----
 	
+	/* 
+	 * Every world has its own queue of pending updates within a manager, along
+	 * with the counters used to enforce its physics budget.
+	 */
+	struct ph_world_queue
+	{
+		int wid;
+		tbb::concurrent_queue<physics_update> updates;
+		std::atomic<int> pending; // approximate size of the queue
+		
+		// entity ticks are kept apart from block updates, since they are
+		// neither paused, budgeted nor shed along with them.
+		tbb::concurrent_queue<physics_update> entities;
+		std::atomic<int> entity_pending;
+		
+		std::atomic<int> used;      // updates processed during the current tick
+		std::atomic<int> last_used; // and during the previous one
+		
+		// load shedding.
+		// block tick delays are multiplied by `slowdown' (1, 2, 4 or 8) as long
+		// as the world keeps exhausting its budget.
+		std::atomic<int> slowdown;
+		int hot_ticks;  // consecutive ticks the budget was exhausted
+		int cold_ticks; // consecutive ticks under half the budget
+		std::atomic<bool> overloaded;
+		std::atomic<unsigned long long> dropped;
+		
+	//---
+		ph_world_queue (int wid);
+	};
+	
+	/* 
+	 * Budget utilization of a single world, as shown by /status.
+	 */
+	struct physics_world_stats
+	{
+		int pending;
+		int max_pending;
+		int budget;
+		int used; // during the last tick
+		int slowdown;
+		unsigned long long dropped;
+	};
+	
+	
 	class physics_manager;
 	
 	/* 
@@ -150,6 +257,33 @@ namespace hCraft {
 	{
 		friend class physics_manager;
 		
+		// identifies a group of same-typed blocks in a single subchunk that can
+		// be handed to a bulk kernel together.
+		struct bulk_key
+		{
+			world *w;
+			int id;
+			int cx, sy, cz;
+			
+			bool
+			operator== (const bulk_key& other) const
+			{
+				return (w == other.w) && (id == other.id) && (cx == other.cx)
+					&& (sy == other.sy) && (cz == other.cz);
+			}
+		};
+		
+		struct bulk_key_hash
+		{
+			std::size_t
+			operator() (const bulk_key& key) const
+			{
+				return std::hash<world *> () (key.w) ^ ((std::size_t)key.id << 3)
+					^ ((std::size_t)key.cx << 7) ^ ((std::size_t)key.sy << 13)
+					^ ((std::size_t)key.cz << 17);
+			}
+		};
+		
 	public:
 		bool paused;
 		unsigned long long ticks;
@@ -158,6 +292,14 @@ namespace hCraft {
 		physics_manager &man;
 		std::minstd_rand rnd;
 		
+		std::unordered_map<bulk_key, std::vector<physics_bulk_entry>, bulk_key_hash>
+			bulk_groups;
+		std::unique_ptr<physics_snapshot> snap;
+		std::vector<physics_change> bulk_changes;
+		
+		std::vector<ph_world_queue *> wqs;
+		std::vector<ph_world_queue *> hungry;
+		
 		bool _running;
 		std::thread th;
 		
@@ -167,6 +309,22 @@ namespace hCraft {
 		 */
 		void main_loop ();
 		
+		/* 
+		 * Processes up to @{limit} due updates from the specified world's queue,
+		 * without going over the world's budget.
+		 * Returns the number of updates processed.
+		 */
+		int run_queue (ph_world_queue& wq, int limit, std::minstd_rand& rnd);
+		
+		void process (world *w, physics_update& u, std::minstd_rand& rnd);
+		
+		/* 
+		 * Runs all blocks collected for bulk processing during the current tick,
+		 * either through their type's bulk kernel, or one by one if there are
+		 * too few of them.
+		 */
+		void flush_bulk (std::minstd_rand& rnd);
+		
 	public:
 		/* 
 		 * Constructs and starts the worker thread.
@@ -191,22 +349,87 @@ namespace hCraft {
 		std::vector<std::shared_ptr<physics_worker>> workers;
 		std::mutex lock;
 		
-		std::unordered_map<world *,
-			std::unordered_map<chunk_pos, ph_mem_chunk, chunk_pos_hash>>
-				block_mem;
-				
+		// pending block memberships: a fixed table of buckets, each holding a
+		// chain of chunks.  lookups are lock-free, adding a chunk takes its
+		// bucket's lock.  idle chunks are unlinked by sweep_block_mem (), and
+		// freed once every thread that might still be reading them is done
+		// (see mem_read_guard).
+		static const int mem_buckets = 4096;
+		static const int mem_bucket_locks = 64;
+		std::atomic<ph_mem_chunk *> block_mem[mem_buckets];
+		std::mutex mem_bucket_lock[mem_bucket_locks];
+		
+		// threads currently reading block_mem, counted separately for the two
+		// phases that mem_phase alternates between (spread over several padded
+		// counters to keep threads off each other's cache lines; the managers are
+		// heap allocated, so alignas cannot be relied on before C++17).
+		static const int mem_reader_stripes = 16;
+		struct mem_reader_count { std::atomic<int> n; char pad[60]; };
+		mem_reader_count mem_readers[2][mem_reader_stripes];
+		std::atomic<int> mem_phase;
+		struct mem_read_guard;
+		
+		std::mutex mem_lock; // taken by the sweeper only
+		std::chrono::steady_clock::time_point last_sweep;
+		
+		// per-world queues, never erased while the manager is alive.
+		tbb::concurrent_unordered_map<int, ph_world_queue *> queues;
+		std::mutex sched_lock; // taken by the worker that rolls over the tick
+		std::chrono::steady_clock::time_point next_tick;
+		
 	public:
-		tbb::concurrent_queue<physics_update> updates;
 		server &srv;
+		
+		// the maximum number of updates processed by a single worker in a tick,
+		// shared fairly among all worlds.
+		int updates_per_tick;
+		
+		// the minimum number of same-typed blocks pending in a single subchunk
+		// for them to be processed by a bulk kernel (0 disables bulk mode).
+		int bulk_threshold;
+		
+		// if set, called by every worker at the end of each tick with the number
+		// of updates it processed and the time it took (used for benchmarking).
+		// must be set before any workers are started.
+		std::function<void (int, std::chrono::steady_clock::duration)> tick_hook;
 				
 	protected:
-		bool block_exists_nolock (world *w, int x, int y, int z);
-		void add_block_nolock (world *w, int x, int y, int z);
+		ph_mem_chunk* find_mem_chunk (world *w, int cx, int cz);
+		ph_mem_chunk* get_mem_chunk (world *w, int cx, int cz);
 		
 		bool block_exists (world *w, int x, int y, int z);
-		void add_block (world *w, int x, int y, int z);
+		
+		/* 
+		 * Marks the specified block as having a pending queue_physics_once ()
+		 * update.  Returns true if the block was not marked before.
+		 */
+		bool add_block (world *w, int x, int y, int z);
 		void remove_block (world *w, int x, int y, int z);
 		
+		/* 
+		 * Releases the memory used by regions that had no pending updates
+		 * since the last sweep.  Called periodically by the workers.
+		 */
+		void sweep_block_mem ();
+		
+		/* 
+		 * Waits until every thread that was reading block_mem when this was
+		 * called is done.
+		 */
+		void wait_for_mem_readers ();
+		
+		/* 
+		 * Resets per-tick budget counters and adjusts the slowdown factor of
+		 * every world according to its load.  Called by the workers at the start
+		 * of every tick, only one of them gets through every 50ms.
+		 */
+		void begin_tick ();
+		
+		/* 
+		 * Called when a world's queue reaches its limit.
+		 */
+		void overloaded (world *w, ph_world_queue& wq);
+		
 	public:
 		physics_manager (server &srv);
 		~physics_manager ();
@@ -223,6 +446,15 @@ namespace hCraft {
 		
 		
 		
+		ph_world_queue& get_queue (int wid);
+		
+		/* 
+		 * Pushes an update into its world's queue.
+		 */
+		void push_update (const physics_update& u);
+		
+		
+		
 		/* 
 		 * Queues an update to be processed by one of the workers:
 		 */
@@ -244,6 +476,13 @@ namespace hCraft {
 		 */
 		void queue_physics (world *w, int eid, bool persistent = true,
 			int tick_delay = 1, physics_params *params = nullptr);
+		
+		
+		/* 
+		 * Fills @{out} with the budget utilization of the specified world.
+		 * Returns false if the world has no updates queued in this manager.
+		 */
+		bool get_stats (world *w, physics_world_stats& out);
 	};
 }
 
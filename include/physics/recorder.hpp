@@ -0,0 +1,174 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft__PHYSICS__RECORDER_H_
+#define _hCraft__PHYSICS__RECORDER_H_
+
+#include "physics/physics.hpp"
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+
+namespace hCraft {
+	
+	class world;
+	
+	
+	enum physics_record_type: unsigned char
+	{
+		PRT_UPDATE,  // world::queue_update ()
+		PRT_PHYSICS, // world::queue_physics ()
+		PRT_SET,     // a block written directly by an edit stage commit
+	};
+	
+	enum
+	{
+		PRF_PHYSICS = 1, // PRT_UPDATE: trigger physics
+		PRF_PARAMS  = 2, // PRT_PHYSICS: `params' holds physics parameters
+		PRF_ONCE    = 4, // PRT_PHYSICS: queued through queue_physics_once ()
+	};
+	
+	struct physics_record
+	{
+		physics_record_type type;
+		unsigned char flags;
+		unsigned int time; // milliseconds since the start of the recording
+		
+		int x, y, z;
+		unsigned short id;
+		unsigned char meta;
+		unsigned char extra;
+		int data;
+		int tick_delay;
+		
+		physics_params params;
+	};
+	
+	struct physics_recorded_chunk
+	{
+		int cx, cz;
+		
+		// 65536 entries each, in YZX order.
+		std::vector<unsigned short> ids;
+		std::vector<unsigned char> meta;
+		std::vector<unsigned char> extra;
+	};
+	
+	
+	/* 
+	 * Thrown when a recording cannot be read or written.
+	 */
+	class physics_recording_error: public std::runtime_error
+	{
+	public:
+		physics_recording_error (const std::string& str)
+			: std::runtime_error (str)
+			{ }
+	};
+	
+	/* 
+	 * A region of a world as it was when recording started, followed by all
+	 * block changes and physics updates fed into the world from the outside
+	 * (players, commands, drawing operations) while it was being recorded.
+	 * Changes made by physics themselves are not recorded, since replaying the
+	 * input reproduces them.
+	 */
+	class physics_recording
+	{
+	public:
+		std::vector<physics_recorded_chunk> chunks;
+		std::vector<physics_record> records;
+		unsigned int duration; // in milliseconds
+		unsigned int skipped;  // updates with callbacks attached (not recordable)
+		
+	public:
+		physics_recording ();
+		
+		/* 
+		 * Reads\writes the recording from\to the specified file.
+		 * Throws `physics_recording_error' on failure.
+		 */
+		void save (const char *path) const;
+		void load (const char *path);
+		
+		
+		/* 
+		 * Copies the recorded region into the specified world.
+		 */
+		void apply_snapshot (world &w) const;
+		
+		/* 
+		 * Feeds a single record into the given world.
+		 */
+		static void replay (world &w, const physics_record& rec);
+		
+		/* 
+		 * Computes a checksum over the contents of the recorded region in the
+		 * specified world.
+		 */
+		unsigned long long checksum (world &w) const;
+	};
+	
+	
+	/* 
+	 * Attached to a world while it is being recorded (see
+	 * world::start_recording ()).
+	 */
+	class physics_recorder
+	{
+		physics_recording rec;
+		std::mutex lock;
+		std::chrono::steady_clock::time_point start;
+		
+	public:
+		/* 
+		 * Set in threads whose block changes are caused by other changes
+		 * (physics workers, world threads), so that only the outside input of a
+		 * world gets recorded.
+		 */
+		static thread_local bool suppressed;
+		
+	private:
+		unsigned int elapsed ();
+		
+	public:
+		/* 
+		 * Takes a snapshot of all loaded chunks within @{radius} chunks of the
+		 * given chunk coordinates.
+		 */
+		physics_recorder (world &w, int cx, int cz, int radius);
+		
+		void record_update (int x, int y, int z, unsigned short id,
+			unsigned char meta, int extra, int data, bool physics);
+		void record_physics (int x, int y, int z, int extra, int tick_delay,
+			physics_params *params, physics_block_callback cb, bool once);
+		void record_set (int x, int y, int z, unsigned short id,
+			unsigned char meta, unsigned char extra);
+		
+		/* 
+		 * Stops recording and returns the result.
+		 */
+		physics_recording& finish ();
+	};
+}
+
+#endif
+
@@ -22,6 +22,7 @@
 #include "entities/entity.hpp"
 #include "system/logger.hpp"
 #include "system/packet.hpp"
+#include "system/serial_executor.hpp"
 #include "world/world.hpp"
 #include "rank.hpp"
 #include "system/messages.hpp"
@@ -43,6 +44,7 @@
 #include <chrono>
 #include <event2/event.h>
 #include <event2/bufferevent.h>
+#include <event2/buffer.h>
 #include <functional>
 
 #include <cryptopp/aes.h>
@@ -110,6 +112,36 @@ namespace hCraft {
 			return ((this->w == other.w) && (this->cx == other.cx) && (this->cz == other.cz));
 		}
 	};
+	
+	class known_chunk_hash
+	{
+		std::hash<int> int_hash;
+		std::hash<world *> ptr_hash;
+		
+	public:
+		std::size_t
+		operator() (const known_chunk& kc) const
+		{
+			return int_hash (kc.cx) ^ (int_hash (kc.cz) << 5) ^ ptr_hash (kc.w);
+		}
+	};
+	
+	typedef std::unordered_set<known_chunk, known_chunk_hash> known_chunk_set;
+
+//------------
+	
+//------------
+	
+	/* 
+	 * A complete packet received from a player, held in a buffer taken from
+	 * the packet pool until it has been handled.
+	 */
+	struct received_packet
+	{
+		unsigned char *data;
+		unsigned int cap;
+		std::chrono::steady_clock::time_point received;
+	};
 
 //------------
 	
@@ -166,9 +198,7 @@ namespace hCraft {
 		bool disconnecting;
 		
 		bool reading;
-		unsigned char rdbuf[384];
-		int total_read;
-		int read_rem;
+		unsigned int dec_count; // decrypted bytes at the front of the input buffer
 		std::atomic_int handlers_scheduled;
 		CryptoPP::CFB_Mode<CryptoPP::AES>::Decryption *decryptor;
 		int rej_mov; // movement rejection
@@ -176,18 +206,27 @@ namespace hCraft {
 		unsigned char vtoken[4];
 		unsigned char ssec[16]; // shared secret
 		
-		// Using a thread pool to execute packet handling methods gives rise to a
-		// problem: Packets that must be executed in a certain order (such as, for
-		// example - 0x66 [window click] packets) are NOT guaranteed to be handled
-		// in the same order they were received. To solve this, received packets
-		// are first put into this queue, and only after a conclusion is made that
-		// it is indeed safe to call the packet callbacks, the packets in the queue
-		// are executed one after the other all at once in a pooled thread.
-		std::deque<unsigned char *> exec_queue;
+		// Packet handlers run in the server's thread pool, but packets that
+		// come from the same player must be handled one at a time and in the
+		// order they were received (window clicks, for example). Received
+		// packets are posted to this per-player strand, which guarantees just
+		// that while still letting different players be served in parallel.
+		serial_executor<received_packet> strand;
 		
 		bool writing;
-		std::queue<packet *> out_queue;
+		bool kick_sent; // the disconnect packet has been queued
 		std::mutex out_lock;
+		
+		// packets that carry world data (chunks and block changes) are held
+		// back in this lane and paced by a token bucket, so that a burst of
+		// chunks cannot delay keep-alives, movement or chat.  the rate follows
+		// what the connection is observed to drain.  see pace_output ().
+		std::deque<packet *> world_lane;
+		double pace_rate;   // bytes per second
+		double pace_tokens;
+		std::atomic<unsigned long long> bytes_drained;
+		unsigned long long pace_last_drained;
+		std::chrono::steady_clock::time_point pace_last;
 		CryptoPP::CFB_Mode<CryptoPP::AES>::Encryption *encryptor;
 		
 		bool ping_waiting;
@@ -207,10 +246,64 @@ namespace hCraft {
 		std::unordered_set<player *> visible_players;
 		std::mutex visible_player_lock;
 		
-		std::vector<known_chunk> pending_chunks;
+		// the world, chunk and radius with which the player is registered in
+		// that world's interest grid (nullptr if not registered).
+		world *interest_world;
+		int interest_x, interest_z;
+		int interest_radius;
+		std::mutex interest_lock;
+		
+		// the position (in 1/32 block units) and angles that players who can
+		// see us were last told about.  movement is broadcast once per tick, as
+		// a delta from these.  protected by visible_player_lock.
+		bool move_sent_valid;
+		int move_sent_x, move_sent_y, move_sent_z;
+		int move_sent_r, move_sent_l;
+		float move_sent_fr, move_sent_fl;
+		int ticks_since_abs_move;
+		
+		known_chunk_set pending_chunks;
 		std::queue<gen_response> response_chunks;
 		std::mutex response_chunks_lock;
 		bool need_new_chunks;
+		
+		// the square of chunks that were last requested by stream_chunks ().
+		// known chunks never lie outside of it, so that only the chunks that
+		// leave it have to be looked at when the player moves.
+		world *stream_world;
+		int stream_cx, stream_cz;
+		int stream_radius;
+		
+		// the radius (in chunks) that is streamed to the player.  it shrinks
+		// when the server or the player's connection fall behind, and grows back
+		// when they catch up.  what the player can see (can_see_chunk (), the
+		// interest grid) follows it.  see adjust_view_distance ().
+		std::atomic<int> view_distance;
+		std::atomic<int> slow_ticks; // ticks that ran late since the last adjustment
+		
+		// horizontal velocity (in blocks per second) estimated from successive
+		// positions given to move_to (), and the chunk around which chunks were
+		// last prefetched.  see prefetch_chunks ().
+		double move_vx, move_vz;
+		std::chrono::steady_clock::time_point last_move_time;
+		world *prefetch_world;
+		int prefetch_cx, prefetch_cz;
+		
+		// a teleport that waits for the area around its destination to be
+		// loaded, see teleport_when_ready ().  protected by tp_lock.  the world
+		// is kept by name, in case it gets unloaded in the meantime.
+		std::mutex tp_lock;
+		bool tp_pending;
+		bool tp_moving; // ready, and handed off to the thread pool
+		std::string tp_world;
+		entity_pos tp_dest;
+		std::chrono::steady_clock::time_point tp_requested;
+		
+		// set once a teleport is carried out, until the chunk the player landed
+		// in has been sent (for time-to-playable statistics).  the start time is
+		// protected by tp_lock.
+		std::atomic<bool> tp_measuring;
+		std::chrono::steady_clock::time_point tp_measure_start;
 				
 		std::chrono::steady_clock::time_point last_tick;
 		std::chrono::steady_clock::time_point last_heart_regen;
@@ -231,6 +324,7 @@ namespace hCraft {
 		// a list of all edit stages that should re-send their contents whenever
 		// the player crosses chunk boundaries.
 		std::unordered_set<edit_stage *> edstages;
+		std::atomic<int> edstage_count; // size of the above, readable without world_lock
 		sparse_edit_stage sb_updates; // selection block updates
 		
 	public:
@@ -240,7 +334,7 @@ namespace hCraft {
 		blocki sb_block;
 		std::mutex sb_lock;
 		
-		std::vector<known_chunk> known_chunks;
+		known_chunk_set known_chunks;
 		
 		inventory inv;
 		block_undo *bundo;
@@ -265,6 +359,19 @@ namespace hCraft {
 		static void handle_write (struct bufferevent *bufev, void *ctx);
 		static void handle_event (struct bufferevent *bufev, short events, void *ctx);
 		
+		static void handle_output_drain (struct evbuffer *buf,
+			const struct evbuffer_cb_info *info, void *ctx);
+		
+		/* 
+		 * Appends a packet to the output buffer.  out_lock must be held.
+		 */
+		void send_nolock (packet *pack);
+		
+		/* 
+		 * Drops all packets held back in the world lane.
+		 */
+		void clear_world_lane ();
+		
 		/* 
 		 * Packet handlers:
 		 * NOTE: These return 0 on success (any other value will disconnect the
@@ -302,22 +409,15 @@ namespace hCraft {
 		static int handle_pl_packet_16 (player *pl, packet_reader reader);
 		
 		
-		/* 
-		 * Examines the queue that holds packets pending to be handled by
-		 * appropriate callback methods in-order to conclude whether it is safe
-		 * to handle the packets. 
-		 */
-		bool test_packet_chain ();
-		
 		/* 
 		 * Executes the appropriate packet handler for the given byte array.
 		 */
 		int handle (const unsigned char *data);
 		
 		/* 
-		 * Executed in a thread pool task, spawned by handle ().
+		 * Called by the player's strand for every received packet.
 		 */
-		friend void handle_func (void *ctx);
+		void handle_received (received_packet& rp);
 		
 		
 	//----
@@ -340,8 +440,41 @@ namespace hCraft {
 		 */
 		void move_to (entity_pos dest);
 		
+		/* 
+		 * Sends movement made since the last tick to visible players.
+		 */
+		void broadcast_movement ();
+		
 		void update_home_chunk ();
 		
+		/* 
+		 * Shrinks or grows the player's view distance, within the bounds set by
+		 * its world, according to the load on the server and the player's own
+		 * backlog.  Called every time chunks are streamed.
+		 */
+		void adjust_view_distance ();
+		
+		/* 
+		 * Asks the chunk generator to warm up the chunks that the player is
+		 * about to need, based on where their current velocity will take them.
+		 */
+		void prefetch_chunks ();
+		
+		/* 
+		 * Registers the player in its world's interest grid around its current
+		 * chunk, or removes it from the grid altogether.
+		 */
+		void update_interest ();
+		void leave_interest ();
+		
+		/* 
+		 * Called every tick while a teleport is pending, to check whether its
+		 * destination is ready (or it has timed out), in which case the move
+		 * itself is handed off to the thread pool.
+		 */
+		void check_teleport ();
+		void finish_teleport ();
+		
 	//----
 		
 		/* 
@@ -381,13 +514,14 @@ namespace hCraft {
 		
 		inline bool is_reading () { return this->reading; }
 		inline bool is_writing () { return this->writing; }
-		inline bool is_handling_packets () { return (this->handlers_scheduled.load () > 0); }
+		inline bool is_handling_packets ()
+			{ return (this->handlers_scheduled.load () > 0) || this->strand.busy (); }
 		inline bool is_disconnecting () { return this->disconnecting; }
 		inline std::chrono::time_point<std::chrono::system_clock> disconnection_time ()
 			{ return this->fail_time; }
 		
 		inline std::mutex& get_world_lock () { return this->world_lock; }
-		static constexpr int chunk_radius () { return 5; }
+		static constexpr int chunk_radius () { return 5; } // the largest view distance
 		
 		inline window* get_open_window () { return this->open_win; }
 		inline slot_item& held_item () { return this->inv.get (this->held_slot); }
@@ -395,6 +529,7 @@ namespace hCraft {
 		inline gamemode_type gamemode () { return this->curr_gamemode; }
 		
 		inline int get_ping () { return this->ping_time_ms; }
+		inline int get_view_distance () { return this->view_distance; }
 		
 		// whether the player isn't valid anymore, and should be destroyed.
 		inline bool bad () { return this->fail || this->disconnecting; }
@@ -436,10 +571,19 @@ namespace hCraft {
 		
 		
 		/* 
-		 * Inserts the specified packet into the player's queue of outgoing packets.
+		 * Appends the specified packet to the player's output buffer.
+		 * The player takes over one reference to the packet, so the same packet
+		 * can be queued to several players by calling share () on it.
 		 */
 		void send (packet *pack);
 		
+		/* 
+		 * Refills the world lane's token bucket, adapts its rate to the drain
+		 * rate of the connection, and moves as many held back packets into the
+		 * output buffer as the bucket allows.  Called every tick.
+		 */
+		void pace_output ();
+		
 		/* 
 		 * Resends the block located at the given block coordinates.
 		 */
@@ -463,10 +607,11 @@ namespace hCraft {
 		void rejoin_world (bool respawn = true);
 		
 		/* 
-		 * Loads new close chunks to the player and unloads those that are too
-		 * far away.
+		 * Loads new close chunks to the player, nearest first and no more than
+		 * its budget allows, and unloads those that are outside of its current
+		 * view distance.
 		 */
-		void stream_chunks (int radius = player::chunk_radius ());
+		void stream_chunks ();
 		
 		/* 
 		 * Checks whether the specified chunk is within the visible chunk range
@@ -510,6 +655,14 @@ namespace hCraft {
 		 */
 		void teleport_to (entity_pos dest);
 		
+		/* 
+		 * Moves the player to the given world and position once the chunks
+		 * around the destination have been loaded, or once the configured
+		 * timeout runs out, whichever comes first.  The player stays where they
+		 * are in the meantime.  A newer request replaces a pending one.
+		 */
+		void teleport_when_ready (world *w, entity_pos dest);
+		
 		
 		
 		/* 
@@ -615,6 +768,13 @@ namespace hCraft {
 		void es_add (edit_stage *es);
 		void es_remove (edit_stage *es);
 		
+		/* 
+		 * Returns true if the player sees blocks that other players do not
+		 * (selection blocks, or edit stages of its own), in which case block
+		 * updates cannot simply be shared with other players.
+		 */
+		bool has_private_blocks ();
+		
 		
 		/* 
 		 * These three functions can be used to store additional general-purpose
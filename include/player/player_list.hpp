@@ -148,6 +148,12 @@ namespace hCraft {
 		 * Sends the specified packet to all players in this list.
 		 */
 		void send_to_all (packet *pack, player *except = nullptr);
+		
+		/* 
+		 * Sends the specified packet to all players that can see @{target}.  If
+		 * the target is in a world, only the observers of its chunk are visited
+		 * (see interest_grid).
+		 */
 		void send_to_all_visible (packet *pack, entity *target);
 	};
 }
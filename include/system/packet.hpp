@@ -21,6 +21,7 @@
 
 #include <cstdint>
 #include <vector>
+#include <atomic>
 #include "slot/slot.hpp"
 
 #include <cryptopp/rsa.h>
@@ -75,6 +76,14 @@ namespace hCraft {
 		unsigned int pos;
 		unsigned int cap;
 		
+		// number of owners.  once a packet is shared between several players,
+		// its contents must not be modified anymore.
+		std::atomic<int> refs;
+		
+		// set on disconnect packets: the connection is closed once this packet
+		// has been written out.
+		bool disconnect;
+		
 		/* 
 		 * Constructs a new packet that can hold up to the specified amount of bytes.
 		 */
@@ -90,6 +99,12 @@ namespace hCraft {
 		 */
 		~packet ();
 		
+		/* 
+		 * Packet objects and their buffers are taken from the packet pool.
+		 */
+		static void* operator new (std::size_t size);
+		static void operator delete (void *ptr, std::size_t size);
+		
 		
 		
 		/* 
@@ -118,6 +133,24 @@ namespace hCraft {
 		
 		void clear ();
 		
+		
+		/* 
+		 * Adds another owner to the packet, and returns it.  Used to queue the
+		 * same payload to several players without copying it.
+		 */
+		inline packet*
+		share ()
+		{
+			this->refs.fetch_add (1, std::memory_order_relaxed);
+			return this;
+		}
+		
+		/* 
+		 * Drops one reference to the specified packet, destroying it once no
+		 * owners are left.
+		 */
+		static void release (packet *pack);
+		
 	//----
 		
 		/* 
@@ -207,7 +240,7 @@ namespace hCraft {
 			packet* make_entity (int eid);
 			packet* make_entity_rel_move (int eid, double dx, double dy, double dz);
 			packet* make_entity_look (int eid, float r, float l);
-			packet* make_entity_look_and_rel_move (int eid, double dx, double dy, char dz,
+			packet* make_entity_look_and_rel_move (int eid, double dx, double dy, double dz,
 				float r, float l);
 			packet* make_entity_move (int eid, double x, double y, double z, float r, float l);
 			packet* make_entity_head_look (int eid, float r);
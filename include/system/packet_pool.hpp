@@ -0,0 +1,81 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft__PACKET_POOL_H_
+#define _hCraft__PACKET_POOL_H_
+
+#include <cstddef>
+
+
+namespace hCraft {
+	
+	/* 
+	 * Allocation counters of the packet pool.
+	 */
+	struct packet_pool_stats
+	{
+		unsigned long long requests;   // buffers and objects requested
+		unsigned long long hits;       // requests served from a free list
+		unsigned long long heap_allocs;
+		unsigned long long heap_frees;
+		unsigned long long oversized;  // buffers too large to be pooled
+		unsigned long long cached;     // bytes currently held in free lists
+	};
+	
+	
+	/* 
+	 * A size-classed free-list allocator for packet buffers and packet objects.
+	 * 
+	 * Packets are built on one thread and destroyed on another (usually the
+	 * network thread, once the packet has been written), at a rate of
+	 * hundreds of thousands per second on busy servers.  Freed buffers are
+	 * kept in per-size-class free lists and handed out again, so that in
+	 * steady state building a packet does not touch the heap at all.
+	 */
+	class packet_pool
+	{
+	public:
+		/* 
+		 * Returns a buffer that can hold at least @{size} bytes.
+		 * The buffer's actual capacity is stored in @{cap}, and must be passed
+		 * back to free ().
+		 */
+		static unsigned char* alloc (unsigned int size, unsigned int& cap);
+		
+		/* 
+		 * Returns the specified buffer to the pool.
+		 */
+		static void free (unsigned char *data, unsigned int cap);
+		
+		
+		/* 
+		 * Storage for packet objects themselves.
+		 */
+		static void* alloc_object (std::size_t size);
+		static void free_object (void *ptr, std::size_t size);
+		
+		
+		/* 
+		 * Fills the specified structure with the pool's allocation counters.
+		 */
+		static void get_stats (packet_pool_stats& st);
+	};
+}
+
+#endif
+
@@ -0,0 +1,136 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft__SERIAL_EXECUTOR_H_
+#define _hCraft__SERIAL_EXECUTOR_H_
+
+#include "system/threadpool.hpp"
+#include <deque>
+#include <mutex>
+#include <functional>
+
+
+namespace hCraft {
+	
+	/* 
+	 * A serial executor (strand) on top of a thread pool.
+	 * 
+	 * Items posted to the executor are passed to its handler one at a time, in
+	 * the order they were posted, by whichever pooled thread happens to pick
+	 * the executor up.  Separate executors run in parallel.  At most one pool
+	 * task is scheduled per executor at any time, and it hands its thread back
+	 * after a batch of items so that busy executors do not starve others.
+	 */
+	template<typename T>
+	class serial_executor
+	{
+		thread_pool& pool;
+		std::function<void (T&)> handler;
+		int batch;
+		
+		std::mutex lock;
+		std::deque<T> items;
+		bool scheduled;
+		
+	private:
+		static void
+		run (void *ptr)
+		{
+			serial_executor *ex = static_cast<serial_executor *> (ptr);
+			
+			for (int n = 0; ; ++n)
+				{
+					T item;
+					{
+						std::lock_guard<std::mutex> guard {ex->lock};
+						if (ex->items.empty ())
+							{
+								ex->scheduled = false;
+								return;
+							}
+						
+						if (n == ex->batch)
+							{
+								// let other executors have a go.
+								ex->pool.enqueue (&serial_executor::run, ex);
+								return;
+							}
+						
+						item = std::move (ex->items.front ());
+						ex->items.pop_front ();
+					}
+					
+					ex->handler (item);
+				}
+		}
+		
+	public:
+		serial_executor (thread_pool& pool, std::function<void (T&)>&& handler,
+			int batch = 32)
+			: pool (pool), handler (std::move (handler)), batch (batch)
+		{
+			this->scheduled = false;
+		}
+		
+		serial_executor (const serial_executor&) = delete;
+		
+		
+		/* 
+		 * Queues the specified item, scheduling the executor on the pool if it
+		 * is not running already.
+		 */
+		void
+		post (T&& item)
+		{
+			std::lock_guard<std::mutex> guard {this->lock};
+			this->items.push_back (std::move (item));
+			if (!this->scheduled)
+				{
+					this->scheduled = true;
+					this->pool.enqueue (&serial_executor::run, this);
+				}
+		}
+		
+		/* 
+		 * Returns true if items are queued or being handled.
+		 */
+		bool
+		busy ()
+		{
+			std::lock_guard<std::mutex> guard {this->lock};
+			return this->scheduled;
+		}
+		
+		/* 
+		 * Removes all queued items without handling them, passing each to the
+		 * specified function.
+		 */
+		template<typename F>
+		void
+		clear (F f)
+		{
+			std::lock_guard<std::mutex> guard {this->lock};
+			for (T& item : this->items)
+				f (item);
+			this->items.clear ();
+		}
+	};
+}
+
+#endif
+
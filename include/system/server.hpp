@@ -35,6 +35,7 @@
 #include "system/messages.hpp"
 #include "irc/irc.hpp"
 #include "slot/crafting.hpp"
+#include "util/histogram.hpp"
 
 #include <soci/soci.h>
 #include <unordered_map>
@@ -99,10 +100,59 @@ namespace hCraft {
 		std::string irc_chan;
 		std::string irc_nick;
 		
+		// physics:
+		int ph_world_budget;
+		int ph_world_max_pending;
+		
+		// chunk streaming:
+		int view_min;
+		int view_max;
+		int stream_chunks_per_tick;
+		int teleport_timeout; // in milliseconds
+		
+		// trickle saving (0 chunks per tick disables it):
+		int save_chunks_per_tick;
+		int save_bytes_per_tick;
+		int save_max_dirty_age; // in seconds
+		
 		std::set<std::string> dcmds; // disabled commands
 	};
 	
 	
+	/* 
+	 * Counters of the network path, shared by all connections.
+	 */
+	struct network_stats
+	{
+		std::atomic<unsigned long long> packets_out;
+		std::atomic<unsigned long long> bytes_out;
+		std::atomic<unsigned long long> writes; // write syscalls that sent data
+		
+		// player movement broadcasts (bytes counted once per recipient).
+		std::atomic<unsigned long long> move_packets;
+		std::atomic<unsigned long long> move_bytes;
+		
+		// chunk and block packets that were held back by output pacing.
+		std::atomic<unsigned long long> paced_packets;
+		
+		// time received packets spend queued in their player's strand, and
+		// time spent in their handler, by packet id.
+		latency_histogram handler_wait[256];
+		latency_histogram handler_time[256];
+		
+		// teleports: time spent waiting for the destination to load, and time
+		// from the request until the chunk the player lands in was sent.
+		latency_histogram teleport_wait;
+		latency_histogram teleport_playable;
+		std::atomic<unsigned long long> teleport_timeouts;
+		
+		network_stats ()
+			: packets_out (0), bytes_out (0), writes (0), move_packets (0),
+				move_bytes (0), paced_packets (0), teleport_timeouts (0)
+			{ }
+	};
+	
+	
 	struct muted_player {
 		char username[17];
 		int seconds;
@@ -174,6 +224,7 @@ namespace hCraft {
 		std::vector<initializer> inits; // <init, destroy> pairs
 		bool running;
 		bool shutting_down;
+		bool headless;
 		
 		std::vector<worker> workers;
 		int worker_count;
@@ -187,6 +238,7 @@ namespace hCraft {
 		std::unordered_set<player *> to_destroy;
 		std::mutex player_lock;
 		crafting_manager craftman;
+		network_stats nstats;
 		
 		std::mutex id_lock;
 		int entity_id_counter;
@@ -344,6 +396,7 @@ namespace hCraft {
 	public:
 		inline bool is_running () { return this->running; }
 		inline bool is_shutting_down () { return this->shutting_down; }
+		inline bool is_headless () { return this->headless; }
 		
 		inline const server_config& get_config () { return this->cfg; }
 		inline logger& get_logger () { return this->log; }
@@ -357,6 +410,7 @@ namespace hCraft {
 		inline group_manager& get_groups () { return this->groups; }
 		inline world_list& get_worlds () { return this->worlds; }
 		inline crafting_manager& get_crafting_manager () { return this->craftman; }
+		inline network_stats& get_net_stats () { return this->nstats; }
 		
 		inline std::mutex& get_player_lock () { return this->player_lock; }
 		
@@ -398,6 +452,13 @@ namespace hCraft {
 		 */
 		void stop ();
 		
+		/* 
+		 * Prepares the server to host worlds without starting any of its
+		 * subsystems (configuration file, database, network, commands...).
+		 * Used by offline tools such as the physics benchmark.
+		 */
+		void start_headless ();
+		
 		
 		
 //-----
@@ -0,0 +1,69 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft__HISTOGRAM_H_
+#define _hCraft__HISTOGRAM_H_
+
+#include <atomic>
+#include <chrono>
+
+
+namespace hCraft {
+	
+	/* 
+	 * A lock-free histogram of durations, with power-of-two microsecond
+	 * buckets: bucket 0 holds samples under 1us, bucket i samples in
+	 * [2^(i-1), 2^i) microseconds, and the last bucket everything above.
+	 */
+	class latency_histogram
+	{
+	public:
+		static const int bucket_count = 24;
+		
+	private:
+		std::atomic<unsigned long long> buckets[bucket_count];
+		std::atomic<unsigned long long> total_us;
+		
+	public:
+		latency_histogram ();
+		
+		/* 
+		 * Records a single sample.
+		 */
+		void record (std::chrono::steady_clock::duration d);
+		
+		/* 
+		 * Returns the number of recorded samples.
+		 */
+		unsigned long long count () const;
+		
+		/* 
+		 * Returns the average sample, in microseconds.
+		 */
+		double mean_us () const;
+		
+		/* 
+		 * Returns an upper bound (in microseconds) for the specified percentile
+		 * (0.0 - 1.0) of the recorded samples.
+		 */
+		unsigned long long percentile_us (double p) const;
+	};
+}
+
+#endif
+
@@ -284,6 +284,13 @@ namespace hCraft {
 		 * NOTE: Only block data is copied.
 		 */
 		chunk* duplicate ();
+		
+		/* 
+		 * Returns a copy of this chunk that can be written to disk while the
+		 * original keeps changing.  Unlike duplicate (), signs and the generated
+		 * flag are copied as well.
+		 */
+		chunk* snapshot ();
 	};
 	
 	
@@ -21,9 +21,11 @@
 
 #include <thread>
 #include <queue>
+#include <deque>
 #include <mutex>
 #include <vector>
 #include <map>
+#include <atomic>
 
 
 namespace hCraft {
@@ -65,12 +67,19 @@ namespace hCraft {
 		// with this flag on, the generator will not make any attempts to cancel
 		// the generation of a chunk, for whatever reason.
 		GFL_NOABORT = (1 << 2),
+		
+		// a speculative request made ahead of a moving player.  the chunk and its
+		// neighbours are loaded into the world without being delivered, and only
+		// when no regular request is waiting.  dropped once the player is no
+		// longer headed that way.
+		GFL_PREFETCH = (1 << 3),
 	};
 	
 	
 	struct generator_queue {
 		int pid;
 		std::queue<gen_request> requests;
+		std::deque<gen_request> prefetch;
 		unsigned int counter;
 	};
 	
@@ -89,6 +98,8 @@ namespace hCraft {
 		std::vector<generator_queue *> queues;
 		std::map<int, int> index_map;
 		std::mutex request_mutex;
+		std::atomic<int> backlog_size;
+		unsigned int prefetch_rr;
 		
 	private:
 		/* 
@@ -96,6 +107,12 @@ namespace hCraft {
 		 */
 		void main_loop ();
 		
+		/* 
+		 * Pops the next prefetch request, taking turns between players.
+		 * request_mutex must be held.
+		 */
+		bool pop_prefetch (gen_request& req);
+		
 	public:
 		chunk_generator ();
 		~chunk_generator ();
@@ -117,6 +134,9 @@ namespace hCraft {
 		/* 
 		 * Requests the chunk located at the given coordinates to be generated.
 		 * The specified player is then informed when it's ready.
+		 * 
+		 * Requests flagged with GFL_PREFETCH go to a separate, bounded queue
+		 * that is only served when the generator would otherwise be idle.
 		 */
 		void request (world *w, int cx, int cz, int pid, int flags = 0, int extra = 0);
 		
@@ -124,6 +144,12 @@ namespace hCraft {
 		 * Cancels all chunk requests for the given world.
 		 */
 		void cancel_requests (world *w);
+		
+		/* 
+		 * Returns the number of requests that are waiting to be processed, by
+		 * all players.  Prefetch requests are not counted.
+		 */
+		inline int backlog () const { return this->backlog_size.load (); }
 	};
 }
 
@@ -0,0 +1,84 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft__INTEREST_H_
+#define _hCraft__INTEREST_H_
+
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <functional>
+
+
+namespace hCraft {
+	
+	class player;
+	
+	
+	/* 
+	 * Keeps track of which players observe which chunks of a world.
+	 * 
+	 * A player observes every chunk within its view radius of its home chunk.
+	 * Observers are only updated when a player crosses a chunk border, and
+	 * then only for the chunks that came into or went out of view, so looking
+	 * up the players that can see a chunk does not depend on the number of
+	 * players in the world.
+	 */
+	class interest_grid
+	{
+		std::unordered_map<unsigned long long, std::vector<player *>> cells;
+		std::mutex lock;
+		
+	private:
+		void add_nolock (player *pl, int cx, int cz);
+		void remove_nolock (player *pl, int cx, int cz);
+		
+	public:
+		/* 
+		 * Makes the specified player observe all chunks within @{radius} chunks
+		 * of chunk (@{cx}, @{cz}).
+		 */
+		void add (player *pl, int cx, int cz, int radius);
+		
+		/* 
+		 * Undoes a previous call to add ().
+		 */
+		void remove (player *pl, int cx, int cz, int radius);
+		
+		/* 
+		 * Moves a player's view from chunk (@{ox}, @{oz}) to (@{nx}, @{nz}),
+		 * touching only the chunks that entered or left the view.
+		 */
+		void move (player *pl, int ox, int oz, int nx, int nz, int radius);
+		
+		
+		/* 
+		 * Calls @{f} on every player that observes chunk (@{cx}, @{cz}).
+		 * The grid is locked while @{f} runs.
+		 */
+		void observers (int cx, int cz, std::function<void (player *)> f);
+		
+		/* 
+		 * Returns true if any player observes chunk (@{cx}, @{cz}).
+		 */
+		bool observed (int cx, int cz);
+	};
+}
+
+#endif
+
@@ -0,0 +1,282 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft__HWLPROVIDER_H_
+#define _hCraft__HWLPROVIDER_H_
+
+#include "worldprovider.hpp"
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <pthread.h>
+
+
+namespace hCraft {
+	
+	class hw_provider;
+	
+	
+	class hwl_provider_naming: public world_provider_naming
+	{
+	public:
+		virtual const char* provider_name ()
+			{ return "hwl"; }
+		
+		
+		/* 
+		 * Returns true if the format is stored within a separate directory
+		 * (like Anvil).
+		 */
+		virtual bool is_directory_format ()
+			{ return true; }
+		
+		/* 
+		 * Adds required prefixes, suffixes, etc... to the specified world name so
+		 * that the importer's claims_name () function returns true when passed to
+		 * it.
+		 */
+		virtual std::string make_name (const char *world_name);
+		
+		/* 
+		 * Checks whether the specified path name meets the format required by this
+		 * exporter (could be a name prefix, suffix, extension, etc...).
+		 */
+		virtual bool claims_name (const char *path);
+	};
+	
+	
+	/* 
+	 * A file that chunk records are appended to.
+	 */
+	struct hwl_segment
+	{
+		unsigned int id;
+		int fd;
+		unsigned long long size; // bytes of valid records
+		unsigned long long live; // bytes taken up by records still in the index
+		bool dirty;              // written to since it was last synced
+	};
+	
+	/* 
+	 * Where the latest record of a chunk is stored.
+	 */
+	struct hwl_entry
+	{
+		unsigned int seg;
+		unsigned long long offset; // of the record's header
+		unsigned int size;         // of the compressed chunk data
+	};
+	
+	/* 
+	 * World provider for the HWL (log-structured hCraft world) format.
+	 * 
+	 * A world is a directory.  Chunks are never rewritten in place: every save
+	 * appends a record to the newest segment file, and an in-memory index,
+	 * rebuilt on startup by replaying the segments in order, points to the
+	 * latest record of every chunk.  Segments that are mostly made up of
+	 * outdated records are compacted by a background thread, which copies the
+	 * live records to the newest segment and deletes the old file.
+	 * 
+	 * Everything else (world information, portals, zones, security) is kept in
+	 * a small HWv1 file within the same directory.
+	 */
+	class hwl_provider: public world_provider
+	{
+		std::string out_path; // the world's directory
+		hw_provider *meta;
+		world_information inf;
+		
+		// segment and index tables.  lock is held for reading by loads, and for
+		// writing by anything that appends records or changes the tables.
+		std::map<unsigned int, hwl_segment> segs;
+		std::unordered_map<unsigned long long, hwl_entry> index;
+		unsigned int active; // segment appended to, 0 if a new one is needed
+		pthread_rwlock_t lock;
+		
+		std::thread compactor;
+		std::mutex compact_lock;
+		std::mutex compact_run; // held while a segment is being compacted
+		std::condition_variable compact_cv;
+		std::atomic<bool> compact_wanted;
+		std::atomic<bool> stopping;
+		
+	private:
+		void replay ();
+		bool replay_segment (hwl_segment& seg, bool last);
+		
+		/* 
+		 * Appends a chunk record to the active segment and points the index at
+		 * it.  lock must be held for writing.
+		 */
+		void append (const unsigned char *data, unsigned int size, int x, int z);
+		
+		void sync_segments ();
+		
+		void compact_worker ();
+		bool compact_one ();
+		
+	public:
+		/* 
+		 * Constructs a new world provider for the HWL format.
+		 */
+		hwl_provider (const char *path, const char *world_name);
+		
+		/* 
+		 * Class destructor.
+		 */
+		~hwl_provider ();
+		
+		
+		
+		/* 
+		 * Returns the name of this world provider.
+		 */
+		virtual const char* name () override
+			{ return "hwl"; }
+		
+		
+		
+		/* 
+		 * Opens the underlying file stream for reading\writing.
+		 * By using open () and close (), multiple chunks can be read\written
+		 * without reopening the world file everytime.
+		 */
+		virtual void open (world &wr) override;
+		
+		/* 
+		 * Closes the underlying file stream, and makes sure that everything
+		 * appended so far has reached the disk.
+		 */
+		virtual void close () override;
+		
+		
+		
+		/* 
+		 * Saves only the specified chunk.
+		 */
+		virtual void save (world& wr, chunk *ch, int x, int z) override;
+		
+		/* 
+		 * Serializes and compresses the specified chunk so that it can be written
+		 * out later by save_prepared ().
+		 */
+		virtual bool prepare_save (chunk *ch, std::vector<unsigned char>& out) override;
+		
+		/* 
+		 * Writes out a chunk that has been prepared by prepare_save ().
+		 */
+		virtual void save_prepared (world& wr, const std::vector<unsigned char>& data,
+			int x, int z) override;
+		
+		/* 
+		 * Saves the specified world without writing out any chunks.
+		 * NOTE: If a world already exists at the destination path, an empty
+		 *       template will NOT be written out.
+		 */
+		virtual void save_empty (world &wr) override;
+		
+		/* 
+		 * Updates world information for a given world. 
+		 */
+		virtual void save_info (world &w, const world_information &info) override;
+		
+		
+		
+		/* 
+		 * Saves the specified list of portals to disk.
+		 */
+		virtual void save_portals (world &wr, const std::vector<portal *>& portals) override;
+		
+		/* 
+		 * Loads the portal list from disk into the given vector.
+		 */
+		virtual void load_portals (world &wr, std::vector<portal *>& portals) override;
+		
+		
+		
+		/* 
+		 * Saves the specified list of zones to disk.
+		 */
+		virtual void save_zones (world &wr,  const std::vector<zone *>& zones) override;
+		
+		/* 
+		 * Loads the zone list from disk into the given vector.
+		 */
+		virtual void load_zones (world &wr, std::vector<zone *>& zones) override;
+		
+		
+		
+		/* 
+		 * Updates\saves owner\member list, build\join permissions, etc...
+		 */
+		virtual void save_security (world &w, const world_security& sec) override;
+		
+		/* 
+		 * Loads world security information.
+		 */
+		virtual void load_security (world &w, world_security& sec) override;
+		
+		
+		
+		/* 
+		 * Checks whether the directory located at @{path} holds a world of this
+		 * format.
+		 */
+		virtual bool claims (const char *path) override;
+		
+		/* 
+		 * Attempts to load the chunk located at the specified coordinates into
+		 * @{ch}. Returns true on success, and false if the chunk is not present
+		 * within the world.
+		 */
+		virtual bool load (world &wr, chunk *ch, int x, int z) override;
+		
+		/* 
+		 * Records are read with pread (), which allows for loads from multiple
+		 * threads.
+		 */
+		virtual bool concurrent_loads () override
+			{ return true; }
+		
+		/* 
+		 * Deletes all segments and the metadata file.  The directory itself is
+		 * kept.
+		 */
+		virtual void clear (world &wr) override;
+		
+		/* 
+		 * Loads world information into the specified structure.
+		 */
+		virtual const world_information& info () override
+			{ return this->inf; }
+		
+		
+		
+		/* 
+		 * Returns the filesystem path to the world's directory.
+		 */
+		virtual const char* get_path () override;
+	};
+}
+
+#endif
+
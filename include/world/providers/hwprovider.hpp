@@ -22,92 +22,101 @@
 #include "worldprovider.hpp"
 #include <fstream>
 #include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <cstddef>
+#include <pthread.h>
 
 
 namespace hCraft {
 	
 //----
+	/* 
+	 * A chunk's header: the size of its compressed data, and the sectors that
+	 * hold it.  Headers are read from the world file when they are needed.
+	 */
 	struct hw_chunk
 	{
-		int offset;
+		unsigned int offset; // of the header, in 512-byte units
 		int x;
 		int z;
 		unsigned int sector_table[256];
 		int size;
-		
-		hw_chunk (int x, int z)
-		{
-			this->x = x;
-			this->z = z;
-			this->size = 0;
-			for (int i = 0; i < 256; ++i)
-				sector_table[i] = 0;
-		}
 	};
 	
-	struct hw_region
+	/* 
+	 * An occupied slot in one of the tables of the superblock -> block ->
+	 * region -> chunk tree.
+	 */
+	struct hw_slot
 	{
-		int offset;
+		unsigned int index;
 		int x, z;
-		hw_chunk* chunks[1024];
-		
-		hw_region (int x, int z)
-		{
-			this->x = x;
-			this->z = z;
-			for (int i = 0; i < 1024; ++i)
-				this->chunks[i] = nullptr;
-		}
-		
-		~hw_region ()
-		{
-			for (int i = 0; i < 1024; ++i)
-				delete this->chunks[i];
-		}
+		unsigned int offset; // of the child table or chunk header
 	};
+//----
+	
+	/* 
+	 * Serializes and compresses a chunk into the chunk format used by HWv1
+	 * world files.  Other providers may store chunks in the same format.
+	 */
+	void hw_compress_chunk (chunk *ch, std::vector<unsigned char>& out);
+	
+	/* 
+	 * Inflates a chunk produced by hw_compress_chunk () into @{ch}.
+	 * Throws std::runtime_error if the data is corrupt.
+	 */
+	void hw_decompress_chunk (chunk *ch, const unsigned char *data,
+		unsigned int size);
 	
-	struct hw_block
-	{
-		int offset;
-		int x, z;
-		hw_region* regions[1024];
-		
-		hw_block (int x, int z)
-		{
-			this->x = x;
-			this->z = z;
-			for (int i = 0; i < 1024; ++i)
-				this->regions[i] = nullptr;
-		}
-		
-		~hw_block ()
-		{
-			for (int i = 0; i < 1024; ++i)
-				delete this->regions[i];
-		}
-	};
 	
-	struct hw_superblock
+	
+	/* 
+	 * Keeps track of 4096-byte chunk data sectors that are no longer in use
+	 * (left behind by chunks that have shrunk or moved), so that they can be
+	 * handed out again.  Offsets are in 512-byte units, like everywhere else
+	 * in the format.
+	 */
+	class hw_sector_map
 	{
-		int offset;
-		int x, z;
-		hw_block* blocks[64];
-		
-		hw_superblock (int x, int z)
-		{
-			this->x = x;
-			this->z = z;
-			for (int i = 0; i < 64; ++i)
-				this->blocks[i] = nullptr;
-		}
-		
-		~hw_superblock ()
-		{
-			for (int i = 0; i < 64; ++i)
-				delete this->blocks[i];
-		}
+		std::map<unsigned int, unsigned int> runs; // offset -> sector count
+		std::set<std::pair<unsigned int, unsigned int>> by_size; // (count, offset)
+		
+	private:
+		void add_run (unsigned int offset, unsigned int count);
+		void remove_run (std::map<unsigned int, unsigned int>::iterator itr);
+		
+	public:
+		/* 
+		 * Takes @{count} contiguous sectors out of the map, from the smallest run
+		 * that is large enough.  Returns false if no run is.
+		 */
+		bool alloc (unsigned int count, unsigned int& offset);
+		
+		/* 
+		 * Returns @{count} contiguous sectors starting at @{offset} to the map.
+		 */
+		void release (unsigned int offset, unsigned int count = 1);
+		
+		/* 
+		 * Makes sure that the sector at @{offset} is not considered free.
+		 */
+		void claim (unsigned int offset);
+		
+		void clear ();
+		
+		/* 
+		 * Returns the number of free sectors.
+		 */
+		unsigned int total () const;
+		
+		std::vector<unsigned char> serialize () const;
+		void deserialize (const unsigned char *data, unsigned int size);
 	};
-//----
+	
+	
 	
 	class hw_provider_naming: public world_provider_naming
 	{
@@ -151,21 +160,87 @@ namespace hCraft {
 	class hw_provider: public world_provider
 	{
 		std::string out_path;
-		hw_superblock *sblocks[4096];
 		std::fstream strm;
 		
 		world_information inf;
 		
 		std::vector<hw_layer> layers;
 		
+		// free chunk data sectors.  stored in the "free-sectors" layer when the
+		// world file is closed, and checked against the chunk tables on load,
+		// so a stale copy can only ever leak sectors.
+		hw_sector_map free_sectors;
+		bool free_dirty;
+		bool free_checked;
+		
+		// chunk coordinates -> offset of the chunk's header.  built on first
+		// access, from the "chunk-index" layer if it is up to date, or by
+		// walking the tree otherwise, and stored back when the file is closed.
+		std::unordered_map<unsigned long long, unsigned int> chunk_index;
+		bool index_ready;
+		bool index_dirty;
+		bool count_dirty;
+		
+		// occupied slots of the tree tables that chunks have been inserted
+		// through, keyed by the table's position in the file.  only read in when
+		// a new chunk has to be added.
+		std::unordered_map<unsigned int, std::vector<hw_slot>> table_cache;
+		
+		// a read-only mapping of the world file that chunks are loaded from.
+		// map_lock is held for reading by loads, and for writing by anything
+		// that modifies chunk data or the in-memory tables.  writes go through
+		// strm and are flushed before the lock is released, after which the
+		// mapping is marked as stale, so that the next load remaps the file if
+		// it has grown.
+		int map_fd;
+		unsigned char *map_data;
+		size_t map_size;
+		bool map_stale;
+		pthread_rwlock_t map_lock;
+		
 	private:
 		void read_layer_table (std::fstream& strm);
+		void load_free_sectors ();
+		
+		/* 
+		 * Builds the chunk index if that has not been done yet.  map_lock must
+		 * be held for writing.
+		 */
+		void ensure_index ();
+		
+		/* 
+		 * Drops sectors used by chunks from the free sector map loaded from
+		 * disk, before anything is allocated from it.
+		 */
+		void check_free_sectors ();
+		
+		/* 
+		 * Returns the offset of the header of the chunk at the specified
+		 * coordinates, adding the chunk (and any tables on the way) to the
+		 * file if it is not there yet.  Returns 0xFFFFFFFF if a table is full.
+		 */
+		unsigned int find_or_create_chunk (int x, int z, bool *created);
+		unsigned int find_or_create_slot (unsigned int table_pos,
+			unsigned int slot_count, int x, int z, unsigned int child_slots,
+			bool *created);
+		
+		void read_chunk_header (unsigned int offset, hw_chunk& hch);
+		bool write_chunk (const std::vector<unsigned char>& compressed, int x, int z);
+		
+		/* 
+		 * (Re)maps the world file if it has grown since it was last mapped.
+		 * map_lock must be held for writing.
+		 */
+		void remap ();
+		void unmap ();
 		
 	protected:
 		void write_layer (const char *layer_name, const unsigned char *data,
 			unsigned int layer_size);
 		
 		unsigned char* read_layer (const char *layer_name, unsigned int& data_size);
+		unsigned char* read_layer (std::istream& in, const char *layer_name,
+			unsigned int& data_size);
 		
 	public:
 		/* 
@@ -207,6 +282,18 @@ namespace hCraft {
 		 */
 		virtual void save (world& wr, chunk *ch, int x, int z) override;
 		
+		/* 
+		 * Serializes and compresses the specified chunk so that it can be written
+		 * out later by save_prepared ().
+		 */
+		virtual bool prepare_save (chunk *ch, std::vector<unsigned char>& out) override;
+		
+		/* 
+		 * Writes out a chunk that has been prepared by prepare_save ().
+		 */
+		virtual void save_prepared (world& wr, const std::vector<unsigned char>& data,
+			int x, int z) override;
+		
 		/* 
 		 * Saves the specified world without writing out any chunks.
 		 * NOTE: If a world file already exists at the destination path, an empty
@@ -270,12 +357,31 @@ namespace hCraft {
 		 */
 		virtual bool load (world &wr, chunk *ch, int x, int z) override;
 		
+		/* 
+		 * Chunks are read from a memory mapping of the world file, which allows
+		 * for loads from multiple threads.
+		 */
+		virtual bool concurrent_loads () override
+			{ return true; }
+		
 		/* 
 		 * Loads world information into the specified structure.
 		 */
 		virtual const world_information& info () override
 			{ return this->inf; }
 		
+		/* 
+		 * Rewrites the world file with all chunk tables first, followed by the
+		 * chunks' data in Morton (Z-order) order, so that neighbouring chunks are
+		 * stored next to each other and free sectors are dropped.
+		 */
+		virtual bool defragment (world &wr) override;
+		
+		/* 
+		 * Deletes the world file.
+		 */
+		virtual void clear (world &wr) override;
+		
 		
 		
 		/* 
@@ -140,6 +140,23 @@ namespace hCraft {
 		 */
 		virtual void save (world& wr, chunk *ch, int x, int z) = 0;
 		
+		/* 
+		 * Serializes and compresses the specified chunk so that it can be written
+		 * out later by save_prepared ().  Does not touch the underlying file, and
+		 * may be called from several threads at once.  Returns false if the
+		 * provider does not support split saving, in which case save () should
+		 * be used instead.
+		 */
+		virtual bool prepare_save (chunk *ch, std::vector<unsigned char>& out)
+			{ return false; }
+		
+		/* 
+		 * Writes out a chunk that has been prepared by prepare_save ().
+		 */
+		virtual void save_prepared (world& wr, const std::vector<unsigned char>& data,
+			int x, int z)
+			{ }
+		
 		/* 
 		 * Saves the specified world without writing out any chunks.
 		 * NOTE: If a world file already exists at the destination path, an empty
@@ -204,6 +221,29 @@ namespace hCraft {
 		 */
 		virtual bool load (world &wr, chunk *ch, int x, int z) = 0;
 		
+		/* 
+		 * Returns true if load () can be called from several threads at once,
+		 * without being surrounded by open () and close ().
+		 */
+		virtual bool concurrent_loads ()
+			{ return false; }
+		
+		/* 
+		 * Rewrites the world's chunks so that they are laid out in spatial order
+		 * and take up as little space as possible.  Must not be called while
+		 * chunks are being saved.  Returns false if the provider does not
+		 * support this.
+		 */
+		virtual bool defragment (world &wr)
+			{ return false; }
+		
+		/* 
+		 * Deletes everything stored for the world, so that it starts out empty
+		 * the next time it is saved.  Must not be called while chunks are being
+		 * saved.
+		 */
+		virtual void clear (world &wr) = 0;
+		
 		/* 
 		 * Returns a structure that contains essential information about the
 		 * underlying world.
@@ -0,0 +1,105 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft__WORLD_TRANSACTION_H_
+#define _hCraft__WORLD_TRANSACTION_H_
+
+#include "world/world.hpp"
+#include <vector>
+
+
+namespace hCraft {
+	
+	/* 
+	 * A batch of block updates that is built up by a single thread (usually a
+	 * physics worker) and then handed over to the world in one go.
+	 * 
+	 * Reads made through the transaction observe the writes that were already
+	 * staged in it, so code that inspects its own neighbourhood after moving
+	 * a block sees a consistent picture.  On commit, all updates are enqueued
+	 * under a single acquisition of the world's update lock and are applied
+	 * by the world thread within the same tick.
+	 */
+	class world_transaction
+	{
+		static const int inline_updates = 8;
+		
+	private:
+		world &w;
+		
+		block_update inl[inline_updates];
+		int inl_count;
+		std::vector<block_update> overflow;
+		
+	private:
+		/* 
+		 * Returns the most recently staged update made to the specified block,
+		 * or null if the block has not been touched by this transaction.
+		 */
+		const block_update* find (int x, int y, int z) const;
+		
+	public:
+		inline world& get_world () { return this->w; }
+		
+		inline int size () const
+			{ return this->inl_count + (int)this->overflow.size (); }
+		inline bool empty () const
+			{ return this->inl_count == 0; }
+		
+		inline block_update& at (int index)
+			{ return (index < inline_updates) ? this->inl[index]
+				: this->overflow[index - inline_updates]; }
+		inline const block_update& at (int index) const
+			{ return (index < inline_updates) ? this->inl[index]
+				: this->overflow[index - inline_updates]; }
+		
+	public:
+		world_transaction (world &w);
+		
+		/* 
+		 * Stages an update to the block at the specified coordinates.
+		 */
+		void set (int x, int y, int z, unsigned short id,
+			unsigned char meta = 0, int extra = 0, int data = 0, void *ptr = nullptr,
+			player *pl = nullptr, bool physics = true);
+		
+		/* 
+		 * Block queries that take staged updates into account.
+		 * get_block () and get_id () fall back to the world's current state,
+		 * while get_final_block () falls back to the world's edit stage.
+		 */
+		block_data get_block (int x, int y, int z);
+		unsigned short get_id (int x, int y, int z);
+		blocki get_final_block (int x, int y, int z);
+		
+		
+		/* 
+		 * Enqueues all staged updates into the world and resets the
+		 * transaction so that it can be reused.
+		 */
+		void commit ();
+		
+		/* 
+		 * Discards all staged updates.
+		 */
+		void clear ();
+	};
+}
+
+#endif
+
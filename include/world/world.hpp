@@ -31,16 +31,19 @@
 #include "block_history.hpp"
 #include "world_security.hpp"
 #include "zone.hpp"
+#include "interest.hpp"
 
 #include <unordered_set>
 #include <unordered_map>
 #include <mutex>
+#include <condition_variable>
 #include <deque>
 #include <memory>
 #include <thread>
 #include <chrono>
 #include <functional>
 #include <stdexcept>
+#include <atomic>
 
 
 namespace hCraft {
@@ -51,6 +54,7 @@ namespace hCraft {
 	class player;
 	class player_list;
 	class world_transaction;
+	class physics_recorder;
 	
 	
 	/* 
@@ -71,6 +75,11 @@ namespace hCraft {
 		int data;
 		void *ptr;
 		
+		// set when the next update in the queue belongs to the same
+		// transaction, and must be applied within the same tick.
+		bool more;
+		
+		block_update () { }
 		block_update (int x, int y, int z, unsigned short id, unsigned char meta,
 			int extra, int data, void *ptr, player *pl, bool physics)
 		{
@@ -84,6 +93,7 @@ namespace hCraft {
 			this->data = data;
 			this->ptr = ptr;
 			this->physics = physics;
+			this->more = false;
 		}
 	};
 	
@@ -156,16 +166,61 @@ namespace hCraft {
 		world_generator *gen;
 		world_provider *prov;
 		std::mutex gen_lock;
+		std::atomic<int> disk_loads; // concurrent provider loads in progress
+		unsigned int reloads; // times the provider was replaced or cleared, protected by chunk_lock
+		
+		// background saves started by save_all_async () or trickle_save () that
+		// have not finished yet.  save_lock protects the count, and serializes
+		// the writes made by those saves.  a save is only ever registered while
+		// chunk_lock is held, and never takes chunk_lock after that, so it is
+		// safe to wait for saves while holding chunk_lock.
+		int pending_saves;
+		bool autosave_running; // a save_all_async () save is in progress
+		std::mutex save_lock;
+		std::condition_variable save_cv;
+		
+		// copies of chunks unloaded by remove_chunk () while a save was in
+		// progress.  written out when it ends.  protected by save_lock.
+		std::unordered_map<unsigned long long, chunk *> unload_queue;
+		
+		// modified chunks waiting to be written out by trickle_save (), oldest
+		// first.  protected by chunk_lock.
+		struct dirty_chunk
+		{
+			unsigned long long key;
+			std::chrono::steady_clock::time_point since;
+		};
+		std::deque<dirty_chunk> dirty_queue;
+		std::unordered_set<unsigned long long> dirty_keys;
+		std::chrono::steady_clock::time_point trickle_last;
+		std::chrono::steady_clock::time_point dirty_scan_last;
+		std::atomic<long long> trickle_tokens; // bytes the saver may still write
 		
 		std::vector<portal *> portals;
 		std::mutex portal_lock;
 		
 		world_security wsec;
 		zone_manager zman;
+		interest_grid interest;
+		
+		// set while the world's input is being recorded (/physics record).
+		std::atomic<bool> ph_recording;
+		std::shared_ptr<physics_recorder> ph_rec;
 		
 	public:
 		bool auto_lighting;
 		physics_manager physics;
+		
+		// physics budget: the maximum number of updates processed per tick, and
+		// the number of pending updates past which new ones are dropped.
+		int ph_budget;
+		int ph_max_pending;
+		
+		// bounds of the view distance (in chunks) of players in this world, see
+		// player::adjust_view_distance ().
+		int view_min;
+		int view_max;
+		
 		lighting_manager lm;
 		block_history_manager blhi;
 		
@@ -185,6 +240,7 @@ namespace hCraft {
 		inline world_type get_type () const { return this->typ; }
 		inline const char* get_name () const { return this->name; }
 		inline player_list& get_players () { return *this->players; }
+		inline interest_grid& get_interest () { return this->interest; }
 		
 		inline world_provider* get_provider () { return this->prov; }
 		inline const char* get_path () { return this->prov->get_path (); }
@@ -231,6 +287,24 @@ namespace hCraft {
 		
 		void get_information (world_information& inf);
 		
+		/* 
+		 * Background saving.  Snapshots of modified chunks are compressed in
+		 * batches on the server's thread pool, and the last batch to finish
+		 * writes all of them out.
+		 */
+		struct async_save;
+		static void compress_save_batch (void *ptr);
+		void finish_async_save (async_save *job);
+		void end_save_nolock ();
+		void write_meta ();
+		
+		/* 
+		 * Called by the world's thread.  Queues chunks that have been modified
+		 * since they were last saved, and writes a few of the oldest ones out
+		 * on the server's thread pool, within the configured budget.
+		 */
+		void trickle_save ();
+		
 	public:
 		/* 
 		 * Constructs a new empty world.
@@ -279,6 +353,26 @@ namespace hCraft {
 		 */
 		void save_all ();
 		
+		/* 
+		 * Saves all modified chunks to disk in the background.  The world's
+		 * locks are only held while copies of the modified chunks are taken;
+		 * compression and I/O happen on the server's thread pool.  Returns false
+		 * if a previous background save of this world is still running.
+		 */
+		bool save_all_async ();
+		
+		/* 
+		 * Blocks until all background saves of this world have finished.
+		 */
+		void wait_for_saves ();
+		
+		/* 
+		 * Has the world's provider rewrite the world file so that chunks are
+		 * stored in spatial order.  Saves are held off until it is done.
+		 * Returns false if the provider does not support defragmentation.
+		 */
+		bool defragment ();
+		
 		/* 
 		 * Saves metadata to disk (width, depth, spawn pos, etc...).
 		 */
@@ -409,6 +503,10 @@ namespace hCraft {
 			unsigned char meta = 0, int extra = 0, int data = 0, void *ptr = nullptr,
 			player *pl = nullptr, bool physics = true);
 		
+		/* 
+		 * Enqueues all updates staged in the specified transaction at once.
+		 * The world thread applies them within a single tick.
+		 */
 		void queue_update (world_transaction *tr);
 		
 		void queue_lighting (int x, int y, int z)
@@ -430,6 +528,35 @@ namespace hCraft {
 		void stop_physics ();
 		void pause_physics ();
 		
+		/* 
+		 * Returns the manager that handles this world's physics: either the
+		 * world's own, or the server's global one if the former has no threads.
+		 */
+		physics_manager& get_physics_manager ();
+		
+		
+		/* 
+		 * Starts recording all block changes and physics updates fed into this
+		 * world from the outside, after taking a snapshot of the chunks within
+		 * @{radius} chunks of the given chunk coordinates.
+		 * Returns false if the world is already being recorded.
+		 */
+		bool start_recording (int cx, int cz, int radius);
+		
+		/* 
+		 * Stops the current recording and returns the recorder (or null if the
+		 * world was not being recorded).
+		 */
+		std::shared_ptr<physics_recorder> stop_recording ();
+		
+		inline bool is_recording () const { return this->ph_recording.load (); }
+		
+		/* 
+		 * Returns the active recorder if changes made by the calling thread
+		 * should be recorded, and null otherwise.
+		 */
+		std::shared_ptr<physics_recorder> active_recorder ();
+		
 		
 		
 	//----
@@ -43,6 +43,7 @@
 #include "commands/me.hpp"
 #include "commands/money.hpp"
 #include "commands/mute.hpp"
+#include "commands/netstats.hpp"
 #include "commands/nick.hpp"
 #include "commands/physics.hpp"
 #include "commands/ping.hpp"
@@ -91,6 +92,7 @@ namespace hCraft {
 	static command* create_c_whodid () { return new commands::c_whodid (); }
 	static command* create_c_rules () { return new commands::c_rules (); }
 	static command* create_c_players () { return new commands::c_players (); }
+	static command* create_c_netstats () { return new commands::c_netstats (); }
 	
 	// chat commands:
 	static command* create_c_me () { return new commands::c_me (); }
@@ -194,6 +196,7 @@ namespace hCraft {
 			{ "realm", create_c_realm },
 			{ "rules", create_c_rules },
 			{ "players", create_c_players },
+			{ "netstats", create_c_netstats },
 			{ "warn", create_c_warn },
 			{ "warnlog", create_c_warnlog },
 			{ "worlds", create_c_worlds },
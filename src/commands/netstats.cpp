@@ -0,0 +1,155 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "commands/netstats.hpp"
+#include "system/server.hpp"
+#include "system/packet_pool.hpp"
+#include "player/player.hpp"
+#include "util/stringutils.hpp"
+#include <sstream>
+#include <iomanip>
+
+
+namespace hCraft {
+	namespace commands {
+		
+		/* 
+		 * /netstats
+		 * 
+		 * Displays statistics about the server's network path.
+		 * 
+		 * Permissions:
+		 *   - command.info.netstats
+		 *       Needed to execute the command.
+		 */
+		void
+		c_netstats::execute (player *pl, command_reader& reader)
+		{
+			if (!pl->perm (this->get_exec_permission ()))
+				return;
+			
+			if (!reader.parse (this, pl))
+				return;
+			if (reader.arg_count () > 1)
+				{ this->show_summary (pl); return; }
+			if (reader.has_next ())
+				{
+					std::string arg = reader.next ().as_str ();
+					if (sutils::iequals (arg, "handlers"))
+						this->show_handlers (pl);
+					else
+						this->show_summary (pl);
+					return;
+				}
+			
+			packet_pool_stats ps;
+			packet_pool::get_stats (ps);
+			
+			std::ostringstream ss;
+			pl->message ("§3Network statistics§b:");
+			
+			ss << "§6 | §ePacket allocations§6: §a" << ps.requests << " §7(§a"
+				 << ((ps.requests > 0) ? (ps.hits * 100 / ps.requests) : 100)
+				 << "% §7from pool)";
+			pl->message (ss.str ());
+			ss.clear (); ss.str (std::string ());
+			
+			ss << "§6 | §eHeap allocations§6: §c" << ps.heap_allocs << " §7(§c"
+				 << ps.oversized << " §7oversized), §c" << ps.heap_frees << " §7frees";
+			pl->message (ss.str ());
+			ss.clear (); ss.str (std::string ());
+			
+			ss << "§6 | §ePool size§6: §a" << (ps.cached / 1024) << " §7KB";
+			pl->message (ss.str ());
+			ss.clear (); ss.str (std::string ());
+			
+			network_stats& ns = pl->get_server ().get_net_stats ();
+			unsigned long long packets = ns.packets_out.load ();
+			unsigned long long writes = ns.writes.load ();
+			
+			ss << "§6 | §ePackets sent§6: §a" << packets << " §7in §a" << writes
+				 << " §7writes (§a" << (ns.bytes_out.load () / 1024) << " §7KB)";
+			pl->message (ss.str ());
+			ss.clear (); ss.str (std::string ());
+			
+			ss << "§6 | §eSyscalls per packet§6: §a" << std::fixed << std::setprecision (3)
+				 << ((packets > 0) ? ((double)writes / packets) : 0.0);
+			pl->message (ss.str ());
+			ss.clear (); ss.str (std::string ());
+			
+			ss << "§6 | §eChunk/block packets paced§6: §a" << ns.paced_packets.load ();
+			pl->message (ss.str ());
+			ss.clear (); ss.str (std::string ());
+			
+			ss << "§6 | §eMovement broadcasts§6: §a" << ns.move_packets.load ()
+				 << " §7packets (§a" << (ns.move_bytes.load () / 1024) << " §7KB)";
+			pl->message (ss.str ());
+			ss.clear (); ss.str (std::string ());
+			
+			ss << "§6 | §eTeleports§6: §a" << ns.teleport_wait.count ()
+				 << " §7(§c" << ns.teleport_timeouts.load () << " §7timed out), waited §a"
+				 << (ns.teleport_wait.percentile_us (0.5) / 1000) << "§7/§a"
+				 << (ns.teleport_wait.percentile_us (0.99) / 1000) << " §7ms, playable in §a"
+				 << (ns.teleport_playable.percentile_us (0.5) / 1000) << "§7/§a"
+				 << (ns.teleport_playable.percentile_us (0.99) / 1000) << " §7ms §7(p50/p99)";
+			pl->message (ss.str ());
+			ss.clear (); ss.str (std::string ());
+		}
+		
+		
+		
+		/* 
+		 * /netstats handlers
+		 * 
+		 * Lists every packet id that has been handled so far, along with how
+		 * long packets waited in their player's queue and how long their
+		 * handler took to run.
+		 */
+		void
+		c_netstats::show_handlers (player *pl)
+		{
+			network_stats& ns = pl->get_server ().get_net_stats ();
+			
+			std::ostringstream ss;
+			pl->message ("§3Packet handlers §7(§bwait p50/p99§7, §bhandle p50/p99§7, in us)§b:");
+			
+			bool any = false;
+			for (int i = 0; i < 256; ++i)
+				{
+					latency_histogram& wait = ns.handler_wait[i];
+					latency_histogram& time = ns.handler_time[i];
+					unsigned long long count = time.count ();
+					if (count == 0)
+						continue;
+					any = true;
+					
+					ss << "§6 | §e0x" << std::hex << std::setw (2) << std::setfill ('0')
+						 << i << std::dec << std::setfill (' ') << "§6: §a" << count
+						 << " §7- §a" << wait.percentile_us (0.5) << "§7/§a"
+						 << wait.percentile_us (0.99) << " §7- §a"
+						 << time.percentile_us (0.5) << "§7/§a" << time.percentile_us (0.99);
+					pl->message (ss.str ());
+					ss.clear (); ss.str (std::string ());
+				}
+			
+			if (!any)
+				pl->message ("§6 | §7No packets handled yet.");
+		}
+	}
+}
+
@@ -21,8 +21,11 @@
 #include "player/player.hpp"
 #include "util/stringutils.hpp"
 #include "util/cistring.hpp"
+#include "physics/recorder.hpp"
 #include <sstream>
 #include <unordered_map>
+#include <cctype>
+#include <sys/stat.h>
 
 
 namespace hCraft {
@@ -101,6 +104,169 @@ namespace hCraft {
 		
 		
 		
+		static void
+		handle_bulk (player *pl, command_reader& reader)
+		{
+			physics_manager& man = pl->get_world ()->get_physics_manager ();
+			
+			if (!reader.has_next ())
+				{
+					std::ostringstream ss;
+					if (man.bulk_threshold == 0)
+						ss << "§7Bulk physics are currently §cdisabled";
+					else
+						ss << "§7Bulk physics kick in at §b" << man.bulk_threshold
+							 << " §7pending blocks per subchunk";
+					pl->message (ss.str ());
+					return;
+				}
+			
+			command_reader::argument narg = reader.next ();
+			if (narg.as_str () == "off")
+				{
+					man.bulk_threshold = 0;
+					pl->message ("§eBulk physics have been §cdisabled");
+					return;
+				}
+			
+			if (!narg.is_int () || narg.as_int () < 1)
+				{
+					pl->message ("§c * §7Syntax§f: §e/physics bulk §c<min-blocks|off>");
+					return;
+				}
+			
+			man.bulk_threshold = narg.as_int ();
+			pl->message ("§eBulk physics threshold has been set to §a" + narg.as_str ());
+		}
+		
+		static void
+		handle_budget (player *pl, command_reader& reader)
+		{
+			world *wr = pl->get_world ();
+			
+			if (!reader.has_next ())
+				{
+					std::ostringstream ss;
+					ss << "§7This world may process up to §b" << wr->ph_budget
+						 << " §7updates per tick, with at most §b" << wr->ph_max_pending
+						 << " §7pending";
+					pl->message (ss.str ());
+					return;
+				}
+			
+			command_reader::argument narg = reader.next ();
+			if (!narg.is_int () || narg.as_int () < 1)
+				{
+					pl->message ("§c * §7Syntax§f: §e/physics budget §c<updates-per-tick> [max-pending]");
+					return;
+				}
+			
+			int max_pending = wr->ph_max_pending;
+			if (reader.has_next ())
+				{
+					command_reader::argument marg = reader.next ();
+					if (!marg.is_int () || marg.as_int () < 1)
+						{
+							pl->message ("§c * §7Syntax§f: §e/physics budget §c<updates-per-tick> [max-pending]");
+							return;
+						}
+					max_pending = marg.as_int ();
+				}
+			
+			wr->ph_budget = narg.as_int ();
+			wr->ph_max_pending = max_pending;
+			
+			std::ostringstream ss;
+			ss << "§ePhysics budget has been set to §a" << wr->ph_budget
+				 << " §eupdates per tick §7(§a" << wr->ph_max_pending << " §7pending)";
+			pl->message (ss.str ());
+		}
+		
+		
+		static void
+		handle_record (player *pl, command_reader& reader)
+		{
+			world *wr = pl->get_world ();
+			
+			std::string act = reader.has_next () ? reader.next ().as_str () : "";
+			if (sutils::iequals (act, "start"))
+				{
+					int radius = 4;
+					if (reader.has_next ())
+						{
+							command_reader::argument rarg = reader.next ();
+							if (!rarg.is_int () || rarg.as_int () < 0 || rarg.as_int () > 16)
+								{
+									pl->message ("§c * §7Radius must be in the range of §c0-16");
+									return;
+								}
+							radius = rarg.as_int ();
+						}
+					
+					block_pos bp = pl->pos;
+					if (!wr->start_recording (bp.x >> 4, bp.z >> 4, radius))
+						{
+							pl->message ("§c * §7This world is already being recorded§f.");
+							return;
+						}
+					
+					pl->message ("§eRecording physics input of this world§f...");
+					return;
+				}
+			else if (sutils::iequals (act, "stop"))
+				{
+					if (!reader.has_next ())
+						{
+							pl->message ("§c * §7Syntax§f: §e/physics record stop §c<name>");
+							return;
+						}
+					
+					std::string name = reader.next ().as_str ();
+					for (char c : name)
+						if (!std::isalnum (c) && c != '-' && c != '_')
+							{
+								pl->message ("§c * §7Invalid recording name§f: §c" + name);
+								return;
+							}
+					
+					std::shared_ptr<physics_recorder> rec = wr->stop_recording ();
+					if (!rec)
+						{
+							pl->message ("§c * §7This world is not being recorded§f.");
+							return;
+						}
+					
+					physics_recording& recording = rec->finish ();
+					std::string path = "data/recordings/" + name + ".phr";
+					mkdir ("data/recordings", 0744);
+					try
+						{
+							recording.save (path.c_str ());
+						}
+					catch (const std::exception& ex)
+						{
+							pl->message ("§c * §7Failed to save recording§f: §c" + std::string (ex.what ()));
+							return;
+						}
+					
+					std::ostringstream ss;
+					ss << "§eSaved §a" << recording.records.size () << " §erecords and §a"
+						 << recording.chunks.size () << " §echunks to §b" << path;
+					pl->message (ss.str ());
+					if (recording.skipped > 0)
+						{
+							ss.clear (); ss.str (std::string ());
+							ss << "§7(§c" << recording.skipped << " §7updates with callbacks could not be recorded)";
+							pl->message (ss.str ());
+						}
+					return;
+				}
+			
+			pl->message ("§c * §7Syntax§f: §e/physics record §cstart [radius]§f|§cstop <name>");
+		}
+		
+		
+		
 		/* 
 		 * /physics -
 		 * 
@@ -129,6 +295,9 @@ namespace hCraft {
 						{ "off", handle_off },
 						{ "pause", handle_pause },
 						{ "threads", handle_threads },
+						{ "bulk", handle_bulk },
+						{ "budget", handle_budget },
+						{ "record", handle_record },
 					};
 			
 			auto itr = funs.find (opt.c_str ());
@@ -135,7 +135,7 @@ namespace hCraft {
 					return;
 				}
 			
-			pl->join_world (wr);
+			pl->teleport_when_ready (wr, wr->get_spawn ());
 		}
 	}
 }
@@ -19,6 +19,7 @@
 #include "commands/status.hpp"
 #include "system/server.hpp"
 #include "player/player.hpp"
+#include "world/world.hpp"
 #include "system/sqlops.hpp"
 #include "util/stringutils.hpp"
 #include "util/utils.hpp"
@@ -58,6 +59,7 @@ namespace hCraft {
 			bool can_see_rank = pl->has ("command.info.status.rank");
 			bool can_see_blockstats = pl->has ("command.info.status.blockstats");
 			bool can_see_balance = pl->has ("command.info.status.balance");
+			bool can_see_physics = pl->has ("command.info.status.physics");
 			
 			bool sect1 = can_see_nick || can_see_rank || can_see_ip || can_see_balance;
 			bool sect2 = can_see_logins;
@@ -201,6 +203,34 @@ namespace hCraft {
 								ss.clear (); ss.str (std::string ());
 							}
 					}
+				
+				// physics load of the world the target is currently in
+				physics_world_stats ps;
+				world *tw = target ? target->get_world () : nullptr;
+				if (can_see_physics && tw
+					&& tw->get_physics_manager ().get_stats (tw, ps))
+					{
+						if (sect1 || sect2 || sect3)
+							pl->message ("§6 -");
+						
+						ss << "§6 | §ePhysics queue §7(§b" << tw->get_name () << "§7)§6: §a"
+							 << ps.pending << "§7/§a" << ps.max_pending << " §7pending";
+						pl->message (ss.str ());
+						ss.clear (); ss.str (std::string ());
+						
+						ss << "§6 | §eBudget utilization§6: §a" << (ps.used * 100 / ps.budget)
+							 << "% §7(§a" << ps.used << "§7/§a" << ps.budget << " §7per tick)";
+						pl->message (ss.str ());
+						ss.clear (); ss.str (std::string ());
+						
+						if (ps.slowdown > 1 || ps.dropped > 0)
+							{
+								ss << "§6 | §eLoad shedding§6: §c" << ps.slowdown << "x §7slower, §c"
+									 << ps.dropped << " §7updates dropped";
+								pl->message (ss.str ());
+								ss.clear (); ss.str (std::string ());
+							}
+					}
 			//---
 			}
 		}
@@ -90,12 +90,12 @@ namespace hCraft {
 									return;
 								}
 							
-							pl->join_world_at (target->get_world (), target->pos);
+							pl->teleport_when_ready (target->get_world (), target->pos);
 							return;
 						}
 					else
 						{
-							pl->teleport_to (target->pos);
+							pl->teleport_when_ready (target->get_world (), target->pos);
 						}
 					
 					pl->message ("§eTeleported to " + std::string (target->get_colored_username ()));
@@ -146,12 +146,12 @@ namespace hCraft {
 									return;
 								}
 							
-							src->join_world_at (dest->get_world (), dest->pos);
+							src->teleport_when_ready (dest->get_world (), dest->pos);
 							return;
 						}
 					else
 						{
-							src->teleport_to (dest->pos);
+							src->teleport_when_ready (dest->get_world (), dest->pos);
 						}
 					
 					src->message ("§eYou have been teleported to " + std::string (dest->get_colored_username ()));
@@ -186,7 +186,7 @@ namespace hCraft {
 						 << z << "§e)";
 					pl->message (ss.str ());
 					
-					pl->teleport_to (entity_pos (block_pos (x, y, z))
+					pl->teleport_when_ready (pl->get_world (), entity_pos (block_pos (x, y, z))
 						.set_rot (curr_pos.r, curr_pos.l));
 				}
 		}
@@ -29,6 +29,7 @@
 #include <sstream>
 #include <iomanip>
 #include <cmath>
+#include <memory>
 
 #include <iostream> // DEBUG
 
@@ -809,6 +810,25 @@ namespace hCraft {
 			return true;
 		}
 		
+		/* 
+		 * Backups are made by copying the world file, which does not work for
+		 * worlds that are stored in directories.
+		 */
+		static bool
+		_can_backup (player *pl, world *w)
+		{
+			std::unique_ptr<world_provider_naming> naming {
+				world_provider_naming::create (w->get_provider ()->name ())};
+			if (naming && naming->is_directory_format ())
+				{
+					pl->message ("§c * §7Backups are not supported for worlds in the §c"
+						+ std::string (naming->provider_name ()) + " §7format§c.");
+					return false;
+				}
+			
+			return true;
+		}
+		
 		static int
 		_determine_backup_number (const std::string& path)
 		{
@@ -837,6 +857,9 @@ namespace hCraft {
     			return;
     		}
     	
+    	if (!_can_backup (pl, w))
+    		return;
+    	
     	mkdir ("data/backups", 0744);
     	mkdir (("data/backups/" + std::string (w->get_name ())).c_str (), 0744);
     	
@@ -886,6 +909,9 @@ namespace hCraft {
     			return;
     		}
     	
+    	if (!_can_backup (pl, w))
+    		return;
+    	
     	std::string src = w->get_path ();
     	src.erase (0, 12); // remove "data/worlds/" part
     	src.insert (0, "data/backups/" + std::string (w->get_name ()) + "/");
@@ -934,6 +960,44 @@ namespace hCraft {
     
     
     
+    static void
+    _handle_defrag (player *pl, world *w, command_reader& reader)
+    {
+    	if (!pl->has ("command.world.world.defrag"))
+    		{
+    			pl->message (messages::not_allowed ());
+    			return;
+    		}
+    	
+    	struct stat st;
+    	long long old_size = (stat (w->get_path (), &st) == 0) ? st.st_size : 0;
+    	
+    	pl->message ("§eDefragmenting world§f...");
+    	bool done;
+    	try
+    		{
+    			done = w->defragment ();
+    		}
+    	catch (const std::exception& ex)
+    		{
+    			pl->message ("§4 * §cFailed to defragment world§4: §c" + std::string (ex.what ()));
+    			return;
+    		}
+    	if (!done)
+    		{
+    			pl->message ("§c * §7This world's format does not support defragmentation§c.");
+    			return;
+    		}
+    	
+    	long long new_size = (stat (w->get_path (), &st) == 0) ? st.st_size : 0;
+    	std::ostringstream ss;
+    	ss << "§7 | World " << w->get_colored_name () << " §7has been defragmented ("
+    		 << (old_size / 1024) << "KB §f-> §7" << (new_size / 1024) << "KB).";
+    	pl->message (ss.str ());
+    }
+    
+    
+    
     static bool
     _parse_time (const std::string& str, unsigned long long& out)
     {
@@ -1178,6 +1242,7 @@ namespace hCraft {
 						{ "backup", _handle_backup },
 						{ "restore", _handle_restore },
 						{ "save", _handle_save },
+						{ "defrag", _handle_defrag },
 						{ "time", _handle_time },
 						{ "pvp", _handle_pvp },
 					};
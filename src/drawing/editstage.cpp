@@ -22,6 +22,7 @@
 #include "player/player.hpp"
 #include "player/player_list.hpp"
 #include "physics/blocks/physics_block.hpp"
+#include "physics/recorder.hpp"
 #include <cstring>
 #include <mutex>
 
@@ -195,6 +196,39 @@ namespace hCraft {
 		return {id, (unsigned char)(val & 0xF), ex};
 	}
 	
+	/* 
+	 * Same as get (), but only succeeds if the block has been modified in
+	 * this edit stage (the underlying world is not queried).
+	 */
+	bool
+	dense_edit_stage::get_staged (int x, int y, int z, blocki& out)
+	{
+		auto itr = this->chunks.find ({x >> 4, z >> 4});
+		if (itr == this->chunks.end ())
+			return false;
+		
+		des_subchunk *sub = itr->second.subs[y >> 4];
+		if (!sub)
+			return false;
+		
+		int bx = x & 0xF;
+		int by = y & 0xF;
+		int bz = z & 0xF;
+		int m_index = ((by >> 3) << 2) | ((bz >> 3) << 1) | ((bx >> 3));
+		des_microchunk *micro = sub->micro[m_index];
+		if (!micro)
+			return false;
+		
+		int b_index = ((y & 0x7) << 6) | ((z & 0x7) << 3) | ((x & 0x7));
+		unsigned short val = micro->data[b_index];
+		unsigned short id  = val >> 4;
+		if (id == ES_NONE || id == ES_REM)
+			return false;
+		
+		out.set (id, val & 0xF, micro->ex[b_index]);
+		return true;
+	}
+	
 	void
 	dense_edit_stage::reset (int x, int y, int z)
 	{
@@ -213,26 +247,92 @@ namespace hCraft {
 	
 	
 	
-	void
-	dense_edit_stage::send_to_players (std::vector<player *>& _players,
-	  int cx, int cz, des_chunk& ch, bool restore, bool update_sbs)
+	// multi block changes with at least this many records are compared
+	// against a full chunk resend, and past the second limit the full chunk
+	// is used without building the multi block change at all.
+	static const int full_chunk_min_records = 512;
+	static const int full_chunk_records = 4096;
+	
+	/* 
+	 * Sends @{count} block changes made to chunk (@{cx}, @{cz}) to those of the
+	 * specified players that can see it, in whichever form is cheapest: a
+	 * single block change, a multi block change, or the whole chunk (with
+	 * @{overlay} applied on top of the world's copy, if given).  @{records} may
+	 * be left empty when @{count} is large enough for the chunk to be sent
+	 * anyway.
+	 * 
+	 * The packet is built once and shared between players, except for players
+	 * that see blocks others do not (selection blocks, for example); those get
+	 * a multi block change of their own that leaves them intact.
+	 */
+	static void
+	_send_chunk_changes (world *w, const std::vector<player *>& players,
+		int cx, int cz, int count, const std::vector<block_change_record>& records,
+		edit_stage *overlay)
 	{
-		std::vector<player *> players (_players);
+		std::vector<player *> shared, priv;
+		for (player *pl : players)
+			if ((pl->get_world () == w) && pl->can_see_chunk (cx, cz))
+				{
+					if (pl->has_private_blocks ())
+						priv.push_back (pl);
+					else
+						shared.push_back (pl);
+				}
+		if (shared.empty () && priv.empty ())
+			return;
 		
-		// don't send to players that are too far away
-		for (auto itr = players.begin (); itr != players.end (); )
+		bool have_records = ((int)records.size () >= count);
+		packet *pack = nullptr;
+		if (have_records && (records.size () == 1))
 			{
-				player *pl = *itr;
-				
-				if ((pl->get_world () == this->w) && pl->can_see_chunk (cx, cz))
-					++ itr;
-				else
-					itr = players.erase (itr);
+				const block_change_record& rec = records[0];
+				pack = packets::play::make_block_change ((cx << 4) | rec.x, rec.y,
+					(cz << 4) | rec.z, rec.id, rec.meta);
+			}
+		else if (!have_records || ((int)records.size () >= full_chunk_min_records))
+			{
+				chunk *wch = w->get_chunk (cx, cz);
+				if (wch)
+					{
+						std::vector<edit_stage *> es_vec;
+						if (overlay)
+							es_vec.push_back (overlay);
+						pack = packets::play::make_chunk (cx, cz, wch, es_vec);
+						
+						// send the smaller of the two.
+						if (pack && have_records && ((int)records.size () < full_chunk_records)
+							&& (pack->size > (15 + records.size () * 4)))
+							{
+								packet::release (pack);
+								pack = nullptr;
+							}
+					}
+			}
+		if (!pack)
+			{
+				if (!have_records)
+					return;
+				pack = packets::play::make_multi_block_change (cx, cz, records);
 			}
 		
-		if (players.empty ())
-			return;
+		for (player *pl : shared)
+			pl->send (pack->share ());
+		for (player *pl : priv)
+			{
+				if (have_records)
+					pl->send (packets::play::make_multi_block_change (cx, cz, records, pl));
+				else
+					pl->send (pack->share ());
+			}
 		
+		packet::release (pack);
+	}
+	
+	void
+	dense_edit_stage::send_to_players (std::vector<player *>& players,
+	  int cx, int cz, des_chunk& ch, bool restore, bool update_sbs)
+	{
 		block_data bd;
 		unsigned short id;
 		unsigned char meta;
@@ -240,6 +340,7 @@ namespace hCraft {
 		int bx, by, bz;
 		
 		std::vector<block_change_record> records;
+		records.reserve (ch.mod_count);
 		for (int sy = 0; sy < 16; ++sy)
 			{
 				des_subchunk *sub = ch.subs[sy];
@@ -274,9 +375,8 @@ namespace hCraft {
 					}
 			}
 		
-		for (player *pl : players)
-			if (pl->get_world () == this->w && pl->can_see_chunk (cx, cz))
-				pl->send (packets::play::make_multi_block_change (cx, cz, records, pl));
+		_send_chunk_changes (this->w, players, cx, cz, records.size (), records,
+			restore ? nullptr : this);
 	}
 	
 	
@@ -326,8 +426,6 @@ namespace hCraft {
 	void
 	dense_edit_stage::commit (bool physics)
 	{
-		static const int chunk_cap = 3000;
-		
 		if (this->chunks.empty ())
 			return;
 		
@@ -357,6 +455,7 @@ namespace hCraft {
 		std::lock_guard<std::mutex> u_guard ((this->w->update_lock));
 		std::lock_guard<std::mutex> es_guard ((this->w->estage_lock));
 		std::lock_guard<std::mutex> lm_guard ((this->w->lm.get_lock ()));
+		auto recorder = this->w->active_recorder ();
 		for (auto itr = this->chunks.begin (); itr != this->chunks.end (); ++itr)
 			{
 				int cx = itr->first.x;
@@ -368,7 +467,7 @@ namespace hCraft {
 				des_chunk &ch = itr->second;
 				
 				std::vector<block_change_record> records;
-				bool add_records = (ch.mod_count < chunk_cap);
+				bool add_records = (ch.mod_count < full_chunk_records);
 				
 				std::bitset<256> column_changed;
 				
@@ -443,6 +542,8 @@ namespace hCraft {
 														if (wz > bound_max.z) bound_max.z = wz;
 										
 														wch->set_block (rx, wy, rz, id, meta, ex);
+														if (recorder)
+															recorder->record_set (wx, wy, wz, id, meta, ex);
 														
 														//if (this->w->auto_lighting)
 														// NOTE: we already acquired the lighting manager's lock,
@@ -468,51 +569,8 @@ namespace hCraft {
 								wch->recalc_heightmap (x, z);
 						}
 
-				if (ch.mod_count >= chunk_cap)
-					{
-						for (player *pl : affected_players)
-							{
-								if ((pl->get_world () == this->w) &&pl->can_see_chunk (cx, cz))
-									pl->send (packets::play::make_chunk (cx, cz, wch));
-							}
-					}
-				else if (ch.mod_count > 200)
-					{
-						packet *mbcp = packets::play::make_multi_block_change (cx, cz, records);
-						packet *cp   = packets::play::make_chunk (cx, cz, wch);
-		
-						// send the smaller between the two
-						if (mbcp->size < cp->size)
-							{
-								delete cp;
-								for (player *pl : affected_players)
-									{
-										if (pl->get_world () == this->w)
-											pl->send (new packet (*mbcp));
-									}
-								delete mbcp;
-							}
-						else
-							{
-								delete mbcp;
-								for (player *pl : affected_players)
-									{
-										if ((pl->get_world () == this->w) && pl->can_see_chunk (cx, cz))
-											pl->send (new packet (*cp));
-									}
-								delete cp;
-							}
-					}
-				else
-					{
-						packet *pack = packets::play::make_multi_block_change (cx, cz, records);
-						for (player *pl : affected_players)
-							{
-								if (pl->get_world () == this->w)
-									pl->send (new packet (*pack));
-							}
-						delete pack;
-					}
+				_send_chunk_changes (this->w, affected_players, cx, cz,
+					add_records ? (int)records.size () : ch.mod_count, records, nullptr);
 			}
 		
 		// update player selections
@@ -781,8 +839,8 @@ namespace hCraft {
 				packet *pack = packets::play::make_multi_block_change (cx, cz, records);
 				for (player *pl : players)
 					if (pl->get_world () == this->w)
-						pl->send (new packet (*pack));
-				delete pack;
+						pl->send (pack->share ());
+				packet::release (pack);
 			}
 		
 		// resend modified selection blocks
@@ -868,6 +926,7 @@ namespace hCraft {
 		std::lock_guard<std::mutex> u_guard ((this->w->update_lock));
 		std::lock_guard<std::mutex> es_guard ((this->w->estage_lock));
 		std::lock_guard<std::mutex> lm_guard ((this->w->lm.get_lock ()));
+		auto recorder = this->w->active_recorder ();
 		for (auto itr = this->chunks.begin (); itr != this->chunks.end (); ++itr)
 			{
 				int cx = itr->first.x;
@@ -917,6 +976,8 @@ namespace hCraft {
 						
 						// update world
 						wch->set_block (x, y, z, id, meta, ex);
+						if (recorder)
+							recorder->record_set (wx, y, wz, id, meta, ex);
 						
 						//if (this->w->auto_lighting)
 						// NOTE: we already acquired the lighting manager's lock,
@@ -942,8 +1003,8 @@ namespace hCraft {
 				// update players
 				packet *mbcp = packets::play::make_multi_block_change (cx, cz, records);
 				for (player *pl : affected_players)
-					pl->send (new packet (*mbcp));
-				delete mbcp;
+					pl->send (mbcp->share ());
+				packet::release (mbcp);
 				
 				// resend modified selection blocks
 				for (sb_correction& sbc : corrections)
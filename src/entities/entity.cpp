@@ -163,6 +163,7 @@ namespace hCraft {
 	
 	/* 
 	 * Returns true if this entity can be seen by the specified one.
+	 * Players see as far as their current view distance reaches.
 	 */
 	bool
 	entity::visible_to (entity *ent)
@@ -170,9 +171,13 @@ namespace hCraft {
 	  chunk_pos me_pos = this->pos;
 		chunk_pos ot_pos = ent->pos;
 		
+		int radius = player::chunk_radius ();
+		if (ent->get_type () == ET_PLAYER)
+			radius = dynamic_cast<player *> (ent)->get_view_distance ();
+		
 		return (
-			(utils::iabs (me_pos.x - ot_pos.x) <= player::chunk_radius ()) &&
-			(utils::iabs (me_pos.z - ot_pos.z) <= player::chunk_radius ()));
+			(utils::iabs (me_pos.x - ot_pos.x) <= radius) &&
+			(utils::iabs (me_pos.z - ot_pos.z) <= radius));
 	}
 	
 	
@@ -18,6 +18,7 @@
 
 #include "physics/blocks/firework.hpp"
 #include "world/world.hpp"
+#include "world/transaction.hpp"
 #include "util/utils.hpp"
 #include <random>
 
@@ -27,17 +28,17 @@ namespace hCraft {
 	namespace physics {
 		
 		static void
-		_remove_rocket (world &w, int x, int y, int z)
+		_remove_rocket (world_transaction &tr, int x, int y, int z)
 		{
-			if (w.get_id (x, y, z) != 2004)
+			if (tr.get_id (x, y, z) != 2004)
 				return;
 			
-			w.queue_update (x, y, z, BT_AIR);
-			if (y > 0 && w.get_id (x, y - 1, z) == BT_STILL_LAVA)
+			tr.set (x, y, z, BT_AIR);
+			if (y > 0 && tr.get_id (x, y - 1, z) == BT_STILL_LAVA)
 				{
-					w.queue_update (x, y - 1, z, BT_AIR);
-					if (w.get_id (x, y - 2, z) == BT_STILL_LAVA)
-						w.queue_update (x, y - 2, z, BT_AIR);
+					tr.set (x, y - 1, z, BT_AIR);
+					if (tr.get_id (x, y - 2, z) == BT_STILL_LAVA)
+						tr.set (x, y - 2, z, BT_AIR);
 				}
 		}
 		
@@ -56,6 +57,7 @@ namespace hCraft {
 			physics_params particle_params;
 			physics_params::build ("drop 100 dissipate 25", particle_params);
 			
+			world_transaction tr {w};
 			int rad = 5;
 			for (int xx = -rad; xx <= rad; ++xx)
 				for (int yy = -rad; yy <= rad; ++yy)
@@ -64,10 +66,17 @@ namespace hCraft {
 							{
 								if ((yy + y) >= 0 && chance_dis (rnd) < 2 && w.get_id (xx + x, yy + y, zz + z) == BT_AIR)
 									{
-										w.queue_update (xx + x, yy + y, zz + z, BT_WOOL, col_dis (rnd));
-										w.queue_physics (xx + x, yy + y, zz + z, 0, nullptr, 2, &particle_params, nullptr);
+										tr.set (xx + x, yy + y, zz + z, BT_WOOL, col_dis (rnd));
 									}
 							}
+			
+			// the particles are only given physics once the wool blocks are queued.
+			w.queue_update (&tr);
+			for (int i = 0; i < tr.size (); ++i)
+				{
+					block_update &u = tr.at (i);
+					w.queue_physics (u.x, u.y, u.z, 0, nullptr, 2, &particle_params, nullptr);
+				}
 		}
 		
 		void
@@ -88,26 +97,30 @@ namespace hCraft {
 			if (w.get_id (x, y, z) != 2004)
 				return;
 			
+			world_transaction tr {w};
 			if (y == 255)
 				{
-					_remove_rocket (w, x, y, z);
+					_remove_rocket (tr, x, y, z);
+					tr.commit ();
 					return;
 				}
 				
 			if (data == 20 || (w.get_id (x, y + 1, z) != BT_AIR))
 				{
-					_remove_rocket (w, x, y, z);
+					_remove_rocket (tr, x, y, z);
+					tr.commit ();
 					_explode (w, x, y, z, rnd);
 					return;
 				}
 			
-			w.queue_update (x, y, z, BT_STILL_LAVA);
+			tr.set (x, y, z, BT_STILL_LAVA);
 			if (y > 0 && w.get_id (x, y - 1, z) == BT_AIR)
-				w.queue_update (x, y - 1, z, BT_STILL_LAVA);
+				tr.set (x, y - 1, z, BT_STILL_LAVA);
 			if (y > 1 && w.get_id (x, y - 2, z) == BT_STILL_LAVA)
-				w.queue_update (x, y - 2, z, BT_AIR);
+				tr.set (x, y - 2, z, BT_AIR);
 			
-			w.queue_update (x, y + 1, z, this->id (), 0, 0, data + 1);
+			tr.set (x, y + 1, z, this->id (), 0, 0, data + 1);
+			tr.commit ();
 		}
 		
 		void
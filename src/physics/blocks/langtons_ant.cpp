@@ -18,6 +18,7 @@
 
 #include "physics/blocks/langtons_ant.hpp"
 #include "world/world.hpp"
+#include "world/transaction.hpp"
 #include "util/utils.hpp"
 
 
@@ -26,14 +27,14 @@ namespace hCraft {
 	namespace physics {
 		
 		static inline bool
-		queue_update_if_empty (world &w, int x, int y, int z, unsigned short id,
-			unsigned char meta, int data)
+		queue_update_if_empty (world_transaction &tr, int x, int y, int z,
+			unsigned short id, unsigned char meta, int data)
 		{
-			int prev_id = w.get_final_block (x, y, z).id;
+			int prev_id = tr.get_final_block (x, y, z).id;
 			if (prev_id != BT_AIR)
 				return false;
 			
-			w.queue_update (x, y, z, id, meta, 0, data);
+			tr.set (x, y, z, id, meta, 0, data);
 			return true;
 		}
 		
@@ -112,17 +113,20 @@ namespace hCraft {
 			int col_below = color_from_wool (w.get_meta (x, y - 1, z));
 			int next_col  = next_color (col_below);
 			
-			w.queue_update (x, y - 1, z, BT_WOOL, wool_from_color (next_col));
-			w.queue_update (x, y, z, BT_AIR);
+			world_transaction tr {w};
+			tr.set (x, y - 1, z, BT_WOOL, wool_from_color (next_col));
+			tr.set (x, y, z, BT_AIR);
 			
 			int next_dir = rotate (data, direction_from_color (next_col));
 			switch (next_dir)
 				{
-					case 0: queue_update_if_empty (w, x + 1, y, z, BT_LANGTONS_ANT, 0, (int)next_dir); break;
-					case 1: queue_update_if_empty (w, x, y, z + 1, BT_LANGTONS_ANT, 0, (int)next_dir); break;
-					case 2: queue_update_if_empty (w, x - 1, y, z, BT_LANGTONS_ANT, 0, (int)next_dir); break;
-					case 3: queue_update_if_empty (w, x, y, z - 1, BT_LANGTONS_ANT, 0, (int)next_dir); break;
+					case 0: queue_update_if_empty (tr, x + 1, y, z, BT_LANGTONS_ANT, 0, (int)next_dir); break;
+					case 1: queue_update_if_empty (tr, x, y, z + 1, BT_LANGTONS_ANT, 0, (int)next_dir); break;
+					case 2: queue_update_if_empty (tr, x - 1, y, z, BT_LANGTONS_ANT, 0, (int)next_dir); break;
+					case 3: queue_update_if_empty (tr, x, y, z - 1, BT_LANGTONS_ANT, 0, (int)next_dir); break;
 				}
+			
+			tr.commit ();
 		}
 	}
 }
@@ -18,6 +18,7 @@
 
 #include "physics/blocks/sand.hpp"
 #include "world/world.hpp"
+#include "world/transaction.hpp"
 
 
 namespace hCraft {
@@ -32,34 +33,77 @@ namespace hCraft {
 				{ w.queue_update (x, y, z, BT_AIR); return; }
 			if (w.get_id (x, y, z) != BT_SAND)
 				return;
-		
+			
+			world_transaction tr {w};
 			int below = w.get_id (x, y - 1, z);
 			if (below == BT_AIR)
 				{
-					w.queue_update (x, y, z, BT_AIR);
-					w.queue_update (x, y - 1, z, BT_SAND);
+					tr.set (x, y, z, BT_AIR);
+					tr.set (x, y - 1, z, BT_SAND);
 				}
 			else
 				{
 					if (w.get_id (x - 1, y - 1, z) == BT_AIR && w.get_id (x - 1, y, z) == BT_AIR)
 						{
-							w.queue_update (x, y, z, BT_AIR);
-							w.queue_update (x - 1, y - 1, z, BT_SAND);
+							tr.set (x, y, z, BT_AIR);
+							tr.set (x - 1, y - 1, z, BT_SAND);
 						}
 					else if (w.get_id (x + 1, y - 1, z) == BT_AIR && w.get_id (x + 1, y, z) == BT_AIR)
 						{
-							w.queue_update (x, y, z, BT_AIR);
-							w.queue_update (x + 1, y - 1, z, BT_SAND);
+							tr.set (x, y, z, BT_AIR);
+							tr.set (x + 1, y - 1, z, BT_SAND);
 						}
 					else if (w.get_id (x, y - 1, z - 1) == BT_AIR && w.get_id (x, y, z - 1) == BT_AIR)
 						{
-							w.queue_update (x, y, z, BT_AIR);
-							w.queue_update (x, y - 1, z - 1, BT_SAND);
+							tr.set (x, y, z, BT_AIR);
+							tr.set (x, y - 1, z - 1, BT_SAND);
 						}
 					else if (w.get_id (x, y - 1, z + 1) == BT_AIR && w.get_id (x, y, z + 1) == BT_AIR)
 						{
-							w.queue_update (x, y, z, BT_AIR);
-							w.queue_update (x, y - 1, z + 1, BT_SAND);
+							tr.set (x, y, z, BT_AIR);
+							tr.set (x, y - 1, z + 1, BT_SAND);
+						}
+				}
+			
+			tr.commit ();
+		}
+		
+		/* 
+		 * Bulk version of tick ().
+		 * Like tick (), reads the world's current state only, so changes made
+		 * by earlier blocks in the batch are not visible to later ones.
+		 */
+		void
+		sand::bulk_tick (physics_snapshot& snap, const physics_bulk_entry *blocks,
+			int count, std::vector<physics_change>& out, std::minstd_rand& rnd)
+		{
+			static const int offs[4][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+			
+			for (int i = 0; i < count; ++i)
+				{
+					int x = blocks[i].x, y = blocks[i].y, z = blocks[i].z;
+					
+					if (y <= 0)
+						{ out.push_back ({x, y, z, BT_AIR, 0}); continue; }
+					if (snap.get_id (x, y, z) != BT_SAND)
+						continue;
+					
+					if (snap.get_id (x, y - 1, z) == BT_AIR)
+						{
+							out.push_back ({x, y, z, BT_AIR, 0});
+							out.push_back ({x, y - 1, z, BT_SAND, 0});
+							continue;
+						}
+					
+					for (int j = 0; j < 4; ++j)
+						{
+							int nx = x + offs[j][0], nz = z + offs[j][1];
+							if (snap.get_id (nx, y - 1, nz) == BT_AIR && snap.get_id (nx, y, nz) == BT_AIR)
+								{
+									out.push_back ({x, y, z, BT_AIR, 0});
+									out.push_back ({nx, y - 1, nz, BT_SAND, 0});
+									break;
+								}
 						}
 				}
 		}
@@ -63,6 +63,62 @@ namespace hCraft {
 						w.queue_update (x, y - 1, z, BT_SNOW_BLOCK);
 				}
 		}
+		
+		/* 
+		 * Bulk version of tick ().
+		 * tick () queries the edit stage, which reflects updates queued by
+		 * previous ticks, so every change is also written back to the snapshot.
+		 */
+		void
+		snow::bulk_tick (physics_snapshot& snap, const physics_bulk_entry *blocks,
+			int count, std::vector<physics_change>& out, std::minstd_rand& rnd)
+		{
+			auto emit = [&snap, &out] (int x, int y, int z, unsigned short id)
+				{
+					out.push_back ({x, y, z, id, 0});
+					snap.set (x, y, z, id);
+				};
+			
+			for (int i = 0; i < count; ++i)
+				{
+					int x = blocks[i].x, y = blocks[i].y, z = blocks[i].z;
+					
+					if (y <= 0)
+						{ emit (x, y, z, BT_AIR); continue; }
+					if (snap.get_id (x, y, z) != BT_SNOW_BLOCK)
+						continue;
+					
+					int below = snap.get_id (x, y - 1, z);
+					if (below != BT_AIR)
+						{
+							if (below == BT_SNOW_BLOCK || below == BT_SNOW_COVER)
+								emit (x, y, z, BT_AIR);
+							else
+								emit (x, y, z, BT_SNOW_COVER);
+						}
+					else
+						{
+							emit (x, y, z, BT_AIR);
+							
+							int nx = x, nz = z;
+							
+							std::uniform_int_distribution<> dis (1, 4);
+							int d = dis (rnd);
+							switch (d)
+								{
+									case 1: ++ nx; break;
+									case 2: -- nx; break;
+									case 3: ++ nz; break;
+									case 4: -- nz; break;
+								}
+							
+							if (snap.get (nx, y - 1, nz) == BT_AIR)
+								emit (nx, y - 1, nz, BT_SNOW_BLOCK);
+							else
+								emit (x, y - 1, z, BT_SNOW_BLOCK);
+						}
+				}
+		}
 	}
 }
 
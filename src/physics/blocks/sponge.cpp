@@ -18,6 +18,7 @@
 
 #include "physics/blocks/sponge.hpp"
 #include "world/world.hpp"
+#include "world/transaction.hpp"
 
 
 namespace hCraft {
@@ -40,19 +41,21 @@ namespace hCraft {
 				return;
 			
 			// spawn the initial agents
+			world_transaction tr {w};
+			if (y < 255 && is_water_block (tr.get_final_block (x, y + 1, z).id))
+				tr.set (x, y + 1, z, 2002);
+			if (y > 0   && is_water_block (tr.get_final_block (x, y - 1, z).id))
+				tr.set (x, y - 1, z, 2002);
+			if (is_water_block (tr.get_final_block (x - 1, y, z).id))
+				tr.set (x - 1, y, z, 2002);
+			if (is_water_block (tr.get_final_block (x + 1, y, z).id))
+				tr.set (x + 1, y, z, 2002);
+			if (is_water_block (tr.get_final_block (x, y, z - 1).id))
+				tr.set (x, y, z - 1, 2002);
+			if (is_water_block (tr.get_final_block (x, y, z + 1).id))
+				tr.set (x, y, z + 1, 2002);
 			
-			if (y < 255 && is_water_block (w.get_final_block (x, y + 1, z).id))
-				w.queue_update (x, y + 1, z, 2002);
-			if (y > 0   && is_water_block (w.get_final_block (x, y - 1, z).id))
-				w.queue_update (x, y - 1, z, 2002);
-			if (is_water_block (w.get_final_block (x - 1, y, z).id))
-				w.queue_update (x - 1, y, z, 2002);
-			if (is_water_block (w.get_final_block (x + 1, y, z).id))
-				w.queue_update (x + 1, y, z, 2002);
-			if (is_water_block (w.get_final_block (x, y, z - 1).id))
-				w.queue_update (x, y, z - 1, 2002);
-			if (is_water_block (w.get_final_block (x, y, z + 1).id))
-				w.queue_update (x, y, z + 1, 2002);
+			tr.commit ();
 		}
 		
 		void
@@ -63,21 +66,23 @@ namespace hCraft {
 				return;
 			
 			// spawn agents
-			if (y < 255 && is_water_block (w.get_final_block (x, y + 1, z).id))
-				w.queue_update (x, y + 1, z, 2002);
-			if (y > 0   && is_water_block (w.get_final_block (x, y - 1, z).id))
-				w.queue_update (x, y - 1, z, 2002);
-			if (is_water_block (w.get_final_block (x - 1, y, z).id))
-				w.queue_update (x - 1, y, z, 2002);
-			if (is_water_block (w.get_final_block (x + 1, y, z).id))
-				w.queue_update (x + 1, y, z, 2002);
-			if (is_water_block (w.get_final_block (x, y, z - 1).id))
-				w.queue_update (x, y, z - 1, 2002);
-			if (is_water_block (w.get_final_block (x, y, z + 1).id))
-				w.queue_update (x, y, z + 1, 2002);
+			world_transaction tr {w};
+			if (y < 255 && is_water_block (tr.get_final_block (x, y + 1, z).id))
+				tr.set (x, y + 1, z, 2002);
+			if (y > 0   && is_water_block (tr.get_final_block (x, y - 1, z).id))
+				tr.set (x, y - 1, z, 2002);
+			if (is_water_block (tr.get_final_block (x - 1, y, z).id))
+				tr.set (x - 1, y, z, 2002);
+			if (is_water_block (tr.get_final_block (x + 1, y, z).id))
+				tr.set (x + 1, y, z, 2002);
+			if (is_water_block (tr.get_final_block (x, y, z - 1).id))
+				tr.set (x, y, z - 1, 2002);
+			if (is_water_block (tr.get_final_block (x, y, z + 1).id))
+				tr.set (x, y, z + 1, 2002);
 			
 			// replace self with air
-			w.queue_update (x, y, z, 0);
+			tr.set (x, y, z, 0);
+			tr.commit ();
 		}
 	}
 }
@@ -18,6 +18,7 @@
 
 #include "physics/blocks/water.hpp"
 #include "world/world.hpp"
+#include "world/transaction.hpp"
 #include "slot/blocks.hpp"
 
 
@@ -26,12 +27,12 @@ namespace hCraft {
 	namespace physics {
 		
 		static bool
-		can_be_placed_at (world& w, int x, int y, int z, int lv)
+		can_be_placed_at (world_transaction& tr, int x, int y, int z, int lv)
 		{
 			if (y < 0)
 				return false;
 			
-			block_data bd = w.get_block (x, y, z);
+			block_data bd = tr.get_block (x, y, z);
 			block_info *binf = block_info::from_id (bd.id);
 			if (!binf->opaque)
 				return true;
@@ -57,19 +58,80 @@ namespace hCraft {
 			if (lv > 8)
 				lv = 0;
 			
-			if (can_be_placed_at (w, x, y - 1, z, 8 | lv))
-				w.queue_update (x, y - 1, z, BT_WATER, 8 | lv);
+			world_transaction tr {w};
+			if (can_be_placed_at (tr, x, y - 1, z, 8 | lv))
+				tr.set (x, y - 1, z, BT_WATER, 8 | lv);
 			else if (y != 0 && (lv & 7) != 7)
 				{
 					unsigned char next_lv = (lv & 7) + 1;
-					if (can_be_placed_at (w, x + 1, y, z, next_lv))
-						w.queue_update (x + 1, y, z, BT_WATER, next_lv);
-					if (can_be_placed_at (w, x - 1, y, z, next_lv))
-						w.queue_update (x - 1, y, z, BT_WATER, next_lv);
-					if (can_be_placed_at (w, x, y, z + 1, next_lv))
-						w.queue_update (x, y, z + 1, BT_WATER, next_lv);
-					if (can_be_placed_at (w, x, y, z - 1, next_lv))
-						w.queue_update (x, y, z - 1, BT_WATER, next_lv);
+					if (can_be_placed_at (tr, x + 1, y, z, next_lv))
+						tr.set (x + 1, y, z, BT_WATER, next_lv);
+					if (can_be_placed_at (tr, x - 1, y, z, next_lv))
+						tr.set (x - 1, y, z, BT_WATER, next_lv);
+					if (can_be_placed_at (tr, x, y, z + 1, next_lv))
+						tr.set (x, y, z + 1, BT_WATER, next_lv);
+					if (can_be_placed_at (tr, x, y, z - 1, next_lv))
+						tr.set (x, y, z - 1, BT_WATER, next_lv);
+				}
+			
+			tr.commit ();
+		}
+		
+		static bool
+		can_be_placed_at (const physics_snapshot& snap, int x, int y, int z, int lv)
+		{
+			if (y < 0)
+				return false;
+			
+			blocki bl = snap.get (x, y, z);
+			block_info *binf = block_info::from_id (bl.id);
+			if (!binf->opaque)
+				return true;
+			
+			if (bl.id == BT_WATER)
+				{
+					if ((lv & 8) == 8) return true;
+					if (bl.meta >= lv)
+						return true;
+				}
+			return false;
+		}
+		
+		/* 
+		 * Bulk version of tick ().
+		 * Like tick (), reads the world's current state only, so changes made
+		 * by earlier blocks in the batch are not visible to later ones.
+		 */
+		void
+		water::bulk_tick (physics_snapshot& snap, const physics_bulk_entry *blocks,
+			int count, std::vector<physics_change>& out, std::minstd_rand& rnd)
+		{
+			static const int offs[4][2] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1} };
+			
+			for (int i = 0; i < count; ++i)
+				{
+					int x = blocks[i].x, y = blocks[i].y, z = blocks[i].z;
+					
+					blocki bl = snap.get (x, y, z);
+					if (bl.id != BT_WATER)
+						continue;
+					
+					unsigned char lv = bl.meta;
+					if (lv > 8)
+						lv = 0;
+					
+					if (can_be_placed_at (snap, x, y - 1, z, 8 | lv))
+						out.push_back ({x, y - 1, z, BT_WATER, (unsigned char)(8 | lv)});
+					else if (y != 0 && (lv & 7) != 7)
+						{
+							unsigned char next_lv = (lv & 7) + 1;
+							for (int j = 0; j < 4; ++j)
+								{
+									int nx = x + offs[j][0], nz = z + offs[j][1];
+									if (can_be_placed_at (snap, nx, y, nz, next_lv))
+										out.push_back ({nx, y, nz, BT_WATER, next_lv});
+								}
+						}
 				}
 		}
 		
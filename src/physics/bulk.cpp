@@ -0,0 +1,142 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "physics/bulk.hpp"
+#include "world/world.hpp"
+#include "world/chunk.hpp"
+#include <mutex>
+
+
+namespace hCraft {
+	
+	/* 
+	 * Copies the subchunk located at the given chunk coordinates and
+	 * subchunk index (and its border) from the specified world.
+	 */
+	void
+	physics_snapshot::load (world &w, int cx, int sy, int cz,
+		physics_snapshot_source src)
+	{
+		this->ox = (cx << 4) - 1;
+		this->oy = (sy << 4) - 1;
+		this->oz = (cz << 4) - 1;
+		
+		// the snapshot spans a 3x3 grid of chunks
+		chunk *chunks[3][3];
+		for (int i = 0; i < 3; ++i)
+			for (int k = 0; k < 3; ++k)
+				chunks[i][k] = w.get_chunk (cx + i - 1, cz + k - 1);
+		
+		int x, y, z;
+		for (x = this->ox; x < (this->ox + dim); ++x)
+			for (z = this->oz; z < (this->oz + dim); ++z)
+				{
+					chunk *ch = chunks[(x >> 4) - cx + 1][(z >> 4) - cz + 1];
+					for (y = this->oy; y < (this->oy + dim); ++y)
+						{
+							int index = this->index (x, y, z);
+							if (!ch || (y < 0) || (y > 255))
+								{
+									this->ids[index] = BT_AIR;
+									this->meta[index] = 0;
+									continue;
+								}
+							
+							block_data bd = ch->get_block (x & 0xF, y, z & 0xF);
+							this->ids[index] = bd.id;
+							this->meta[index] = bd.meta;
+						}
+				}
+		
+		if (src == PSS_FINAL)
+			{
+				// apply pending modifications on top
+				std::lock_guard<std::mutex> guard {w.estage_lock};
+				
+				blocki bl;
+				for (x = this->ox; x < (this->ox + dim); ++x)
+					for (z = this->oz; z < (this->oz + dim); ++z)
+						for (y = this->oy; y < (this->oy + dim); ++y)
+							{
+								if ((y < 0) || (y > 255))
+									continue;
+								if (w.estage.get_staged (x, y, z, bl))
+									{
+										int index = this->index (x, y, z);
+										this->ids[index] = bl.id;
+										this->meta[index] = bl.meta;
+									}
+							}
+			}
+	}
+	
+	
+	
+	/* 
+	 * Block retrieval\modification (in world coordinates).
+	 * Blocks outside the snapshot are treated as air.
+	 */
+	
+	blocki
+	physics_snapshot::get (int x, int y, int z) const
+	{
+		if (!this->contains (x, y, z))
+			return blocki (BT_AIR);
+		
+		int index = this->index (x, y, z);
+		return blocki (this->ids[index], this->meta[index]);
+	}
+	
+	unsigned short
+	physics_snapshot::get_id (int x, int y, int z) const
+	{
+		if (!this->contains (x, y, z))
+			return BT_AIR;
+		return this->ids[this->index (x, y, z)];
+	}
+	
+	void
+	physics_snapshot::set (int x, int y, int z, unsigned short id,
+		unsigned char meta)
+	{
+		if (!this->contains (x, y, z))
+			return;
+		
+		int index = this->index (x, y, z);
+		this->ids[index] = id;
+		this->meta[index] = meta;
+	}
+	
+	
+	
+	/* 
+	 * Queues all of the given block changes in the specified world under a
+	 * single acquisition of its update lock.
+	 */
+	void
+	physics_commit_changes (world &w, const std::vector<physics_change>& changes)
+	{
+		if (changes.empty ())
+			return;
+		
+		std::lock_guard<std::mutex> guard {w.get_update_lock ()};
+		for (const physics_change& c : changes)
+			w.queue_update_nolock (c.x, c.y, c.z, c.id, c.meta);
+	}
+}
+
@@ -19,12 +19,15 @@
 #include "physics/physics.hpp"
 #include "physics/physics.hpp"
 #include "world/world.hpp"
+#include "world/transaction.hpp"
 #include "util/utils.hpp"
 #include "system/server.hpp"
 #include "util/stringutils.hpp"
 #include "entities/entity.hpp"
 #include "player/player.hpp"
+#include "physics/recorder.hpp"
 #include <functional>
+#include <algorithm>
 #include <cstring>
 
 #include <iostream> // DEBUG
@@ -33,7 +36,23 @@
 namespace hCraft {
 	
 	physics_manager::physics_manager (server &srv)
-		: srv (srv)
+		: last_sweep (std::chrono::steady_clock::now ()),
+			next_tick (std::chrono::steady_clock::now ()), srv (srv),
+			updates_per_tick (8000), bulk_threshold (64)
+	{
+		for (int i = 0; i < mem_buckets; ++i)
+			this->block_mem[i] = nullptr;
+		for (int p = 0; p < 2; ++p)
+			for (int i = 0; i < mem_reader_stripes; ++i)
+				this->mem_readers[p][i].n = 0;
+		this->mem_phase = 0;
+	}
+	
+	
+	
+	ph_world_queue::ph_world_queue (int wid)
+		: wid (wid), pending (0), entity_pending (0), used (0), last_used (0), slowdown (1),
+			hot_ticks (0), cold_ticks (0), overloaded (false), dropped (0)
 		{ }
 	
 	
@@ -50,6 +69,7 @@ namespace hCraft {
 		this->data.blk.z = z;
 		this->data.blk.cb = cb;
 		this->data.blk.data = data;
+		this->data.blk.once = false;
 		this->tick = tick;
 		this->elapsed = 0;
 	}
@@ -126,7 +146,38 @@ namespace hCraft {
 	
 	ph_mem_subchunk::ph_mem_subchunk ()
 	{
-		std::memset (this->blocks, 0, 4096 * sizeof (unsigned short));
+		for (int i = 0; i < 64; ++i)
+			this->bits[i].store (0, std::memory_order_relaxed);
+		this->count.store (0, std::memory_order_relaxed);
+	}
+	
+	/* 
+	 * Sets the bit at the given index.
+	 * Returns true if the bit was previously clear.
+	 */
+	bool
+	ph_mem_subchunk::test_and_set (unsigned int index)
+	{
+		unsigned long long mask = 1ULL << (index & 63);
+		if (this->bits[index >> 6].fetch_or (mask) & mask)
+			return false;
+		
+		++ this->count;
+		return true;
+	}
+	
+	bool
+	ph_mem_subchunk::test (unsigned int index) const
+	{
+		return this->bits[index >> 6].load () & (1ULL << (index & 63));
+	}
+	
+	void
+	ph_mem_subchunk::clear (unsigned int index)
+	{
+		unsigned long long mask = 1ULL << (index & 63);
+		if (this->bits[index >> 6].fetch_and (~mask) & mask)
+			-- this->count;
 	}
 	
 	
@@ -136,7 +187,8 @@ namespace hCraft {
 	 */
 	physics_worker::physics_worker (physics_manager &man)
 		: paused (false), ticks (0), man (man),
-			rnd (utils::ns_since_epoch ()), _running (true),
+			rnd (utils::ns_since_epoch ()), snap (new physics_snapshot ()),
+			_running (true),
 		
 			// and finally, the thread:
 			th (std::bind (std::mem_fn (&hCraft::physics_worker::main_loop), this))
@@ -156,24 +208,38 @@ namespace hCraft {
 	physics_manager::~physics_manager ()
 	{
 		this->stop ();
+		
+		for (int i = 0; i < mem_buckets; ++i)
+			for (ph_mem_chunk *ch = this->block_mem[i].load (); ch; )
+				{
+					ph_mem_chunk *next = ch->next.load ();
+					delete ch;
+					ch = next;
+				}
+		for (auto& p : this->queues)
+			delete p.second;
 	}
 	
 	void
 	physics_manager::stop ()
 	{
 		this->workers.clear ();
-		this->updates.clear ();
+		for (auto& p : this->queues)
+			{
+				p.second->updates.clear ();
+				p.second->pending = 0;
+			}
 	}
 	
 	
 	
 	static bool
-	handle_param_dissipate (world *w, physics_update& u, physics_action& act, std::minstd_rand& rnd)
+	handle_param_dissipate (world_transaction& tr, physics_update& u, physics_action& act, std::minstd_rand& rnd)
 	{
 		std::uniform_int_distribution<> dis (0, 100);
 		if (dis (rnd) <= act.val)
 			{
-				w->queue_update (u.data.blk.x, u.data.blk.y, u.data.blk.z, BT_AIR);
+				tr.set (u.data.blk.x, u.data.blk.y, u.data.blk.z, BT_AIR);
 				return false;
 			}
 		
@@ -181,7 +247,7 @@ namespace hCraft {
 	}
 	
 	static bool
-	handle_param_drop (world *w, physics_update& u, physics_action& act)
+	handle_param_drop (world_transaction& tr, physics_update& u, physics_action& act)
 	{
 		int x = u.data.blk.x, y = u.data.blk.y, z = u.data.blk.z;
 		
@@ -190,11 +256,11 @@ namespace hCraft {
 		
 		if (u.elapsed % d == 0)
 			{
-				if ((y > 0) && (w->get_id (x, y - 1, z) == BT_AIR))
+				if ((y > 0) && (tr.get_id (x, y - 1, z) == BT_AIR))
 					{
-						block_data bd = w->get_block (x, y, z);
-						w->queue_update (x, y - 1, z, bd.id, bd.meta);
-						w->queue_update (x, y, z, BT_AIR);
+						block_data bd = tr.get_block (x, y, z);
+						tr.set (x, y - 1, z, bd.id, bd.meta);
+						tr.set (x, y, z, BT_AIR);
 						
 						-- u.data.blk.y;
 						return true;
@@ -208,23 +274,23 @@ namespace hCraft {
 	
 	// based on MCZall's finite mechanics.
 	static bool
-	handle_param_finite (world *w, physics_update& u, physics_action& act, std::minstd_rand& rnd)
+	handle_param_finite (world_transaction& tr, physics_update& u, physics_action& act, std::minstd_rand& rnd)
 	{
 		int x = u.data.blk.x, y = u.data.blk.y, z = u.data.blk.z;
 		
-		block_data bd = w->get_block (x, y, z);
+		block_data bd = tr.get_block (x, y, z);
 		if (bd.id == BT_AIR)
 			return false;
 		else if (y == 0)
 			{
-				w->queue_update (x, y, z, BT_AIR);
+				tr.set (x, y, z, BT_AIR);
 				return false;
 			}
 		
-		if (w->get_id (x, y - 1, z) == BT_AIR)
+		if (tr.get_id (x, y - 1, z) == BT_AIR)
 			{
-				w->queue_update (x, y - 1, z, bd.id, bd.meta);
-				w->queue_update (x, y, z, BT_AIR);
+				tr.set (x, y - 1, z, bd.id, bd.meta);
+				tr.set (x, y, z, BT_AIR);
 				
 				-- u.data.blk.y;
 			}
@@ -261,8 +327,8 @@ namespace hCraft {
 					{
 						int i = ind_list[ii];
 						xz_pos pos = pos_list[i];
-						if (w->get_id (pos.x, y - 1, pos.z) == BT_AIR &&
-								w->get_id (pos.x, y, pos.z) == BT_AIR)
+						if (tr.get_id (pos.x, y - 1, pos.z) == BT_AIR &&
+								tr.get_id (pos.x, y, pos.z) == BT_AIR)
 							{
 								if (pos.x < x) pos.x = std::floor ((pos.x + x) / 2.0);
 								else pos.x = std::ceil ((pos.x + x) / 2.0);
@@ -271,10 +337,10 @@ namespace hCraft {
 								
 								if (pos.x != x || pos.z != z)
 									{
-										if (w->get_id (pos.x, y, pos.z) == BT_AIR)
+										if (tr.get_id (pos.x, y, pos.z) == BT_AIR)
 											{
-												w->queue_update (pos.x, y, pos.z, bd.id, bd.meta);
-												w->queue_update (x, y, z, BT_AIR);
+												tr.set (pos.x, y, pos.z, bd.id, bd.meta);
+												tr.set (x, y, z, BT_AIR);
 										
 												u.data.blk.x = pos.x;
 												u.data.blk.z = pos.z;
@@ -293,6 +359,8 @@ namespace hCraft {
 	{
 		int found = 0;
 		
+		// all actions see each other's changes, and are applied as one unit.
+		world_transaction tr {*w};
 		for (int i = 0; i < 8; ++i)
 			{
 				physics_action& act = u.params.actions[i];
@@ -302,17 +370,17 @@ namespace hCraft {
 				switch (act.type)
 					{
 					case PA_DISSIPATE:
-						if (!handle_param_dissipate (w, u, act, rnd))
+						if (!handle_param_dissipate (tr, u, act, rnd))
 							act.type = PA_NONE;
 						break;
 					
 					case PA_DROP:
-						if (!handle_param_drop (w, u, act))
+						if (!handle_param_drop (tr, u, act))
 							act.type = PA_NONE;
 						break;
 					
 					case PA_FINITE:
-						if (!handle_param_finite (w, u, act, rnd))
+						if (!handle_param_finite (tr, u, act, rnd))
 							act.type = PA_NONE;
 						break;
 					
@@ -330,12 +398,22 @@ namespace hCraft {
 					++ found;
 			}
 		
+		tr.commit ();
+		
 		if (found > 0)
 			{
 				physics_update nu = u;
-				nu.nt = std::chrono::steady_clock::now () + std::chrono::milliseconds (50 * nu.tick);
+				int slowdown = 1;
+				if (nu.type == PU_BLOCK)
+					{
+						// the block's mark has been cleared by the update being
+						// processed now, so the repeated one must not clear it again.
+						nu.data.blk.once = false;
+						slowdown = man.get_queue (nu.wid).slowdown.load ();
+					}
+				nu.nt = std::chrono::steady_clock::now () + std::chrono::milliseconds (50 * nu.tick * slowdown);
 				++ nu.elapsed;
-				man.updates.push (nu);
+				man.push_update (nu);
 			}
 		
 		return true;
@@ -349,12 +427,11 @@ namespace hCraft {
 	void
 	physics_worker::main_loop ()
 	{
-		physics_update u {};
-		const static int updates_per_tick = 8000;
-		int i, fcount;
-		
 		std::minstd_rand rnd ((utils::ns_since_epoch ()));
 		
+		// changes made by physics are not part of a world's recorded input.
+		physics_recorder::suppressed = true;
+		
 		while (this->_running)
 			{
 				std::this_thread::sleep_for (std::chrono::milliseconds (50));
@@ -362,162 +439,625 @@ namespace hCraft {
 				if (paused)
 					continue;
 				
-				fcount = 0; // failure counter
-				for (i = 0; i < updates_per_tick; ++i)
+				auto tick_start = std::chrono::steady_clock::now ();
+				int processed = 0;
+				
+				if ((this->ticks % 100) == 0)
+					this->man.sweep_block_mem ();
+				
+				this->man.begin_tick ();
+				
+				this->wqs.clear ();
+				for (auto& p : this->man.queues)
+					if ((p.second->pending.load (std::memory_order_relaxed) > 0)
+						|| (p.second->entity_pending.load (std::memory_order_relaxed) > 0))
+						this->wqs.push_back (p.second);
+				
+				if (!this->wqs.empty ())
 					{
-						if (!this->_running || paused || this->man.updates.empty ())
-							break;
-						if (!this->man.updates.try_pop (u))
+						// every world first gets an equal share of the tick, and then
+						// whatever is left is handed to the ones that used all of theirs.
+						int left = this->man.updates_per_tick;
+						processed = left;
+						int share = left / (int)this->wqs.size ();
+						if (share < 1) share = 1;
+						
+						// start from a different world every tick
+						std::size_t start = this->ticks % this->wqs.size ();
+						std::rotate (this->wqs.begin (), this->wqs.begin () + start,
+							this->wqs.end ());
+						
+						this->hungry.clear ();
+						for (ph_world_queue *wq : this->wqs)
 							{
-								++ fcount;
-								if (fcount % 15 == 0)
-									std::this_thread::sleep_for (std::chrono::milliseconds (2));
-								if (fcount == 60)
+								if (left <= 0 || !this->_running || paused)
 									break;
-								continue;
+								
+								int limit = (share < left) ? share : left;
+								int done = this->run_queue (*wq, limit, rnd);
+								if (done == limit)
+									this->hungry.push_back (wq);
+								left -= done;
 							}
 						
-						world *w = this->man.srv.world_by_id (u.wid);
-						if (!w) continue;
-						
-						if (u.tick < 0) continue;
-						if (u.nt > std::chrono::steady_clock::now ())
+						for (ph_world_queue *wq : this->hungry)
 							{
-								this->man.updates.push (u);
-								continue;
+								if (left <= 0 || !this->_running || paused)
+									break;
+								left -= this->run_queue (*wq, left, rnd);
 							}
 						
-						// parameters
-						if (!handle_params (w, u, this->man, this->rnd))
-							continue;
-						
-						if (u.type == PU_BLOCK)
+						processed -= left;
+					}
+				
+				this->flush_bulk (rnd);
+				
+				if (this->man.tick_hook)
+					this->man.tick_hook (processed, std::chrono::steady_clock::now () - tick_start);
+			}
+	}
+	
+	/* 
+	 * Runs all due entity ticks of the specified world, and then processes up
+	 * to @{limit} due block updates from its queue, without going over the
+	 * world's budget.  Block updates are held back while the world's physics
+	 * are paused.
+	 * Returns the number of block updates processed.
+	 */
+	int
+	physics_worker::run_queue (ph_world_queue& wq, int limit, std::minstd_rand& rnd)
+	{
+		world *w = this->man.srv.world_by_id (wq.wid);
+		if (!w)
+			return 0;
+		
+		// updates that are not due yet are pushed back into the queue, so make
+		// sure not to go around in circles.
+		int visits = wq.entity_pending.load ();
+		
+		physics_update u {};
+		while (visits-- > 0)
+			{
+				if (!this->_running || paused)
+					return 0;
+				if (!wq.entities.try_pop (u))
+					break;
+				-- wq.entity_pending;
+				
+				if (u.tick < 0) continue;
+				if (u.nt > std::chrono::steady_clock::now ())
+					{
+						this->man.push_update (u);
+						continue;
+					}
+				
+				this->process (w, u, rnd);
+			}
+		
+		if (w->physics_state () == PHY_PAUSED)
+			return 0;
+		
+		visits = wq.pending.load ();
+		int done = 0;
+		while ((done < limit) && (visits-- > 0))
+			{
+				if (!this->_running || paused)
+					break;
+				if (wq.used.load (std::memory_order_relaxed) >= w->ph_budget)
+					break;
+				if (!wq.updates.try_pop (u))
+					break;
+				-- wq.pending;
+				
+				if (u.tick < 0)
+					{
+						if (u.data.blk.once)
+							this->man.remove_block (w, u.data.blk.x, u.data.blk.y, u.data.blk.z);
+						continue;
+					}
+				if (u.nt > std::chrono::steady_clock::now ())
+					{
+						this->man.push_update (u);
+						continue;
+					}
+				
+				++ wq.used;
+				++ done;
+				this->process (w, u, rnd);
+			}
+		
+		return done;
+	}
+	
+	void
+	physics_worker::process (world *w, physics_update& u, std::minstd_rand& rnd)
+	{
+		// the update is no longer pending, whatever its parameters decide.
+		if ((u.type == PU_BLOCK) && u.data.blk.once)
+			this->man.remove_block (w, u.data.blk.x, u.data.blk.y, u.data.blk.z);
+		
+		// parameters
+		if (!handle_params (w, u, this->man, this->rnd))
+			return;
+		
+		if (u.type == PU_BLOCK)
+			{
+				auto blk = u.data.blk;
+				
+				// does this block have a custom callback attached?
+				if (blk.cb)
+					{
+						blk.cb (*w, blk.x, blk.y, blk.z, blk.data, rnd);
+					}
+				else
+					{
+						// nope, use the one associated with its ID
+						physics_block *pb = w->get_physics_at (blk.x, blk.y, blk.z);
+						if (pb)
 							{
-								auto blk = u.data.blk;
-								this->man.remove_block (w, blk.x, blk.y, blk.z);
-								
-								// does this block have a custom callback attached?
-								if (blk.cb)
+								if ((this->man.bulk_threshold > 0) && pb->has_bulk_tick ()
+									&& (blk.y >= 0) && (blk.y <= 255))
 									{
-										blk.cb (*w, blk.x, blk.y, blk.z, blk.data, rnd);
+										// defer to the end of the tick
+										this->bulk_groups[{w, pb->id (), blk.x >> 4, blk.y >> 4, blk.z >> 4}]
+											.push_back ({blk.x, blk.y, blk.z, blk.data});
 									}
 								else
-									{
-										// nope, use the one associated with its ID
-										physics_block *pb = w->get_physics_at (blk.x, blk.y, blk.z);
-										if (pb)
-											pb->tick (*w, blk.x, blk.y, blk.z, blk.data, nullptr, rnd);
-									}
-							}
-						else if (u.type == PU_ENTITY)
-							{
-								auto ent = u.data.ent;
-								entity *e = w->get_server ().entity_by_id (ent.eid);
-								if (!e) continue;
-								if (e->get_type () == ET_PLAYER)
-									{
-										player *pl = dynamic_cast<player *> (e);
-										if (pl->get_world () != w)
-											continue;
-									}
-								
-								if (!e->tick (*w) && ent.persistent)
-									{
-										// requeue
-										physics_update nu = u;
-										nu.nt = std::chrono::steady_clock::now () + std::chrono::milliseconds (50 * nu.tick);
-										man.updates.push (nu);
-									}
+									pb->tick (*w, blk.x, blk.y, blk.z, blk.data, nullptr, rnd);
 							}
 					}
 			}
+		else if (u.type == PU_ENTITY)
+			{
+				auto ent = u.data.ent;
+				entity *e = w->get_server ().entity_by_id (ent.eid);
+				if (!e) return;
+				if (e->get_type () == ET_PLAYER)
+					{
+						player *pl = dynamic_cast<player *> (e);
+						if (pl->get_world () != w)
+							return;
+					}
+				
+				if (!e->tick (*w) && ent.persistent)
+					{
+						// requeue
+						physics_update nu = u;
+						nu.nt = std::chrono::steady_clock::now () + std::chrono::milliseconds (50 * nu.tick);
+						this->man.push_update (nu);
+					}
+			}
+	}
+	
+	/* 
+	 * Runs all blocks collected for bulk processing during the current tick,
+	 * either through their type's bulk kernel, or one by one if there are
+	 * too few of them.
+	 */
+	void
+	physics_worker::flush_bulk (std::minstd_rand& rnd)
+	{
+		if (this->bulk_groups.empty ())
+			return;
+		
+		for (auto& p : this->bulk_groups)
+			{
+				const bulk_key& key = p.first;
+				std::vector<physics_bulk_entry>& blocks = p.second;
+				
+				physics_block *pb = physics_block::from_id (key.id);
+				if (!pb) continue;
+				
+				if ((int)blocks.size () < this->man.bulk_threshold)
+					{
+						for (physics_bulk_entry& e : blocks)
+							pb->tick (*key.w, e.x, e.y, e.z, e.data, nullptr, rnd);
+						continue;
+					}
+				
+				this->snap->load (*key.w, key.cx, key.sy, key.cz, pb->bulk_source ());
+				this->bulk_changes.clear ();
+				pb->bulk_tick (*this->snap, blocks.data (), blocks.size (),
+					this->bulk_changes, rnd);
+				physics_commit_changes (*key.w, this->bulk_changes);
+			}
+		
+		this->bulk_groups.clear ();
 	}
 	
 	
 	
+	/* 
+	 * Marks the calling thread as reading block_mem for as long as it is
+	 * alive.  Chunks that are unlinked by the sweeper are only freed once all
+	 * guards that might have seen them have gone away.
+	 */
+	struct physics_manager::mem_read_guard
+	{
+		physics_manager& man;
+		std::atomic<int> *count;
+		
+		mem_read_guard (physics_manager& man)
+			: man (man)
+		{
+			static std::atomic<int> next_stripe {0};
+			static thread_local int stripe = (next_stripe++) % mem_reader_stripes;
+			
+			// the phase has to be the same before and after registering,
+			// otherwise the sweeper might have missed us.
+			for (;;)
+				{
+					int phase = man.mem_phase.load ();
+					this->count = &man.mem_readers[phase][stripe].n;
+					this->count->fetch_add (1);
+					if (man.mem_phase.load () == phase)
+						break;
+					this->count->fetch_sub (1);
+				}
+		}
+		
+		~mem_read_guard ()
+			{ this->count->fetch_sub (1); }
+	};
+	
+	/* 
+	 * Waits until every thread that was reading block_mem when this was
+	 * called is done.
+	 */
+	void
+	physics_manager::wait_for_mem_readers ()
+	{
+		// new readers register under the other phase, so the old one can only
+		// drain.
+		int phase = this->mem_phase.load ();
+		this->mem_phase.store (phase ^ 1);
+		for (int i = 0; i < mem_reader_stripes; ++i)
+			while (this->mem_readers[phase][i].n.load () > 0)
+				std::this_thread::yield ();
+	}
+	
+	
+	
+	static inline int
+	_mem_bucket (const ph_mem_key& key, int buckets)
+	{
+		return (int)(ph_mem_key_hash () (key) % buckets);
+	}
+	
+	/* 
+	 * Looks up the chunk without taking any locks.  Must be called with a
+	 * mem_read_guard in place.
+	 */
+	ph_mem_chunk*
+	physics_manager::find_mem_chunk (world *w, int cx, int cz)
+	{
+		ph_mem_key key {w, cx, cz};
+		int b = _mem_bucket (key, mem_buckets);
+		for (ph_mem_chunk *ch = this->block_mem[b].load (); ch; ch = ch->next.load ())
+			if (ch->key == key)
+				return ch;
+		return nullptr;
+	}
+	
+	/* 
+	 * Same as find_mem_chunk (), but adds the chunk if it is not there, or if
+	 * the one found is being unlinked.
+	 */
+	ph_mem_chunk*
+	physics_manager::get_mem_chunk (world *w, int cx, int cz)
+	{
+		ph_mem_chunk *ch = this->find_mem_chunk (w, cx, cz);
+		if (ch && !ch->dead.load ())
+			return ch;
+		
+		// the sweeper holds the bucket's lock while it decides on a chunk, so
+		// there are no dead chunks in the chain once we have it.
+		ph_mem_key key {w, cx, cz};
+		int b = _mem_bucket (key, mem_buckets);
+		std::lock_guard<std::mutex> guard {this->mem_bucket_lock[b % mem_bucket_locks]};
+		ch = this->find_mem_chunk (w, cx, cz);
+		if (ch)
+			return ch;
+		
+		ch = new ph_mem_chunk (key);
+		ch->next.store (this->block_mem[b].load ());
+		this->block_mem[b].store (ch);
+		return ch;
+	}
+	
+	
 	bool
-	physics_manager::block_exists_nolock (world *w, int x, int y, int z)
+	physics_manager::block_exists (world *w, int x, int y, int z)
 	{
 		if (y < 0 || y > 255) return false;
 		
-		auto w_itr = this->block_mem.find (w);
-		if (w_itr == this->block_mem.end ())
-			return false;
-		std::unordered_map<chunk_pos, ph_mem_chunk, chunk_pos_hash>&
-			mem_chunks = w_itr->second;
-		
-		auto ch_itr = mem_chunks.find ({x >> 4, z >> 4});
-		if (ch_itr == mem_chunks.end ())
+		mem_read_guard rguard {*this};
+		ph_mem_chunk *ch = this->find_mem_chunk (w, x >> 4, z >> 4);
+		if (!ch)
 			return false;
-		ph_mem_chunk& ch = ch_itr->second;
-		ph_mem_subchunk* sub = ch.subs[y >> 4];
+		ph_mem_subchunk *sub = ch->subs[y >> 4].load ();
 		if (sub == nullptr)
 			return false;
-		return (sub->blocks[((y & 0xF) << 8) | ((z & 0xF) << 4) | (x & 0xF)] > 0);
+		return sub->test (((y & 0xF) << 8) | ((z & 0xF) << 4) | (x & 0xF));
+	}
+	
+	/* 
+	 * Marks the specified block as having a pending queue_physics_once ()
+	 * update.  Returns true if the block was not marked before.
+	 */
+	bool
+	physics_manager::add_block (world *w, int x, int y, int z)
+	{
+		if (y < 0 || y > 255) return true;
+		
+		mem_read_guard rguard {*this};
+		ph_mem_chunk *ch;
+		for (;;)
+			{
+				ch = this->get_mem_chunk (w, x >> 4, z >> 4);
+				ch->writers.fetch_add (1);
+				if (!ch->dead.load ())
+					break;
+				
+				// being unlinked, get_mem_chunk () waits for the sweeper.
+				ch->writers.fetch_sub (1);
+			}
+		
+		if (!ch->touched.load (std::memory_order_relaxed))
+			ch->touched.store (true, std::memory_order_relaxed);
+		
+		std::atomic<ph_mem_subchunk *>& slot = ch->subs[y >> 4];
+		ph_mem_subchunk *sub = slot.load ();
+		if (sub == nullptr)
+			{
+				ph_mem_subchunk *nsub = new ph_mem_subchunk ();
+				if (slot.compare_exchange_strong (sub, nsub))
+					sub = nsub;
+				else
+					delete nsub; // sub now holds the winner's map
+			}
+		
+		bool added = sub->test_and_set (((y & 0xF) << 8) | ((z & 0xF) << 4) | (x & 0xF));
+		ch->writers.fetch_sub (1);
+		return added;
 	}
 	
 	void
-	physics_manager::add_block_nolock (world *w, int x, int y, int z)
+	physics_manager::remove_block (world *w, int x, int y, int z)
 	{
 		if (y < 0 || y > 255) return;
 		
-		std::unordered_map<chunk_pos, ph_mem_chunk, chunk_pos_hash>&
-			mem_chunks = this->block_mem[w];
-		ph_mem_chunk& ch = mem_chunks[{x >> 4, z >> 4}];
-		ph_mem_subchunk* sub = ch.subs[y >> 4];
+		// a chunk only dies with all of its bits clear, so there is nothing to
+		// coordinate with the sweeper here.
+		mem_read_guard rguard {*this};
+		ph_mem_chunk *ch = this->find_mem_chunk (w, x >> 4, z >> 4);
+		if (!ch)
+			return;
+		ph_mem_subchunk *sub = ch->subs[y >> 4].load ();
 		if (sub == nullptr)
-			sub = ch.subs[y >> 4] = new ph_mem_subchunk ();
+			return;
 		
-		unsigned int index = ((y & 0xF) << 8) | ((z & 0xF) << 4) | (x & 0xF);
-		if (sub->blocks[index] < 0xFFFF)
-			++ sub->blocks[index];
-		else
-			std::cout << "!!!" << std::endl;
+		sub->clear (((y & 0xF) << 8) | ((z & 0xF) << 4) | (x & 0xF));
 	}
 	
-		
-	bool
-	physics_manager::block_exists (world *w, int x, int y, int z)
+	
+	static bool
+	_mem_chunk_empty (ph_mem_chunk *ch)
 	{
-		std::lock_guard<std::mutex> guard {this->lock};
-		return this->block_exists_nolock (w, x, y, z);
+		for (int i = 0; i < 16; ++i)
+			{
+				ph_mem_subchunk *sub = ch->subs[i].load ();
+				if (sub && sub->count.load () > 0)
+					return false;
+			}
+		return true;
 	}
 	
+	/* 
+	 * Releases the memory used by regions that had no pending updates
+	 * since the last sweep.  Called periodically by the workers.
+	 */
 	void
-	physics_manager::add_block (world *w, int x, int y, int z)
+	physics_manager::sweep_block_mem ()
 	{
-		std::lock_guard<std::mutex> guard {this->lock};
-		this->add_block_nolock (w, x, y, z);
+		std::unique_lock<std::mutex> guard {this->mem_lock, std::try_to_lock};
+		if (!guard.owns_lock ())
+			return; // another worker is already at it
+		
+		auto now = std::chrono::steady_clock::now ();
+		if (now - this->last_sweep < std::chrono::seconds (5))
+			return;
+		this->last_sweep = now;
+		
+		std::vector<ph_mem_chunk *> unlinked;
+		for (int b = 0; b < mem_buckets; ++b)
+			{
+				if (!this->block_mem[b].load ())
+					continue;
+				
+				std::lock_guard<std::mutex> bguard {this->mem_bucket_lock[b % mem_bucket_locks]};
+				std::atomic<ph_mem_chunk *> *link = &this->block_mem[b];
+				for (ph_mem_chunk *ch = link->load (); ch; )
+					{
+						ph_mem_chunk *next = ch->next.load ();
+						if (!ch->touched.exchange (false))
+							{
+								// no new marks once dead is set, so if nobody is marking
+								// and nothing is pending, it is safe to let go.
+								ch->dead.store (true);
+								if (ch->writers.load () == 0 && _mem_chunk_empty (ch))
+									{
+										link->store (next);
+										unlinked.push_back (ch);
+										ch = next;
+										continue;
+									}
+								ch->dead.store (false);
+							}
+						
+						link = &ch->next;
+						ch = next;
+					}
+			}
+		
+		if (unlinked.empty ())
+			return;
+		
+		// lookups that started before the chunks were unlinked might still be
+		// walking through them.
+		this->wait_for_mem_readers ();
+		for (ph_mem_chunk *ch : unlinked)
+			delete ch;
 	}
 	
+	
+	
+//-----------
+	
+	ph_world_queue&
+	physics_manager::get_queue (int wid)
+	{
+		auto itr = this->queues.find (wid);
+		if (itr != this->queues.end ())
+			return *itr->second;
+		
+		ph_world_queue *wq = new ph_world_queue (wid);
+		auto res = this->queues.insert ({wid, wq});
+		if (!res.second)
+			{
+				// another thread got here first
+				delete wq;
+				wq = res.first->second;
+			}
+		
+		return *wq;
+	}
+	
+	/* 
+	 * Pushes an update into its world's queue.
+	 */
 	void
-	physics_manager::remove_block (world *w, int x, int y, int z)
+	physics_manager::push_update (const physics_update& u)
 	{
-		if (y < 0 || y > 255) return;
-		std::lock_guard<std::mutex> guard {this->lock};
+		ph_world_queue& wq = this->get_queue (u.wid);
+		if (u.type == PU_ENTITY)
+			{
+				++ wq.entity_pending;
+				wq.entities.push (u);
+				return;
+			}
 		
-		auto w_itr = this->block_mem.find (w);
-		if (w_itr == this->block_mem.end ())
+		++ wq.pending;
+		wq.updates.push (u);
+	}
+	
+	
+	/* 
+	 * Resets per-tick budget counters and adjusts the slowdown factor of
+	 * every world according to its load.  Called by the workers at the start
+	 * of every tick, only one of them gets through every 50ms.
+	 */
+	void
+	physics_manager::begin_tick ()
+	{
+		std::unique_lock<std::mutex> guard {this->sched_lock, std::try_to_lock};
+		if (!guard.owns_lock ())
 			return;
-		std::unordered_map<chunk_pos, ph_mem_chunk, chunk_pos_hash>&
-			mem_chunks = w_itr->second;
 		
-		auto ch_itr = mem_chunks.find ({x >> 4, z >> 4});
-		if (ch_itr == mem_chunks.end ())
+		auto now = std::chrono::steady_clock::now ();
+		if (now < this->next_tick)
 			return;
-		ph_mem_chunk& ch = ch_itr->second;
-		ph_mem_subchunk* sub = ch.subs[y >> 4];
-		if (sub == nullptr)
+		this->next_tick = now + std::chrono::milliseconds (50);
+		
+		for (auto& p : this->queues)
+			{
+				ph_world_queue& wq = *p.second;
+				int used = wq.used.exchange (0);
+				wq.last_used = used;
+				
+				world *w = this->srv.world_by_id (wq.wid);
+				if (!w)
+					{
+						// the world has been unloaded
+						physics_update u;
+						while (wq.updates.try_pop (u))
+							-- wq.pending;
+						while (wq.entities.try_pop (u))
+							-- wq.entity_pending;
+						continue;
+					}
+				
+				if (wq.overloaded.load () && (wq.pending.load () < (w->ph_max_pending / 2)))
+					{
+						wq.overloaded = false;
+						this->srv.get_logger () (LT_SYSTEM) << "Physics queue of world \"" << w->get_name ()
+							<< "\" has drained, no longer dropping updates." << std::endl;
+					}
+				
+				// tick delays are doubled after two seconds of running at full
+				// budget, and halved back after five seconds of light load.
+				int slowdown = wq.slowdown.load ();
+				if (used >= w->ph_budget)
+					{
+						wq.cold_ticks = 0;
+						if ((++ wq.hot_ticks >= 40) && (slowdown < 8))
+							{
+								wq.slowdown = slowdown * 2;
+								wq.hot_ticks = 0;
+							}
+					}
+				else if (used < (w->ph_budget / 2))
+					{
+						wq.hot_ticks = 0;
+						if ((++ wq.cold_ticks >= 100) && (slowdown > 1))
+							{
+								wq.slowdown = slowdown / 2;
+								wq.cold_ticks = 0;
+							}
+					}
+			}
+	}
+	
+	/* 
+	 * Called when a world's queue reaches its limit.  New block updates are
+	 * dropped until the queue drains back to half its size; the world itself
+	 * keeps running, so that entity ticks are never held up by block physics.
+	 */
+	void
+	physics_manager::overloaded (world *w, ph_world_queue& wq)
+	{
+		++ wq.dropped;
+		if (wq.overloaded.exchange (true))
 			return;
 		
-		unsigned int index = ((y & 0xF) << 8) | ((z & 0xF) << 4) | (x & 0xF);
-		if (sub->blocks[index] > 0)
-			-- sub->blocks[index];
+		w->get_players ().message ("§c * §7Physics are §cdropping updates §7due to excessive load§f.");
+		this->srv.get_logger () (LT_WARNING) << "Physics queue of world \"" << w->get_name ()
+			<< "\" is full, dropping updates." << std::endl;
 	}
 	
 	
+	/* 
+	 * Fills @{out} with the budget utilization of the specified world.
+	 * Returns false if the world has no updates queued in this manager.
+	 */
+	bool
+	physics_manager::get_stats (world *w, physics_world_stats& out)
+	{
+		auto itr = this->queues.find (w->id);
+		if (itr == this->queues.end ())
+			return false;
+		
+		ph_world_queue& wq = *itr->second;
+		out.pending = wq.pending.load ();
+		out.max_pending = w->ph_max_pending;
+		out.budget = w->ph_budget;
+		out.used = wq.last_used.load ();
+		out.slowdown = wq.slowdown.load ();
+		out.dropped = wq.dropped.load ();
+		return true;
+	}
+	
 	
-//-----------
 	
 	/* 
 	 * Changes the number of worker threads to utilize.
@@ -560,11 +1100,16 @@ namespace hCraft {
 		//if (tick_delay == 0) tick_delay = 1;
 		//-- tick_delay;
 		
-		std::lock_guard<std::mutex> guard {this->lock};
-		this->add_block_nolock (w, x, y, z);
+		ph_world_queue& wq = this->get_queue (w->id);
+		if (wq.pending.load (std::memory_order_relaxed) >= w->ph_max_pending)
+			{
+				this->overloaded (w, wq);
+				return;
+			}
 		
+		int delay = ((tick_delay < 0) ? 0 : tick_delay) * wq.slowdown.load (std::memory_order_relaxed);
 		physics_update u (w->id, x, y, z, data, tick_delay,
-			std::chrono::steady_clock::now () + std::chrono::milliseconds (50 * ((tick_delay < 0) ? 0 : tick_delay)),
+			std::chrono::steady_clock::now () + std::chrono::milliseconds (50 * delay),
 			cb);
 		if (params)
 			for (int i = 0; i < 8; ++i)
@@ -574,7 +1119,7 @@ namespace hCraft {
 						break;
 				}
 		
-		this->updates.push (u);
+		this->push_update (u);
 	}
 	
 	/* 
@@ -586,17 +1131,25 @@ namespace hCraft {
 		int data, int tick_delay, physics_params *params,
 		physics_block_callback cb)
 	{
-		std::lock_guard<std::mutex> guard {this->lock};
-		if (this->block_exists_nolock (w, x, y, z))
+		ph_world_queue& wq = this->get_queue (w->id);
+		if (wq.pending.load (std::memory_order_relaxed) >= w->ph_max_pending)
+			{
+				this->overloaded (w, wq);
+				return;
+			}
+		
+		// atomically test and mark the block
+		if (!this->add_block (w, x, y, z))
 			return;
 		
 		//if (tick_delay == 0) tick_delay = 1;
 		//-- tick_delay;
 		
-		this->add_block_nolock (w, x, y, z);
+		int delay = ((tick_delay < 0) ? 0 : tick_delay) * wq.slowdown.load (std::memory_order_relaxed);
 		physics_update u (w->id, x, y, z, data, tick_delay,
-			std::chrono::steady_clock::now () + std::chrono::milliseconds (50 * ((tick_delay < 0) ? 0 : tick_delay)),
+			std::chrono::steady_clock::now () + std::chrono::milliseconds (50 * delay),
 			cb);
+		u.data.blk.once = true;
 		if (params)
 			for (int i = 0; i < 8; ++i)
 				{
@@ -605,7 +1158,7 @@ namespace hCraft {
 						break;
 				}
 		
-		this->updates.push (u);
+		this->push_update (u);
 	}
 	
 	
@@ -619,8 +1172,6 @@ namespace hCraft {
 		//if (tick_delay == 0) tick_delay = 1;
 		//-- tick_delay;
 		
-		std::lock_guard<std::mutex> guard {this->lock};
-		
 		physics_update u (w->id, eid, persistent, tick_delay,
 			std::chrono::steady_clock::now () + std::chrono::milliseconds (50 * ((tick_delay < 0) ? 0 : tick_delay)));
 		if (params)
@@ -631,7 +1182,7 @@ namespace hCraft {
 						break;
 				}
 		
-		this->updates.push (u);
+		this->push_update (u);
 	}
 }
 
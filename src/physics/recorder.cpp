@@ -0,0 +1,456 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "physics/recorder.hpp"
+#include "world/world.hpp"
+#include "world/chunk.hpp"
+#include <fstream>
+#include <cstring>
+#include <zlib.h>
+
+
+namespace hCraft {
+	
+	physics_recording::physics_recording ()
+		: duration (0), skipped (0)
+		{ }
+	
+	
+	
+//----
+	// file io
+	
+	static void
+	_write_int (std::ostream& strm, unsigned int val)
+	{
+		unsigned char buf[4] = {
+			(unsigned char)(val >> 24), (unsigned char)(val >> 16),
+			(unsigned char)(val >> 8), (unsigned char)val };
+		strm.write ((const char *)buf, 4);
+	}
+	
+	static void
+	_write_short (std::ostream& strm, unsigned short val)
+	{
+		unsigned char buf[2] = { (unsigned char)(val >> 8), (unsigned char)val };
+		strm.write ((const char *)buf, 2);
+	}
+	
+	static void
+	_write_byte (std::ostream& strm, unsigned char val)
+	{
+		strm.write ((const char *)&val, 1);
+	}
+	
+	static unsigned int
+	_read_int (std::istream& strm)
+	{
+		unsigned char buf[4];
+		if (!strm.read ((char *)buf, 4))
+			throw physics_recording_error ("unexpected end of file");
+		return ((unsigned int)buf[0] << 24) | ((unsigned int)buf[1] << 16)
+			| ((unsigned int)buf[2] << 8) | buf[3];
+	}
+	
+	static unsigned short
+	_read_short (std::istream& strm)
+	{
+		unsigned char buf[2];
+		if (!strm.read ((char *)buf, 2))
+			throw physics_recording_error ("unexpected end of file");
+		return (buf[0] << 8) | buf[1];
+	}
+	
+	static unsigned char
+	_read_byte (std::istream& strm)
+	{
+		unsigned char val;
+		if (!strm.read ((char *)&val, 1))
+			throw physics_recording_error ("unexpected end of file");
+		return val;
+	}
+	
+	
+	/* 
+	 * Reads\writes the recording from\to the specified file.
+	 * Throws `physics_recording_error' on failure.
+	 */
+	void
+	physics_recording::save (const char *path) const
+	{
+		std::ofstream strm (path, std::ios_base::binary);
+		if (!strm)
+			throw physics_recording_error ("could not open file for writing");
+		
+		strm.write ("HCPR", 4);
+		_write_byte (strm, 1); // version
+		_write_int (strm, this->duration);
+		_write_int (strm, this->skipped);
+		
+		// snapshot
+		_write_int (strm, this->chunks.size ());
+		std::vector<unsigned char> raw (65536 * 4);
+		std::vector<unsigned char> compressed (compressBound (raw.size ()));
+		for (const physics_recorded_chunk& ch : this->chunks)
+			{
+				for (int i = 0; i < 65536; ++i)
+					{
+						raw[i * 2] = ch.ids[i] >> 8;
+						raw[i * 2 + 1] = ch.ids[i] & 0xFF;
+					}
+				std::memcpy (raw.data () + 131072, ch.meta.data (), 65536);
+				std::memcpy (raw.data () + 196608, ch.extra.data (), 65536);
+				
+				unsigned long csize = compressed.size ();
+				if (compress2 (compressed.data (), &csize, raw.data (), raw.size (), 6) != Z_OK)
+					throw physics_recording_error ("failed to compress chunk");
+				
+				_write_int (strm, ch.cx);
+				_write_int (strm, ch.cz);
+				_write_int (strm, csize);
+				strm.write ((const char *)compressed.data (), csize);
+			}
+		
+		// records
+		_write_int (strm, this->records.size ());
+		for (const physics_record& rec : this->records)
+			{
+				_write_byte (strm, rec.type);
+				_write_byte (strm, rec.flags);
+				_write_int (strm, rec.time);
+				_write_int (strm, rec.x);
+				_write_int (strm, rec.y);
+				_write_int (strm, rec.z);
+				_write_short (strm, rec.id);
+				_write_byte (strm, rec.meta);
+				_write_byte (strm, rec.extra);
+				_write_int (strm, rec.data);
+				_write_int (strm, rec.tick_delay);
+				
+				if (rec.flags & PRF_PARAMS)
+					for (int i = 0; i < 8; ++i)
+						{
+							_write_byte (strm, rec.params.actions[i].type);
+							_write_int (strm, rec.params.actions[i].expire);
+							_write_short (strm, rec.params.actions[i].val);
+						}
+			}
+		
+		if (!strm)
+			throw physics_recording_error ("write error");
+	}
+	
+	void
+	physics_recording::load (const char *path)
+	{
+		std::ifstream strm (path, std::ios_base::binary);
+		if (!strm)
+			throw physics_recording_error ("could not open file for reading");
+		
+		char magic[4];
+		if (!strm.read (magic, 4) || std::memcmp (magic, "HCPR", 4) != 0)
+			throw physics_recording_error ("not a physics recording");
+		if (_read_byte (strm) != 1)
+			throw physics_recording_error ("unsupported version");
+		this->duration = _read_int (strm);
+		this->skipped = _read_int (strm);
+		
+		// snapshot
+		this->chunks.clear ();
+		unsigned int chunk_count = _read_int (strm);
+		std::vector<unsigned char> raw (65536 * 4);
+		std::vector<unsigned char> compressed;
+		for (unsigned int c = 0; c < chunk_count; ++c)
+			{
+				physics_recorded_chunk ch;
+				ch.cx = (int)_read_int (strm);
+				ch.cz = (int)_read_int (strm);
+				
+				unsigned int csize = _read_int (strm);
+				if (csize > compressBound (raw.size ()))
+					throw physics_recording_error ("corrupt chunk");
+				compressed.resize (csize);
+				if (!strm.read ((char *)compressed.data (), csize))
+					throw physics_recording_error ("unexpected end of file");
+				
+				unsigned long rsize = raw.size ();
+				if (uncompress (raw.data (), &rsize, compressed.data (), csize) != Z_OK
+					|| rsize != raw.size ())
+					throw physics_recording_error ("corrupt chunk");
+				
+				ch.ids.resize (65536);
+				for (int i = 0; i < 65536; ++i)
+					ch.ids[i] = (raw[i * 2] << 8) | raw[i * 2 + 1];
+				ch.meta.assign (raw.begin () + 131072, raw.begin () + 196608);
+				ch.extra.assign (raw.begin () + 196608, raw.end ());
+				this->chunks.push_back (std::move (ch));
+			}
+		
+		// records
+		this->records.clear ();
+		unsigned int record_count = _read_int (strm);
+		this->records.reserve (record_count);
+		for (unsigned int r = 0; r < record_count; ++r)
+			{
+				physics_record rec;
+				rec.type = (physics_record_type)_read_byte (strm);
+				if (rec.type > PRT_SET)
+					throw physics_recording_error ("corrupt record");
+				rec.flags = _read_byte (strm);
+				rec.time = _read_int (strm);
+				rec.x = (int)_read_int (strm);
+				rec.y = (int)_read_int (strm);
+				rec.z = (int)_read_int (strm);
+				rec.id = _read_short (strm);
+				rec.meta = _read_byte (strm);
+				rec.extra = _read_byte (strm);
+				rec.data = (int)_read_int (strm);
+				rec.tick_delay = (int)_read_int (strm);
+				
+				if (rec.flags & PRF_PARAMS)
+					for (int i = 0; i < 8; ++i)
+						{
+							rec.params.actions[i].type = (physics_action_type)_read_byte (strm);
+							rec.params.actions[i].expire = (int)_read_int (strm);
+							rec.params.actions[i].val = (short)_read_short (strm);
+						}
+				
+				this->records.push_back (rec);
+			}
+	}
+	
+	
+	
+	/* 
+	 * Copies the recorded region into the specified world.
+	 */
+	void
+	physics_recording::apply_snapshot (world &w) const
+	{
+		for (const physics_recorded_chunk& rch : this->chunks)
+			{
+				chunk *ch = new chunk ();
+				for (int i = 0; i < 65536; ++i)
+					if (rch.ids[i] != BT_AIR)
+						ch->set_block (i & 0xF, i >> 8, (i >> 4) & 0xF, rch.ids[i],
+							rch.meta[i], rch.extra[i]);
+				
+				ch->generated = true;
+				ch->recalc_heightmap ();
+				w.put_chunk (rch.cx, rch.cz, ch);
+				w.lm.relight_chunk (ch);
+			}
+	}
+	
+	/* 
+	 * Feeds a single record into the given world.
+	 */
+	void
+	physics_recording::replay (world &w, const physics_record& rec)
+	{
+		switch (rec.type)
+			{
+			case PRT_UPDATE:
+				w.queue_update (rec.x, rec.y, rec.z, rec.id, rec.meta, rec.extra,
+					rec.data, nullptr, nullptr, (rec.flags & PRF_PHYSICS) != 0);
+				break;
+			
+			case PRT_PHYSICS:
+				{
+					physics_params params = rec.params;
+					physics_params *pp = (rec.flags & PRF_PARAMS) ? &params : nullptr;
+					if (rec.flags & PRF_ONCE)
+						w.queue_physics_once (rec.x, rec.y, rec.z, rec.data, nullptr,
+							rec.tick_delay, pp);
+					else
+						w.queue_physics (rec.x, rec.y, rec.z, rec.data, nullptr,
+							rec.tick_delay, pp);
+				}
+				break;
+			
+			case PRT_SET:
+				{
+					std::lock_guard<std::mutex> guard {w.get_update_lock ()};
+					w.set_block (rec.x, rec.y, rec.z, rec.id, rec.meta, rec.extra);
+				}
+				break;
+			}
+	}
+	
+	/* 
+	 * Computes a checksum over the contents of the recorded region in the
+	 * specified world.
+	 */
+	unsigned long long
+	physics_recording::checksum (world &w) const
+	{
+		// FNV-1a
+		unsigned long long hash = 14695981039346656037ULL;
+		auto feed = [&hash] (unsigned int val)
+			{
+				for (int i = 0; i < 4; ++i)
+					{
+						hash ^= (val >> (i * 8)) & 0xFF;
+						hash *= 1099511628211ULL;
+					}
+			};
+		
+		for (const physics_recorded_chunk& rch : this->chunks)
+			{
+				feed (rch.cx);
+				feed (rch.cz);
+				
+				chunk *ch = w.get_chunk (rch.cx, rch.cz);
+				if (!ch)
+					continue;
+				
+				for (int i = 0; i < 65536; ++i)
+					{
+						int x = i & 0xF, y = i >> 8, z = (i >> 4) & 0xF;
+						feed ((ch->get_id (x, y, z) << 8) | ch->get_meta (x, y, z));
+					}
+			}
+		
+		return hash;
+	}
+	
+	
+	
+//----
+	
+	thread_local bool physics_recorder::suppressed = false;
+	
+	/* 
+	 * Takes a snapshot of all loaded chunks within @{radius} chunks of the
+	 * given chunk coordinates.
+	 */
+	physics_recorder::physics_recorder (world &w, int cx, int cz, int radius)
+		: start (std::chrono::steady_clock::now ())
+	{
+		for (int x = cx - radius; x <= cx + radius; ++x)
+			for (int z = cz - radius; z <= cz + radius; ++z)
+				{
+					chunk *ch = w.get_chunk (x, z);
+					if (!ch || ch == w.get_edge_chunk ())
+						continue;
+					
+					physics_recorded_chunk rch;
+					rch.cx = x;
+					rch.cz = z;
+					rch.ids.resize (65536);
+					rch.meta.resize (65536);
+					rch.extra.resize (65536);
+					for (int i = 0; i < 65536; ++i)
+						{
+							int bx = i & 0xF, by = i >> 8, bz = (i >> 4) & 0xF;
+							rch.ids[i] = ch->get_id (bx, by, bz);
+							rch.meta[i] = ch->get_meta (bx, by, bz);
+							rch.extra[i] = ch->get_extra (bx, by, bz);
+						}
+					
+					this->rec.chunks.push_back (std::move (rch));
+				}
+	}
+	
+	
+	unsigned int
+	physics_recorder::elapsed ()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds> (
+			std::chrono::steady_clock::now () - this->start).count ();
+	}
+	
+	
+	void
+	physics_recorder::record_update (int x, int y, int z, unsigned short id,
+		unsigned char meta, int extra, int data, bool physics)
+	{
+		physics_record r;
+		r.type = PRT_UPDATE;
+		r.flags = physics ? PRF_PHYSICS : 0;
+		r.x = x; r.y = y; r.z = z;
+		r.id = id;
+		r.meta = meta;
+		r.extra = extra;
+		r.data = data;
+		r.tick_delay = 0;
+		
+		std::lock_guard<std::mutex> guard {this->lock};
+		r.time = this->elapsed ();
+		this->rec.records.push_back (r);
+	}
+	
+	void
+	physics_recorder::record_physics (int x, int y, int z, int extra,
+		int tick_delay, physics_params *params, physics_block_callback cb, bool once)
+	{
+		std::lock_guard<std::mutex> guard {this->lock};
+		if (cb)
+			{
+				// there is no way to store function pointers
+				++ this->rec.skipped;
+				return;
+			}
+		
+		physics_record r;
+		r.type = PRT_PHYSICS;
+		r.flags = (params ? PRF_PARAMS : 0) | (once ? PRF_ONCE : 0);
+		r.time = this->elapsed ();
+		r.x = x; r.y = y; r.z = z;
+		r.id = 0;
+		r.meta = r.extra = 0;
+		r.data = extra;
+		r.tick_delay = tick_delay;
+		if (params)
+			r.params = *params;
+		
+		this->rec.records.push_back (r);
+	}
+	
+	void
+	physics_recorder::record_set (int x, int y, int z, unsigned short id,
+		unsigned char meta, unsigned char extra)
+	{
+		physics_record r;
+		r.type = PRT_SET;
+		r.flags = 0;
+		r.x = x; r.y = y; r.z = z;
+		r.id = id;
+		r.meta = meta;
+		r.extra = extra;
+		r.data = 0;
+		r.tick_delay = 0;
+		
+		std::lock_guard<std::mutex> guard {this->lock};
+		r.time = this->elapsed ();
+		this->rec.records.push_back (r);
+	}
+	
+	
+	/* 
+	 * Stops recording and returns the result.
+	 */
+	physics_recording&
+	physics_recorder::finish ()
+	{
+		std::lock_guard<std::mutex> guard {this->lock};
+		this->rec.duration = this->elapsed ();
+		return this->rec;
+	}
+}
+
@@ -18,6 +18,7 @@
 
 #include "player/player.hpp"
 #include "system/server.hpp"
+#include "system/packet_pool.hpp"
 #include "util/stringutils.hpp"
 #include "util/wordwrap.hpp"
 #include "commands/command.hpp"
@@ -56,7 +57,9 @@ namespace hCraft {
 	 */
 	player::player (server &srv, struct event_base *evbase, evutil_socket_t sock,
 		const char *ip)
-		: living_entity (srv), log (srv.get_logger ()), sock (sock)
+		: living_entity (srv), log (srv.get_logger ()), sock (sock),
+			strand (srv.get_thread_pool (),
+				[this] (received_packet& rp) { this->handle_received (rp); })
 	{
 		std::strcpy (this->ip, ip);
 		
@@ -84,9 +87,14 @@ namespace hCraft {
 		this->disconnecting = false;
 		this->reading = false;
 		this->writing = false;
+		this->kick_sent = false;
+		this->pace_rate = 256 * 1024.0;
+		this->pace_tokens = this->pace_rate * 0.25; // start with a full bucket
+		this->bytes_drained = 0;
+		this->pace_last_drained = 0;
+		this->pace_last = std::chrono::steady_clock::now ();
 		this->handlers_scheduled = 0;
-		this->total_read = 0;
-		this->read_rem = 1;
+		this->dec_count = 0;
 		this->dbid = -1;
 		
 		this->eating = false;
@@ -101,6 +109,11 @@ namespace hCraft {
 		this->last_heart_regen = this->last_tick;
 		this->heal_delay = std::chrono::milliseconds (4000);
 		this->tick_counter = 0;
+		this->move_sent_valid = false;
+		this->interest_world = nullptr;
+		this->interest_radius = 0;
+		this->edstage_count = 0;
+		this->ticks_since_abs_move = 0;
 		
 		this->curr_gamemode = GT_SURVIVAL;
 		this->joining_world = false;
@@ -109,6 +122,18 @@ namespace hCraft {
 		this->sb_block.set (BT_STILL_WATER);
 		this->need_new_chunks = false;
 		this->streaming_chunks = false;
+		this->stream_world = nullptr;
+		this->stream_cx = this->stream_cz = 0;
+		this->stream_radius = 0;
+		this->view_distance = 0;
+		this->slow_ticks = 0;
+		this->move_vx = this->move_vz = 0.0;
+		this->last_move_time = this->last_tick;
+		this->prefetch_world = nullptr;
+		this->prefetch_cx = this->prefetch_cz = 0;
+		this->tp_pending = false;
+		this->tp_moving = false;
+		this->tp_measuring = false;
 		this->bundo = nullptr;
 		
 		this->curr_sel = nullptr;
@@ -120,10 +145,14 @@ namespace hCraft {
 		
 		this->evbase = evbase;
 		this->bufev  = bufferevent_socket_new (evbase, sock,
-			BEV_OPT_CLOSE_ON_FREE);
+			BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE);
 		if (!this->bufev)
 			{ this->fail = true; this->get_server ().schedule_destruction (this); return; }
 		
+		// count write system calls.
+		evbuffer_add_cb (bufferevent_get_output (this->bufev),
+			&hCraft::player::handle_output_drain, this);
+		
 		this->encryptor = nullptr;
 		this->decryptor = nullptr;
 		
@@ -160,15 +189,11 @@ namespace hCraft {
 		while (this->is_disconnecting ())
 			std::this_thread::sleep_for (std::chrono::milliseconds (1));
 		
-		{
-			std::lock_guard<std::mutex> guard {this->out_lock};
-			while (!this->out_queue.empty ())
-				{
-					packet *top = this->out_queue.front ();
-					delete top;
-					this->out_queue.pop ();
-				}
-		}
+		this->clear_world_lane ();
+		
+		// packets that were never handed to a handler.
+		this->strand.clear (
+			[] (received_packet& rp) { packet_pool::free (rp.data, rp.cap); });
 		
 		delete this->bundo;
 		
@@ -188,52 +213,96 @@ namespace hCraft {
 	 */
 	
 	
-	struct handle_context
-	{
-		player *pl;
-		unsigned char **packets;
-		int count;
-	};
-	
 	/* 
-	 * Executed in a thread pool task, spawned by handle ().
+	 * Called by the player's strand for every received packet.
 	 */
 	void
-	handle_func (void *ptr)
+	player::handle_received (received_packet& rp)
 	{
-		handle_context *ctx = static_cast<handle_context *> (ptr);
-		player *pl = ctx->pl;
-		unsigned char **packets = ctx->packets;
-		int count = ctx->count;
-		delete ctx; // no longer needed
-		
-		// this will destroy all pointers in case of failure
-		std::vector<std::unique_ptr<unsigned char []> > vec;
-		for (int i = 0; i < count; ++i)
-			vec.emplace_back (packets [i]);
-		delete[] packets;
+		auto start = std::chrono::steady_clock::now ();
 		
-		if (pl->srv.is_shutting_down ())
-			return;
+		// the opcode follows the length prefix, which is at most three bytes
+		// long (see max_packet_size).
+		int opcode = rp.data[(rp.data[0] & 0x80) ? ((rp.data[1] & 0x80) ? 3 : 2) : 1];
 		
-		for (std::unique_ptr<unsigned char []>& data : vec)
+		if (!this->bad () && !this->is_disconnecting ()
+			&& !this->srv.is_shutting_down ())
 			{
 				try
 					{
-						int err = pl->handle (data.get ());
-						-- pl->handlers_scheduled;
-						if (pl->is_disconnecting ())
-							return;
-						else if (err != 0)
-							{
-								pl->disconnect ();
-								return;
-							}
+						int err = this->handle (rp.data);
+						if (err != 0 && !this->is_disconnecting ())
+							this->disconnect ();
 					}
 				catch (const std::exception& ex)
 					{
-						pl->log (LT_ERROR) << "Exception: " << ex.what () << std::endl;
-						pl->disconnect (false, false);
+						this->log (LT_ERROR) << "Exception: " << ex.what () << std::endl;
+						this->disconnect (false, false);
+					}
+				
+				network_stats& ns = this->srv.get_net_stats ();
+				ns.handler_wait[opcode & 0xFF].record (start - rp.received);
+				ns.handler_time[opcode & 0xFF].record (std::chrono::steady_clock::now () - start);
+			}
+		
+		packet_pool::free (rp.data, rp.cap);
+		-- this->handlers_scheduled;
+	}
+	
+	
+	
+	// the largest packet a client is allowed to send.
+	static const unsigned int max_packet_size = 65536;
+	
+	/* 
+	 * Returns the total size of the packet whose first @{have} bytes are
+	 * given (length prefix included), zero if more bytes are needed to tell,
+	 * or -1 if the length prefix is malformed or zero (every packet has at
+	 * least an opcode).
+	 */
+	static int
+	_frame_size (const unsigned char *data, unsigned int have)
+	{
+		unsigned int packet_size = 0;
+		for (unsigned int i = 0; i < 5; ++i)
+			{
+				if (i >= have)
+					return 0;
+				
+				packet_size |= (data[i] & 0x7F) << (7 * i);
+				if (!(data[i] & 0x80))
+					return (packet_size == 0) ? -1 : (packet_size + i + 1);
+			}
+		
+		return -1;
+	}
+	
+	/* 
+	 * Decrypts bytes that arrived since the last call in place, directly in
+	 * the connection's input buffer.
+	 */
+	static void
+	_decrypt_input (struct evbuffer *buf, size_t avail, unsigned int& dec_count,
+		CryptoPP::CFB_Mode<CryptoPP::AES>::Decryption *decryptor)
+	{
+		while (dec_count < avail)
+			{
+				struct evbuffer_ptr ptr;
+				evbuffer_ptr_set (buf, &ptr, dec_count, EVBUFFER_PTR_SET);
+				
+				struct evbuffer_iovec vecs[8];
+				int n = evbuffer_peek (buf, avail - dec_count, &ptr, vecs, 8);
+				if (n > 8) n = 8;
+				
+				for (int i = 0; i < n && dec_count < avail; ++i)
+					{
+						size_t len = vecs[i].iov_len;
+						if (len > (avail - dec_count))
+							len = avail - dec_count;
+						
+						unsigned char *p = static_cast<unsigned char *> (vecs[i].iov_base);
+						decryptor->ProcessData (p, p, len);
+						dec_count += len;
 					}
 			}
 	}
@@ -246,90 +315,47 @@ namespace hCraft {
 		pl->reading = true;
 		
 		struct evbuffer *buf = bufferevent_get_input (bufev);
-		size_t buf_size;
-		int n;
-		int tl = 0;
+		size_t avail;
 		
-		while ((buf_size = evbuffer_get_length (buf)) > 0)
+		while ((avail = evbuffer_get_length (buf)) > 0)
 			{
-				n = evbuffer_remove (buf, pl->rdbuf + pl->total_read, pl->read_rem);
-				if (n <= 0)
-					{ pl->reading = false; pl->disconnect (); return; }
-				
-				tl = pl->total_read;
-				pl->total_read += n;
-				
 				if (pl->encrypted)
-					{
-						// decrypt data.
-						std::string src ((char *)(pl->rdbuf + tl), pl->total_read - tl);
-						std::string tar;
-						
-						try
-							{
-								CryptoPP::StringSource (src, true,
-									new CryptoPP::StreamTransformationFilter (*pl->decryptor,
-										new CryptoPP::StringSink (tar)));
-							}
-						catch (CryptoPP::Exception& ex)
-							{
-								pl->log (LT_ERROR) << "Packet decryption failed (Player \"" << pl->get_username () << "\")" << std::endl;
-								pl->disconnect ();
-								return;
-							}
-						
-						std::memcpy (pl->rdbuf + tl, tar.data (), tar.size ());
-						pl->total_read = tar.size () + tl; // might not be necessary...
-					}
+					_decrypt_input (buf, avail, pl->dec_count, pl->decryptor);
+				
+				// frame the next packet, without removing it from the buffer.
+				unsigned char hdr[5];
+				unsigned int hn = (avail < sizeof hdr) ? avail : sizeof hdr;
+				evbuffer_copyout (buf, hdr, hn);
 				
-				pl->read_rem = packet::remaining (pl->rdbuf, pl->total_read);
-				if (pl->read_rem == -1)
+				int size = _frame_size (hdr, hn);
+				if (size == 0)
+					break; // wait for more data
+				else if (size < 0 || (unsigned int)size > max_packet_size)
 					{
 						pl->log (LT_WARNING) << "Received an invalid packet from @"
-							<< pl->get_ip () << " (opcode: " << std::hex << std::setfill ('0')
-							<< std::setw (2) << (pl->rdbuf[0] & 0xFF) << ")" << std::setfill (' ')
-							<< std::endl;
+							<< pl->get_ip () << " (size: " << size << ")" << std::endl;
 						pl->reading = false; 
 						pl->disconnect ();
 						return;
 					}
-				else if (pl->read_rem == 0)
-					{
-					  // DEBUG
-				    /*
-				    if (!(pl->rdbuf[1] >= 0x03 && pl->rdbuf[1] <= 0x06))
-			        pl->log (LT_DEBUG) << "Packet [" << (int)pl->rdbuf[1] << "]" << std::endl;
-				    //*/
-					  
-						/* finished reading packet */
-						unsigned char *data = new unsigned char [pl->total_read];
-						std::memcpy (data, pl->rdbuf, pl->total_read);
-						pl->exec_queue.push_back (data);
-						if (pl->test_packet_chain ())
-							{
-								// copy queue into an array, so we could use it in a pooled thread.
-								int packet_count = pl->exec_queue.size ();
-								unsigned char **packets = new unsigned char* [packet_count];
-								for (int i = 0; !pl->exec_queue.empty (); ++i)
-									{
-										packets[i] = pl->exec_queue.front ();
-										pl->exec_queue.pop_front ();
-									}
-								
-								// wrap everything up
-								handle_context *ctx = new handle_context;
-								ctx->pl = pl;
-								ctx->packets = packets;
-								ctx->count = packet_count;
-								
-								++ pl->handlers_scheduled;
-								pl->get_server ().get_thread_pool ().enqueue (
-									handle_func, ctx);
-							}
-						
-						pl->total_read = 0;
-						pl->read_rem = 1;
-					}
+				
+				if (avail < (unsigned int)size)
+					break;
+				
+				/* finished reading packet */
+				
+				// the packet is handled in a pooled thread, so it has to be moved out
+				// of the input buffer.
+				received_packet rp;
+				rp.data = packet_pool::alloc (size, rp.cap);
+				evbuffer_remove (buf, rp.data, size);
+				pl->dec_count = (pl->dec_count > (unsigned int)size)
+					? (pl->dec_count - size) : 0;
+				
+				rp.received = std::chrono::steady_clock::now ();
+				
+				++ pl->handlers_scheduled;
+				pl->strand.post (std::move (rp));
 			}
 		
 		pl->reading = false; 
@@ -342,47 +368,43 @@ namespace hCraft {
 		if (pl->bad ()) return;
 		pl->writing = true;
 		
-		int opcode;
-		
-		std::lock_guard<std::mutex> guard {pl->out_lock};
-		if (!pl->out_queue.empty ())
+		// everything that had been queued has been sent at this point.
+		if (pl->kick_sent)
 			{
-				// dispose of the packet that we just completed sending.
-				packet *pack = pl->out_queue.front ();
-				pl->out_queue.pop ();
-				delete pack;
-				
-				if (pl->kicked && ((pl->pstate == PS_PLAY && opcode == 0x40)
-					|| (pl->pstate == PS_LOGIN && opcode == 0x00)))
-					{
-						if (pl->kick_msg[0] == '\0')
-							pl->log () << pl->get_username () << " has been kicked." << std::endl;
-						else
-							pl->log () << pl->get_username () << " has been kicked: " << pl->kick_msg << std::endl;	
-						
-						while (!pl->out_queue.empty ())
-							{
-								pack = pl->out_queue.front ();
-								delete pack;
-								pl->out_queue.pop ();
-							}
-						
-						pl->writing = false;
-						pl->disconnect (true);
-						return;
-					}
+				if (pl->kick_msg[0] == '\0')
+					pl->log () << pl->get_username () << " has been kicked." << std::endl;
+				else
+					pl->log () << pl->get_username () << " has been kicked: " << pl->kick_msg << std::endl;	
 				
-				// if the queue has more packets, send the next one.
-				if (!pl->out_queue.empty ())
-					{
-						packet *pack = pl->out_queue.front ();
-						bufferevent_write (bufev, pack->data, pack->size);
-					}
+				pl->writing = false;
+				pl->disconnect (true);
+				return;
 			}
 		
 		pl->writing = false;
 	}
 	
+	/* 
+	 * Called whenever bytes are added to or drained from the player's output
+	 * buffer. Drains only happen when libevent writes to the socket.
+	 */
+	void
+	player::handle_output_drain (struct evbuffer *buf,
+		const struct evbuffer_cb_info *info, void *ctx)
+	{
+		if (info->n_deleted == 0)
+			return;
+		
+		player *pl = static_cast<player *> (ctx);
+		pl->bytes_drained.fetch_add (info->n_deleted, std::memory_order_relaxed);
+		
+		network_stats& ns = pl->srv.get_net_stats ();
+		ns.writes.fetch_add (1, std::memory_order_relaxed);
+		ns.bytes_out.fetch_add (info->n_deleted, std::memory_order_relaxed);
+	}
+	
+	
+	
 	void
 	player::handle_event (struct bufferevent *bufev, short events, void *ctx)
 	{
@@ -413,6 +435,8 @@ namespace hCraft {
 		
 		bufferevent_disable (this->bufev, EV_READ | EV_WRITE);
 		bufferevent_setcb (this->bufev, nullptr, nullptr, nullptr, nullptr);
+		evbuffer_remove_cb (bufferevent_get_output (this->bufev),
+			&hCraft::player::handle_output_drain, this);
 		
 		this->save_data ();
 		
@@ -428,6 +452,7 @@ namespace hCraft {
 			log () << this->get_username () << " has disconnected." << std::endl;
 		
 		this->get_server ().get_players ().remove (this);
+		this->leave_interest ();
 		if (this->curr_world)
 			{
 				if (!this->get_server ().is_shutting_down ())
@@ -461,6 +486,7 @@ namespace hCraft {
 		
 		{	
 			std::lock_guard<std::mutex> guard ((this->get_server ().get_player_lock ()));
+			std::lock_guard<std::mutex> out_guard {this->out_lock};
 			bufferevent_free (this->bufev);
 		}
 		
@@ -551,50 +577,193 @@ namespace hCraft {
 		return false;
 	}
 	
+	// output pacing: limits of the world lane's rate (bytes per second), and
+	// how much data (in seconds of the current rate) may sit in the output
+	// buffer before held back packets stop being added to it.
+	static const double pace_min_rate = 32 * 1024.0;
+	static const double pace_max_rate = 16 * 1024 * 1024.0;
+	static const double pace_buffered_time = 0.1;
+	static const double pace_burst_time = 0.25;
+	
+	// returns true if the specified packet carries world data: chunks, and
+	// block changes, which must stay in order with the chunks they modify.
+	static bool
+	_is_world_packet (const packet *pack)
+	{
+		unsigned int i = 0;
+		while ((i < pack->size) && (pack->data[i] & 0x80))
+			++ i; // length prefix
+		if (++i >= pack->size)
+			return false;
+		
+		switch (pack->data[i])
+			{
+			case 0x21: // chunk data
+			case 0x22: // multi block change
+			case 0x23: // block change
+			case 0x24: // block action
+			case 0x26: // map chunk bulk
+			case 0x33: // update sign
+			case 0x35: // update tile entity
+				return true;
+			
+			default:
+				return false;
+			}
+	}
+	
+	
+	// while set, packets sent to this player by the current thread are queued
+	// behind its held back world data, so that they reach the client after the
+	// chunks they refer to.  see stream_chunks ().
+	static thread_local player *_lane_ordered_for = nullptr;
+	
+	
 	/* 
-	 * Inserts the specified packet into the player's queue of outgoing packets.
+	 * Appends the specified packet to the player's output buffer.
+	 * The player takes over one reference to the packet, so the same packet
+	 * can be queued to several players by calling share () on it.
 	 */
 	void
 	player::send (packet *pack)
 	{
 		if (this->bad () || _redundancy_test (this, pack))
-			{ delete pack; return; }
+			{ packet::release (pack); return; }
 		
 		std::lock_guard<std::mutex> guard {this->out_lock};
+		if (this->bad ())
+			{ packet::release (pack); return; }
 		
-		// encrypt contents
-		if (this->encrypted)
+		if (_is_world_packet (pack))
 			{
-				std::string src ((const char *)pack->data, (int)pack->size);
-				std::string tar;
-				
-				try
-					{
-						CryptoPP::StringSource (src, true,
-							new CryptoPP::StreamTransformationFilter (*this->encryptor,
-								new CryptoPP::StringSink (tar)));
-					}
-				catch (CryptoPP::Exception& ex)
+				size_t buffered = evbuffer_get_length (bufferevent_get_output (this->bufev));
+				if (!this->world_lane.empty () || (this->pace_tokens <= 0.0) ||
+					(buffered >= this->pace_rate * pace_buffered_time))
 					{
-						log (LT_ERROR) << "Packet encryption failed (Player \"" << this->get_username () << "\")" << std::endl;
-						this->disconnect ();
+						this->world_lane.push_back (pack);
+						this->srv.get_net_stats ().paced_packets.fetch_add (1,
+							std::memory_order_relaxed);
 						return;
 					}
+				
+				this->pace_tokens -= pack->size;
+			}
+		else if ((_lane_ordered_for == this) && !this->world_lane.empty ())
+			{
+				this->world_lane.push_back (pack);
+				this->srv.get_net_stats ().paced_packets.fetch_add (1,
+					std::memory_order_relaxed);
+				return;
+			}
+		
+		this->send_nolock (pack);
+	}
+	
+	void
+	player::send_nolock (packet *pack)
+	{
+		// packets are appended to the bufferevent's output buffer as they are
+		// sent, so that libevent can flush everything that is available with a
+		// single write.
+		struct evbuffer *out = bufferevent_get_output (this->bufev);
+		unsigned int size = pack->size;
+		bool disconnect = pack->disconnect; // the packet may be gone below
+		if (this->encrypted)
+			{
+				// encrypt directly into the output buffer, the payload itself might
+				// be shared with other players.
+				struct evbuffer_iovec vec;
+				if (evbuffer_reserve_space (out, size, &vec, 1) != 1)
+					{ packet::release (pack); return; }
+				
+				this->encryptor->ProcessData ((unsigned char *)vec.iov_base,
+					pack->data, size);
+				vec.iov_len = size;
+				evbuffer_commit_space (out, &vec, 1);
+				packet::release (pack);
+			}
+		else
+			{
+				// no copy, the packet is released once it has been written.
+				evbuffer_add_reference (out, pack->data, size,
+					[] (const void *data, size_t len, void *ctx)
+						{
+							packet::release (static_cast<packet *> (ctx));
+						}, pack);
+			}
+		
+		if (disconnect && this->kicked)
+			this->kick_sent = true;
+		this->srv.get_net_stats ().packets_out.fetch_add (1, std::memory_order_relaxed);
+	}
+	
+	
+	
+	/* 
+	 * Refills the world lane's token bucket, adapts its rate to the drain
+	 * rate of the connection, and moves as many held back packets into the
+	 * output buffer as the bucket allows.  Called every tick.
+	 */
+	void
+	player::pace_output ()
+	{
+		std::lock_guard<std::mutex> guard {this->out_lock};
+		if (this->bad ())
+			return;
+		
+		auto now = std::chrono::steady_clock::now ();
+		double dt = std::chrono::duration<double> (now - this->pace_last).count ();
+		this->pace_last = now;
+		if (dt <= 0.0)
+			return;
+		if (dt > 1.0)
+			dt = 1.0;
+		
+		unsigned long long drained = this->bytes_drained.load ();
+		double drain_rate = (drained - this->pace_last_drained) / dt;
+		this->pace_last_drained = drained;
 		
-				if (pack->cap < tar.size ())
-					pack->resize (tar.size ());
-				pack->clear ();
-				pack->put_bytes ((const unsigned char *)tar.data (), tar.size ());
+		struct evbuffer *out = bufferevent_get_output (this->bufev);
+		double max_buffered = this->pace_rate * pace_buffered_time;
+		if (evbuffer_get_length (out) >= max_buffered)
+			{
+				// the connection cannot keep up, move towards the rate at which it
+				// actually drains.
+				this->pace_rate = std::max (pace_min_rate,
+					0.75 * this->pace_rate + 0.25 * drain_rate);
+			}
+		else if (!this->world_lane.empty () && (this->pace_tokens <= 0.0))
+			{
+				// the bucket is what holds packets back, not the connection.
+				this->pace_rate = std::min (pace_max_rate, this->pace_rate * 1.25);
 			}
 		
-		this->out_queue.push (pack);
-		if (this->out_queue.size () == 1)
+		this->pace_tokens = std::min (this->pace_rate * pace_burst_time,
+			this->pace_tokens + this->pace_rate * dt);
+		
+		max_buffered = this->pace_rate * pace_buffered_time;
+		while (!this->world_lane.empty () && (this->pace_tokens > 0.0) &&
+			(evbuffer_get_length (out) < max_buffered))
 			{
-				// initiate write
-				bufferevent_write (this->bufev, pack->data, pack->size);
+				packet *pack = this->world_lane.front ();
+				this->world_lane.pop_front ();
+				this->pace_tokens -= pack->size;
+				this->send_nolock (pack);
 			}
 	}
 	
+	/* 
+	 * Drops all packets held back in the world lane.
+	 */
+	void
+	player::clear_world_lane ()
+	{
+		std::lock_guard<std::mutex> guard {this->out_lock};
+		for (packet *pack : this->world_lane)
+			packet::release (pack);
+		this->world_lane.clear ();
+	}
+	
 	
 	
 	/* 
@@ -768,6 +937,11 @@ namespace hCraft {
 		// this will keep the player safe from fall damage right after spawning
 		this->fall_flag = true;
 		
+		// start small and let the view grow as the chunks arrive
+		this->view_distance = w->view_min;
+		this->move_vx = this->move_vz = 0.0;
+		this->prefetch_world = nullptr;
+		
 		// selection blocks
 		this->sb_updates.clear ();
 		this->sb_updates.set_world (w, true);
@@ -782,6 +956,10 @@ namespace hCraft {
 				chunk *prev_chunk = this->curr_world->get_chunk (this->chcurr.x, this->chcurr.z);
 				if (prev_chunk)
 					prev_chunk->remove_entity (this);
+				this->leave_interest ();
+				
+				// chunks of the previous world that have not been sent yet.
+				this->clear_world_lane ();
 				
 				// destroy selections
 				for (auto itr = this->selections.begin (); itr != this->selections.end (); ++itr)
@@ -893,12 +1071,144 @@ namespace hCraft {
 	
 //--
 	
+	// generator backlog above which view distances shrink, and below which they
+	// are allowed to grow again.
+	static const int view_backlog_high = 1024;
+	static const int view_backlog_low  = 128;
+	
+	// pending world lane packets above which the player's connection is
+	// considered to be falling behind.
+	static const size_t view_lane_high = 64;
+	
+	/* 
+	 * Shrinks the player's view distance by a chunk when the chunk generator,
+	 * the world's tick loop or the player's connection falls behind, and grows
+	 * it back by one once everything in view has been sent.
+	 * 
+	 * NOTE: world_lock must be held.
+	 */
+	void
+	player::adjust_view_distance ()
+	{
+		world *w = this->curr_world;
+		if (!w)
+			return;
+		
+		int backlog = this->srv.cgen.backlog ();
+		int slow = this->slow_ticks.exchange (0);
+		size_t lane;
+		{
+			std::lock_guard<std::mutex> guard {this->out_lock};
+			lane = this->world_lane.size ();
+		}
+		
+		int vd = this->view_distance;
+		if (backlog > view_backlog_high || lane > view_lane_high || slow >= 3)
+			-- vd;
+		else if (backlog < view_backlog_low && lane == 0 && slow == 0
+			&& !this->need_new_chunks && this->pending_chunks.empty ())
+			++ vd;
+		
+		if (vd < w->view_min)
+			vd = w->view_min;
+		else if (vd > w->view_max)
+			vd = w->view_max;
+		if (vd != this->view_distance)
+			{
+				this->view_distance = vd;
+				this->need_new_chunks = true;
+				this->update_interest ();
+			}
+	}
+	
+	// players slower than this (in blocks per second) are kept up with by
+	// regular streaming alone.  sprinting is at about 5.6.
+	static const double prefetch_min_speed = 7.0;
+	
+	// how far ahead (in seconds) the player's position is predicted.
+	static const double prefetch_lookahead = 3.0;
+	
+	// maximum number of chunks prefetched per round.
+	static const int prefetch_max_chunks = 32;
+	
+	/* 
+	 * Asks the chunk generator to warm up the chunks that the player is
+	 * about to need, based on where their current velocity will take them.
+	 * 
+	 * NOTE: world_lock must be held.
+	 */
+	void
+	player::prefetch_chunks ()
+	{
+		world *w = this->curr_world;
+		if (!w || (this->stream_world != w))
+			return;
+		
+		// stopped moving
+		if ((std::chrono::steady_clock::now () - this->last_move_time) > std::chrono::seconds (1))
+			return;
+		
+		double vx = this->move_vx, vz = this->move_vz;
+		double speed = std::sqrt (vx*vx + vz*vz);
+		if (speed < prefetch_min_speed)
+			return;
+		
+		// predict where the player will be, but no further than the edge of
+		// their current view.
+		int radius = this->view_distance;
+		double ahead = speed * prefetch_lookahead;
+		double reach = radius * 16.0;
+		if (ahead > reach)
+			ahead = reach;
+		entity_pos dest = this->pos;
+		dest.x += vx / speed * ahead;
+		dest.z += vz / speed * ahead;
+		
+		chunk_pos pc = dest;
+		if ((pc.x == this->stream_cx) && (pc.z == this->stream_cz))
+			return;
+		if ((this->prefetch_world == w) && (pc.x == this->prefetch_cx) && (pc.z == this->prefetch_cz))
+			return;
+		this->prefetch_world = w;
+		this->prefetch_cx = pc.x;
+		this->prefetch_cz = pc.z;
+		
+		// chunks of the predicted view that are not already being streamed and
+		// aren't in memory yet.
+		std::vector<chunk_pos> coords;
+		for (int cx = (pc.x - radius); cx <= (pc.x + radius); ++cx)
+			for (int cz = (pc.z - radius); cz <= (pc.z + radius); ++cz)
+				{
+					if ((utils::iabs (cx - this->stream_cx) <= this->stream_radius) &&
+						(utils::iabs (cz - this->stream_cz) <= this->stream_radius))
+						continue;
+					if (w->get_chunk (cx, cz))
+						continue;
+					
+					coords.emplace_back (cx, cz);
+				}
+		
+		// the nearest ones are needed first
+		int scx = this->stream_cx, scz = this->stream_cz;
+		std::sort (coords.begin (), coords.end (),
+			[scx, scz] (const chunk_pos a, const chunk_pos b) -> bool
+				{
+					return (std::max (utils::iabs (a.x - scx), utils::iabs (a.z - scz)))
+						< (std::max (utils::iabs (b.x - scx), utils::iabs (b.z - scz)));
+				});
+		if ((int)coords.size () > prefetch_max_chunks)
+			coords.resize (prefetch_max_chunks);
+		
+		for (chunk_pos cpos : coords)
+			this->srv.cgen.request (w, cpos.x, cpos.z, this->eid, GFL_PREFETCH);
+	}
+	
 	/* 
 	 * Loads new close chunks to the player and unloads those that are too
 	 * far away.
 	 */
 	void
-	player::stream_chunks (int radius)
+	player::stream_chunks ()
 	{
 		if (this->streaming_chunks)
 			return;
@@ -906,119 +1216,131 @@ namespace hCraft {
 		std::lock_guard<std::mutex> wguard {this->world_lock};
 		this->streaming_chunks = true;
 		
+		this->adjust_view_distance ();
+		int radius = this->view_distance;
+		
 		std::vector<std::pair<known_chunk, bool>> unload_list;
 		world *w = this->curr_world;
 		
 		if (this->need_new_chunks)
 			{
+				chunk_pos cp = this->pos;
+				int ocx = this->stream_cx, ocz = this->stream_cz;
+				int orad = this->stream_radius;
+				
 				// compile a list of chunks that we no longer need
-				for (auto itr = this->known_chunks.begin (); itr != this->known_chunks.end (); )
+				if (this->stream_world != w)
 					{
-						known_chunk kc = *itr;
-						
-						if (!this->can_see_chunk (kc.cx, kc.cz))
+						// switching worlds, every known chunk goes.  those that are in
+						// view will be overwritten by the new world's chunks, and don't
+						// have to be unloaded on the client's side.
+						for (const known_chunk& kc : this->known_chunks)
 							{
-								unload_list.push_back (std::make_pair (kc, true));
-								itr = this->known_chunks.erase (itr);
-							}
-						else
-							{
-								if (kc.w != w)
-									unload_list.push_back (std::make_pair (kc, false));
-								++ itr;
+								bool in_view = (utils::iabs (kc.cx - cp.x) <= radius) &&
+									(utils::iabs (kc.cz - cp.z) <= radius);
+								unload_list.push_back (std::make_pair (kc, !in_view));
 							}
+						this->known_chunks.clear ();
+					}
+				else
+					{
+						// only chunks of the previous square that are not in the new one.
+						for (int cx = (ocx - orad); cx <= (ocx + orad); ++cx)
+							for (int cz = (ocz - orad); cz <= (ocz + orad); ++cz)
+								{
+									if ((utils::iabs (cx - cp.x) <= radius) &&
+										(utils::iabs (cz - cp.z) <= radius))
+										continue;
+									
+									known_chunk kc {w, cx, cz};
+									if (this->known_chunks.erase (kc) > 0)
+										unload_list.push_back (std::make_pair (kc, true));
+								}
 					}
 				
-				// get a sorted list of chunk coordinates.
-				std::vector<chunk_pos> coords;
-				{
-					player *pl = this;
-					chunk_pos cp = this->pos;
-					
-					for (int cx = (cp.x - radius); cx <= (cp.x + radius); ++cx)
-						for (int cz = (cp.z - radius); cz <= (cp.z + radius); ++cz)
-							coords.emplace_back (cx, cz);
-					std::sort (coords.begin (), coords.end (),
-						[pl] (const chunk_pos a, const chunk_pos b) -> bool
-							{
-								double a_dx = (a.x * 16.0) - pl->pos.x;
-								double a_dz = (a.z * 16.0) - pl->pos.z;
-								double b_dx = (b.x * 16.0) - pl->pos.x;
-								double b_dz = (b.z * 16.0) - pl->pos.z;
-								
-								return (a_dx*a_dx + a_dz*a_dz) < (b_dx*b_dx + b_dz*b_dz);
-							});
-				}
+				this->stream_world = w;
+				this->stream_cx = cp.x;
+				this->stream_cz = cp.z;
+				this->stream_radius = radius;
 				
-				for (chunk_pos cpos : coords)
+				// request missing chunks ring by ring, nearest first, without going
+				// over this round's budget.  whatever is left over is picked up on
+				// the next round.
+				int budget = (this->srv.get_config ().stream_chunks_per_tick * 10)
+					- (int)this->pending_chunks.size ();
+				bool complete = true;
+				for (int ring = 0; ring <= radius; ++ring)
 					{
-						int cx = cpos.x, cz = cpos.z;
-						
-						// do we already have this chunk in our known chunk list?
-						bool found = false;
-						for (auto itr = this->known_chunks.begin (); itr != this->known_chunks.end (); ++itr)
+						int side = ring ? (ring * 8) : 1;
+						for (int i = 0; i < side; ++i)
 							{
-								known_chunk kc = *itr;
-								if (kc.cx == cx && kc.cz == cz)
-									{
-										if (kc.w != w)
-											this->known_chunks.erase (itr);
-										else
-											found = true;
-										break;
-									}
-							}
-				
-						if (!found)
-							{
-								bool p_found = false;
-								for (auto itr = this->pending_chunks.begin (); itr != this->pending_chunks.end (); ++itr)
+								// walk the perimeter of the ring
+								int cx, cz;
+								if (ring == 0)
+									{ cx = cp.x; cz = cp.z; }
+								else
 									{
-										known_chunk c = *itr;
-										if (c.cx == cx && c.cz == cz)
+										int edge = i / (ring * 2), off = i % (ring * 2);
+										switch (edge)
 											{
-												if (c.w == w) 
-													p_found = true;
-												else
-													this->pending_chunks.erase (itr);
-												break;
+											case 0: cx = cp.x - ring + off; cz = cp.z - ring; break;
+											case 1: cx = cp.x + ring; cz = cp.z - ring + off; break;
+											case 2: cx = cp.x + ring - off; cz = cp.z + ring; break;
+											default: cx = cp.x - ring; cz = cp.z + ring - off; break;
 											}
 									}
 								
-								if (!p_found)
+								// do we already have this chunk, or is it on its way?
+								known_chunk kc {w, cx, cz};
+								if ((this->known_chunks.count (kc) > 0) ||
+									(this->pending_chunks.count (kc) > 0))
+									continue;
+								
+								if (budget <= 0)
 									{
-										// fetch all chunks around it first!
-										// to ensure that the world generator doesn't produce any
-										// glitched structures (such as trees cut in half)
-										for (int xx = (cx - 1); xx <= (cx + 1); ++xx)
-											for (int zz = (cz - 1); zz <= (cz + 1); ++zz)
-												if (!(xx == cx && zz == cz))
-													this->srv.cgen.request (w, xx, zz, this->eid, GFL_NODELIVER | GFL_NOABORT);
-										
-										this->srv.cgen.request (w, cx, cz, this->eid);
-										this->pending_chunks.push_back ({w, cx, cz});
+										complete = false;
+										break;
 									}
+								-- budget;
+								
+								// fetch all chunks around it first!
+								// to ensure that the world generator doesn't produce any
+								// glitched structures (such as trees cut in half)
+								for (int xx = (cx - 1); xx <= (cx + 1); ++xx)
+									for (int zz = (cz - 1); zz <= (cz + 1); ++zz)
+										if (!(xx == cx && zz == cz))
+											this->srv.cgen.request (w, xx, zz, this->eid, GFL_NODELIVER | GFL_NOABORT);
+								
+								this->srv.cgen.request (w, cx, cz, this->eid);
+								this->pending_chunks.insert (kc);
 							}
+						
+						if (!complete)
+							break;
 					}
 				
-				this->need_new_chunks = false;
+				this->need_new_chunks = !complete;
 			}
 		
+		this->prefetch_chunks ();
+		
 		chunk_pos my_cpos = this->pos;
 		
 		// check if we got any chunks from the generator
 		if (!this->response_chunks.empty ())
 			{
 				std::lock_guard<std::mutex> guard {this->response_chunks_lock};
+				
+				// the position and entity spawns sent along with a chunk must not
+				// overtake it in the world lane.
+				_lane_ordered_for = this;
 				while (!this->response_chunks.empty ())
 					{
 						gen_response resp = this->response_chunks.front ();
 						this->response_chunks.pop ();
 						
 						// remove from pending chunk list
-						for (auto itr = this->pending_chunks.begin (); itr != this->pending_chunks.end (); ++itr)
-							if (itr->cx == resp.cx && itr->cz == resp.cz)
-								{ this->pending_chunks.erase (itr); break; }
+						this->pending_chunks.erase ({resp.w, resp.cx, resp.cz});
 						
 						if (!resp.ch || resp.flags == GFL_ABORTED)
 							continue;
@@ -1027,7 +1349,10 @@ namespace hCraft {
 							continue; // wrong world
 					
 						// do we still need this chunk?
-						if (!this->can_see_chunk (resp.cx, resp.cz))
+						if ((utils::iabs (resp.cx - this->stream_cx) > this->stream_radius) ||
+							(utils::iabs (resp.cz - this->stream_cz) > this->stream_radius))
+							continue;
+						if (this->known_chunks.count ({w, resp.cx, resp.cz}) > 0)
 							continue;
 						
 						// selection blocks / editstages
@@ -1039,7 +1364,7 @@ namespace hCraft {
 							
 						this->send (packets::play::make_chunk (resp.cx, resp.cz, resp.ch, es_vec));
 						
-						this->known_chunks.push_back ({w, resp.cx, resp.cz});
+						this->known_chunks.insert ({w, resp.cx, resp.cz});
 						
 						// is this our new home chunk? (When switching between worlds)
 						if (this->joining_world && (my_cpos.x == resp.cx && my_cpos.z == resp.cz))
@@ -1094,6 +1419,21 @@ namespace hCraft {
 								}
 						}
 					}
+				_lane_ordered_for = nullptr;
+			}
+		
+		// has the chunk a teleport brought us into reached the client?
+		if (this->tp_measuring.load () &&
+			(this->known_chunks.count ({w, my_cpos.x, my_cpos.z}) > 0))
+			{
+				std::chrono::steady_clock::time_point start;
+				{
+					std::lock_guard<std::mutex> guard {this->tp_lock};
+					start = this->tp_measure_start;
+					this->tp_measuring = false;
+				}
+				this->srv.get_net_stats ().teleport_playable.record (
+					std::chrono::steady_clock::now () - start);
 			}
 		
 		// unload chunks
@@ -1135,9 +1475,10 @@ namespace hCraft {
 	player::can_see_chunk (int x, int z)
 	{
 		chunk_pos me_pos = this->pos;
+		int radius = this->view_distance.load (std::memory_order_relaxed);
 		return (
-			(utils::iabs (me_pos.x - x) <= player::chunk_radius ()) &&
-			(utils::iabs (me_pos.z - z) <= player::chunk_radius ()));
+			(utils::iabs (me_pos.x - x) <= radius) &&
+			(utils::iabs (me_pos.z - z) <= radius));
 	}
 	
 	/* 
@@ -1194,6 +1535,58 @@ namespace hCraft {
 				new_chunk->add_entity (this);
 				this->chcurr.set (curr_cpos.x, curr_cpos.z);
 			}
+		
+		this->update_interest ();
+	}
+	
+	/* 
+	 * Registers the player in its world's interest grid around its current
+	 * chunk, as far as its view distance reaches.  Only the chunks that came
+	 * into or went out of view are updated when the player crosses a chunk
+	 * border; a change in view distance registers the player anew.
+	 */
+	void
+	player::update_interest ()
+	{
+		world *w = this->curr_world;
+		chunk_pos cpos = this->pos;
+		int radius = this->view_distance.load ();
+		
+		std::lock_guard<std::mutex> guard {this->interest_lock};
+		if ((this->interest_world == w) && (this->interest_radius == radius))
+			{
+				if (w)
+					w->get_interest ().move (this, this->interest_x, this->interest_z,
+						cpos.x, cpos.z, radius);
+			}
+		else
+			{
+				if (this->interest_world)
+					this->interest_world->get_interest ().remove (this,
+						this->interest_x, this->interest_z, this->interest_radius);
+				if (w)
+					w->get_interest ().add (this, cpos.x, cpos.z, radius);
+			}
+		
+		this->interest_world = w;
+		this->interest_x = cpos.x;
+		this->interest_z = cpos.z;
+		this->interest_radius = radius;
+	}
+	
+	/* 
+	 * Removes the player from its world's interest grid.
+	 */
+	void
+	player::leave_interest ()
+	{
+		std::lock_guard<std::mutex> guard {this->interest_lock};
+		if (this->interest_world)
+			{
+				this->interest_world->get_interest ().remove (this,
+					this->interest_x, this->interest_z, this->interest_radius);
+				this->interest_world = nullptr;
+			}
 	}
 	
 	
@@ -1234,10 +1627,7 @@ namespace hCraft {
 										continue;
 									}
 								
-								if (w == this->get_world ())
-									this->teleport_to (ptl->dest_pos);
-								else
-									this->join_world_at (w, ptl->dest_pos);
+								this->teleport_when_ready (w, ptl->dest_pos);
 								
 								break;
 							}
@@ -1369,6 +1759,29 @@ namespace hCraft {
 		if (prev_pos == dest)
 			return;
 		
+	//----
+		// estimate horizontal velocity for chunk prefetching.  moves of more than
+		// a chunk at once are teleports, and say nothing about where the player
+		// is headed.
+		{
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now ();
+			double dt = std::chrono::duration<double> (now - this->last_move_time).count ();
+			double dx = dest.x - prev_pos.x;
+			double dz = dest.z - prev_pos.z;
+			if ((dt > 1.0) || (std::abs (dx) > 16.0) || (std::abs (dz) > 16.0))
+				this->move_vx = this->move_vz = 0.0;
+			else
+				{
+					// clients report their position about once a tick, don't let
+					// bunched up packets blow up the estimate.
+					if (dt < 0.05)
+						dt = 0.05;
+					this->move_vx = (this->move_vx * 0.75) + ((dx / dt) * 0.25);
+					this->move_vz = (this->move_vz * 0.75) + ((dz / dt) * 0.25);
+				}
+			this->last_move_time = now;
+		}
+		
 	//----
 		// set home chunk
 		if (!(curr_cpos.x == this->chcurr.x && curr_cpos.z == this->chcurr.z))
@@ -1381,8 +1794,6 @@ namespace hCraft {
 		double x_delta = dest.x - prev_pos.x;
 		double y_delta = dest.y - prev_pos.y;
 		double z_delta = dest.z - prev_pos.z;
-		float r_delta = dest.r - prev_pos.r;
-		float l_delta = dest.l - prev_pos.l;
 		
 	//----
 		/* 
@@ -1406,43 +1817,103 @@ namespace hCraft {
 	//----
 		
 		
-		if (x_delta == 0.0 && y_delta == 0.0 && z_delta == 0.0)
-			{
-				// position hasn't changed.
+		// visible players are told about the movement on the next tick, see
+		// broadcast_movement ().
+		
+		this->handle_falls_and_jumps (prev_pos.on_ground, this->pos.on_ground, prev_pos);
+		this->handle_portals ();
+		
+		this->old_pos = this->pos;
+	}
+	
+	// converts an angle to the byte representation used by entity packets.
+	static inline int
+	_angle_byte (float a)
+	{
+		return (int)(std::fmod (std::floor (a), 360.0f) / 360.0 * 256.0) & 0xFF;
+	}
+	
+	// absolute positions are resent this often (in ticks) even if relative
+	// moves would do, so that rounding errors cannot pile up on the client.
+	static const int abs_move_interval = 400;
+	
+	/* 
+	 * Sends movement made since the last tick to visible players.
+	 */
+	void
+	player::broadcast_movement ()
+	{
+		entity_pos curr = this->pos;
+		int x = (int)(curr.x * 32.0);
+		int y = (int)(curr.y * 32.0);
+		int z = (int)(curr.z * 32.0);
+		int r = _angle_byte (curr.r);
+		int l = _angle_byte (curr.l);
+		
+		std::lock_guard<std::mutex> guard {this->visible_player_lock};
+		++ this->ticks_since_abs_move;
+		
+		if (this->move_sent_valid)
+			{
+				int dx = x - this->move_sent_x;
+				int dy = y - this->move_sent_y;
+				int dz = z - this->move_sent_z;
+				bool moved = (dx != 0) || (dy != 0) || (dz != 0);
+				bool looked = (r != this->move_sent_r) || (l != this->move_sent_l);
+				if (!moved && !looked)
+					return;
 				
-				if (r_delta == 0.0f && l_delta == 0.0f)
+				if (!this->visible_players.empty ())
 					{
-						// the player hasn't moved at all.
+						packet *pack;
+						if (moved && ((this->ticks_since_abs_move >= abs_move_interval)
+							|| (dx < -128) || (dx > 127) || (dy < -128) || (dy > 127)
+							|| (dz < -128) || (dz > 127)))
+							{
+								pack = packets::play::make_entity_move (this->get_eid (),
+									x / 32.0, y / 32.0, z / 32.0, curr.r, curr.l);
+								this->ticks_since_abs_move = 0;
+							}
+						else if (!moved)
+							pack = packets::play::make_entity_look (this->get_eid (),
+								curr.r, curr.l);
+						else if (!looked)
+							pack = packets::play::make_entity_rel_move (this->get_eid (),
+								dx / 32.0, dy / 32.0, dz / 32.0);
+						else
+							pack = packets::play::make_entity_look_and_rel_move (
+								this->get_eid (), dx / 32.0, dy / 32.0, dz / 32.0, curr.r, curr.l);
 						
-					}
-				else
-					{
-						// only orientation changed.
-						std::lock_guard<std::mutex> guard {this->visible_player_lock};
+						packet *head = nullptr;
+						if (r != this->move_sent_r)
+							head = packets::play::make_entity_head_look (this->get_eid (), curr.r);
+						
+						unsigned int bytes = pack->size + (head ? head->size : 0);
 						for (player *pl : this->visible_players)
 							{
-								pl->send (packets::play::make_entity_look (this->get_eid (), dest.r, dest.l));
-								pl->send (packets::play::make_entity_head_look (this->get_eid (), dest.r));
+								pl->send (pack->share ());
+								if (head)
+									pl->send (head->share ());
 							}
+						
+						network_stats& ns = this->srv.get_net_stats ();
+						ns.move_packets += this->visible_players.size () * (head ? 2 : 1);
+						ns.move_bytes += this->visible_players.size () * bytes;
+						
+						packet::release (pack);
+						if (head)
+							packet::release (head);
 					}
 			}
-		else
-			{
-				// position has changed.
-				
-				std::lock_guard<std::mutex> guard {this->visible_player_lock};
-				for (player *pl : this->visible_players)
-					{
-						pl->send (packets::play::make_entity_move (this->get_eid (),
-							dest.x, dest.y, dest.z, dest.r, dest.l));
-						pl->send (packets::play::make_entity_head_look (this->get_eid (), dest.r));
-					}
-			}
-		
-		this->handle_falls_and_jumps (prev_pos.on_ground, this->pos.on_ground, prev_pos);
-		this->handle_portals ();
 		
-		this->old_pos = this->pos;
+		this->move_sent_valid = true;
+		this->move_sent_x = x;
+		this->move_sent_y = y;
+		this->move_sent_z = z;
+		this->move_sent_r = r;
+		this->move_sent_l = l;
+		this->move_sent_fr = curr.r;
+		this->move_sent_fl = curr.l;
 	}
 	
 	/* 
@@ -1459,6 +1930,156 @@ namespace hCraft {
 	}
 	
 	
+	/* 
+	 * Returns the radius of the square of chunks around a teleport destination
+	 * that has to be in memory before the player is moved there: the world's
+	 * smallest view, plus the neighbours needed to generate its edges.
+	 */
+	static int
+	_teleport_radius (world *w)
+	{
+		return w->view_min + 1;
+	}
+	
+	static bool
+	_area_loaded (world *w, chunk_pos cp, int radius)
+	{
+		for (int cx = (cp.x - radius); cx <= (cp.x + radius); ++cx)
+			for (int cz = (cp.z - radius); cz <= (cp.z + radius); ++cz)
+				if (!w->get_chunk (cx, cz))
+					return false;
+		return true;
+	}
+	
+	/* 
+	 * Moves the player to the given world and position once the chunks
+	 * around the destination have been loaded, or once the configured
+	 * timeout runs out, whichever comes first.  The player stays where they
+	 * are in the meantime.  A newer request replaces a pending one.
+	 */
+	void
+	player::teleport_when_ready (world *w, entity_pos dest)
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now ();
+		chunk_pos cp = dest;
+		int radius = _teleport_radius (w);
+		
+		if ((this->srv.get_config ().teleport_timeout == 0) || _area_loaded (w, cp, radius))
+			{
+				// nothing to wait for
+				{
+					std::lock_guard<std::mutex> guard {this->tp_lock};
+					this->tp_pending = false;
+					this->tp_moving = false;
+					this->tp_measure_start = now;
+					this->tp_measuring = true;
+				}
+				
+				this->srv.get_net_stats ().teleport_wait.record (
+					std::chrono::steady_clock::duration::zero ());
+				
+				if (w == this->get_world ())
+					this->teleport_to (dest);
+				else
+					this->join_world_at (w, dest);
+				return;
+			}
+		
+		{
+			std::lock_guard<std::mutex> guard {this->tp_lock};
+			if (this->tp_pending && (this->tp_dest == dest) && (this->tp_world == w->get_name ()))
+				return; // already on its way (e.g. still standing in a portal)
+			
+			this->tp_pending = true;
+			this->tp_moving = false;
+			this->tp_world.assign (w->get_name ());
+			this->tp_dest = dest;
+			this->tp_requested = now;
+		}
+		
+		// load the destination ring by ring, nearest first.  nothing is delivered,
+		// the chunks are streamed normally once the player gets there.
+		for (int ring = 0; ring <= radius; ++ring)
+			for (int cx = (cp.x - ring); cx <= (cp.x + ring); ++cx)
+				for (int cz = (cp.z - ring); cz <= (cp.z + ring); ++cz)
+					{
+						if ((utils::iabs (cx - cp.x) != ring) && (utils::iabs (cz - cp.z) != ring))
+							continue;
+						if (!w->get_chunk (cx, cz))
+							this->srv.cgen.request (w, cx, cz, this->eid, GFL_NODELIVER | GFL_NOABORT);
+					}
+	}
+	
+	/* 
+	 * Called every tick while a teleport is pending, to check whether its
+	 * destination is ready (or it has timed out), in which case the move
+	 * itself is handed off to the thread pool.
+	 */
+	void
+	player::check_teleport ()
+	{
+		{
+			std::lock_guard<std::mutex> guard {this->tp_lock};
+			if (!this->tp_pending)
+				return;
+			
+			world *w = this->srv.get_worlds ().find (this->tp_world.c_str ());
+			if (!w)
+				{
+					// the destination world has been unloaded
+					this->tp_pending = false;
+					return;
+				}
+			
+			std::chrono::steady_clock::duration waited
+				= std::chrono::steady_clock::now () - this->tp_requested;
+			bool timed_out = (waited >= std::chrono::milliseconds (
+				this->srv.get_config ().teleport_timeout));
+			if (!timed_out && !_area_loaded (w, this->tp_dest, _teleport_radius (w)))
+				return;
+			
+			network_stats& ns = this->srv.get_net_stats ();
+			ns.teleport_wait.record (waited);
+			if (timed_out)
+				++ ns.teleport_timeouts;
+			
+			this->tp_pending = false;
+			this->tp_moving = true;
+		}
+		
+		this->srv.get_thread_pool ().enqueue (
+			[] (void *ptr) { (static_cast<player *> (ptr))->finish_teleport (); }, this);
+	}
+	
+	void
+	player::finish_teleport ()
+	{
+		world *w;
+		entity_pos dest;
+		{
+			std::lock_guard<std::mutex> guard {this->tp_lock};
+			if (!this->tp_moving)
+				return; // superseded by a newer request
+			this->tp_moving = false;
+			
+			w = this->srv.get_worlds ().find (this->tp_world.c_str ());
+			if (!w)
+				return;
+			dest = this->tp_dest;
+			this->tp_measure_start = this->tp_requested;
+		}
+		
+		if (this->bad ())
+			return;
+		
+		this->tp_measuring = true;
+		if (w == this->get_world ())
+			this->teleport_to (dest);
+		else
+			this->join_world_at (w, dest);
+	}
+	
+	
 	
 //----
 	
@@ -1513,13 +2134,35 @@ namespace hCraft {
 		std::string col_name;
 		col_name.append (this->get_colored_username ());
 		
-		entity_pos me_pos = this->pos;
 		entity_metadata me_meta;
 		this->build_metadata (me_meta);
-		pl->send (packets::play::make_spawn_player (
-			this->get_eid (), this->get_uuid ().to_str ().c_str (), col_name.c_str (),
-			me_pos.x, me_pos.y, me_pos.z, me_pos.r, me_pos.l, 0, me_meta));
-		pl->send (packets::play::make_entity_head_look (this->get_eid (), me_pos.r));
+		
+		{
+			// spawn at the position other viewers were last told about, so that
+			// the relative moves broadcast from now on apply to this viewer too.
+			std::lock_guard<std::mutex> guard {this->visible_player_lock};
+			if (!this->move_sent_valid)
+				{
+					entity_pos me_pos = this->pos;
+					this->move_sent_valid = true;
+					this->move_sent_x = (int)(me_pos.x * 32.0);
+					this->move_sent_y = (int)(me_pos.y * 32.0);
+					this->move_sent_z = (int)(me_pos.z * 32.0);
+					this->move_sent_r = _angle_byte (me_pos.r);
+					this->move_sent_l = _angle_byte (me_pos.l);
+					this->move_sent_fr = me_pos.r;
+					this->move_sent_fl = me_pos.l;
+				}
+			
+			pl->send (packets::play::make_spawn_player (
+				this->get_eid (), this->get_uuid ().to_str ().c_str (), col_name.c_str (),
+				this->move_sent_x / 32.0, this->move_sent_y / 32.0,
+				this->move_sent_z / 32.0, this->move_sent_fr, this->move_sent_fl, 0,
+				me_meta));
+			pl->send (packets::play::make_entity_head_look (this->get_eid (),
+				this->move_sent_fr));
+			this->visible_players.insert (pl);
+		}
 		
 		pl->send (packets::play::make_entity_equipment (this->eid, 0, this->inv.get (this->held_slot)));
 		
@@ -1527,10 +2170,6 @@ namespace hCraft {
 			std::lock_guard<std::mutex> guard {pl->visible_player_lock};
 			pl->visible_players.insert (this);
 		}
-		{
-			std::lock_guard<std::mutex> guard {this->visible_player_lock};
-			this->visible_players.insert (pl);
-		}
 	}
 	
 	void
@@ -1542,13 +2181,11 @@ namespace hCraft {
 		player *me = this;
 		chunk_pos me_pos = me->pos;
 		
-		this->get_world ()->get_players ().all (
-			[me, me_pos] (player *pl)
+		this->get_world ()->get_interest ().observers (me_pos.x, me_pos.z,
+			[me] (player *pl)
 				{
-					if ((pl != me) && pl->can_see_chunk (me_pos.x, me_pos.z))
-						{
-							me->spawn_to (pl);
-						}
+					if (pl != me)
+						me->spawn_to (pl);
 				});
 	}
 	
@@ -1578,13 +2215,11 @@ namespace hCraft {
 		player *me = this;
 		chunk_pos me_pos = me->pos;
 		
-		this->get_world ()->get_players ().all (
-			[me, me_pos] (player *pl)
+		this->get_world ()->get_interest ().observers (me_pos.x, me_pos.z,
+			[me] (player *pl)
 				{
-					if ((pl != me) && pl->can_see_chunk (me_pos.x, me_pos.z))
-						{
-							me->despawn_from (pl);
-						}
+					if (pl != me)
+						me->despawn_from (pl);
 				});
 	}
 	
@@ -2216,6 +2851,7 @@ namespace hCraft {
 	{
 		std::lock_guard<std::mutex> wguard {this->world_lock};
 		this->edstages.insert (es);
+		this->edstage_count = (int)this->edstages.size ();
 	}
 	
 	void
@@ -2223,6 +2859,25 @@ namespace hCraft {
 	{
 		std::lock_guard<std::mutex> wguard {this->world_lock};
 		this->edstages.erase (es);
+		this->edstage_count = (int)this->edstages.size ();
+	}
+	
+	/* 
+	 * Returns true if the player sees blocks that other players do not
+	 * (selection blocks, or edit stages of its own), in which case block
+	 * updates cannot simply be shared with other players.
+	 */
+	bool
+	player::has_private_blocks ()
+	{
+		// edstages is guarded by the world lock, which cannot be taken here
+		// without risking a deadlock against chunk streaming; its size is
+		// mirrored in edstage_count instead.
+		if (this->edstage_count.load () > 0)
+			return true;
+		
+		std::lock_guard<std::mutex> guard {this->sb_lock};
+		return !this->sel_blocks.empty ();
 	}
 	
 	
@@ -2448,6 +3103,8 @@ namespace hCraft {
 		
 		std::chrono::steady_clock::time_point now
 			= std::chrono::steady_clock::now ();
+		if ((now - this->last_tick) > std::chrono::milliseconds (75))
+			++ this->slow_ticks;
 		
 		// regenerate hearts
 		if (this->hearts < 20 && (this->hunger >= 18))
@@ -2493,6 +3150,10 @@ namespace hCraft {
 			this->srv.get_thread_pool ().enqueue (
 				[] (void *ptr) { (static_cast<player *> (ptr))->stream_chunks (); }, this);
 		
+		this->check_teleport ();
+		this->broadcast_movement ();
+		this->pace_output ();
+		
 		// send time
 		if (this->tick_counter % 40 == 0)
 			this->send (packets::play::make_time_update (w.get_time (), w.get_time ()));
@@ -4846,92 +5507,5 @@ namespace hCraft {
 					return -1;
 			}
 	}
-
-
-
-//----
-	
-	static bool
-	test_packet_00 (packet_reader reader, int length,
-		std::deque<unsigned char *>& equeue)
-	{
-		/* 
-		 * When a client connects, we expect two packets - the handshake packet
-		 * (opcode: 0x00), followed by a request/login start packet
-		 * (dpending on whether the client is trying to login, or check the server's
-		 * status.
-		 */
-		
-		return !equeue.empty ();
-	}
-	
-	static bool
-	test_packet_0e (packet_reader reader, int length,
-		std::deque<unsigned char *>& equeue)
-	{
-		reader.read_byte (); // wid
-		short slot = reader.read_short ();
-		char mbtn  = reader.read_byte ();
-		reader.read_short (); // action number
-		char mode = reader.read_byte ();
-		
-		if (mode == 5)
-			{
-				if (slot == -999 && ((mbtn == 2) || (mbtn == 6)))
-					return true;
-				
-				return false;
-			}			
-		
-		return true;
-	}
-	
-	/* 
-	 * Examines the queue that holds packets pending to be handled by
-	 * appropriate callback methods in-order to conclude whether it is safe
-	 * to handle the packets. 
-	 */
-	bool
-	player::test_packet_chain ()
-	{
-		// if the last packet is different compared to the previous ones,
-		// then consider it as the end of chain.
-		if (this->exec_queue.size () > 1)
-			{
-				int last_op = -1;
-				for (auto itr = this->exec_queue.rbegin (); itr != this->exec_queue.rend (); ++itr)
-					{
-						packet_reader reader {*itr};
-						reader.read_varint (); // skip length
-						
-						if (last_op == -1)
-							last_op = reader.read_varint ();
-						else
-							{
-								if (last_op != (int)reader.read_varint ())
-									return true;
-							}
-					}
-			} 
-		
-		// we only test the last packet
-		unsigned char *data = this->exec_queue.back ();
-		this->exec_queue.pop_back ();
-		
-		packet_reader reader {data};
-		int length = reader.read_varint ();
-		
-		bool ret = true;
-		switch (reader.read_varint ())
-			{
-				case 0x0E: ret = test_packet_0e (reader, length, this->exec_queue); break;
-				case 0x10: ret = false; break;
-				
-				case 0x00: ret = test_packet_00 (reader, length, this->exec_queue); break;
-			}
-		
-		this->exec_queue.push_back (data);
-		return ret;
-	}
 }
 
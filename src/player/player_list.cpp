@@ -19,6 +19,7 @@
 #include "player/player_list.hpp"
 #include "entities/entity.hpp"
 #include "player/player.hpp"
+#include "world/world.hpp"
 #include <cstring>
 #include <cctype>
 
@@ -222,12 +223,26 @@ namespace hCraft {
 	void
 	player_list::all_visible (std::function<void (player *)> f, player *target)
 	{
+		world *w = target->get_world ();
+		if (w)
+			{
+				// only players that observe the target's chunk can see it.
+				chunk_pos cpos = target->pos;
+				w->get_interest ().observers (cpos.x, cpos.z,
+					[&f, target] (player *pl)
+						{
+							if (pl != target)
+								f (pl);
+						});
+				return;
+			}
+		
 		std::lock_guard<std::mutex> guard {this->lock};
 		
 		for (auto itr = this->players.begin (); itr != this->players.end (); ++itr)
 			{
 				player *pl = itr->second;
-				if (pl != target && pl->visible_to (target))
+				if (pl != target && target->visible_to (pl))
 					f (pl);
 			}
 	}
@@ -329,27 +344,42 @@ namespace hCraft {
 				player *pl = itr->second;
 				if (pl != except)
 					{
-						pl->send (new packet (*pack));
+						pl->send (pack->share ());
 					}
 			}
-		delete pack;
+		packet::release (pack);
 	}
 	
 	void
 	player_list::send_to_all_visible (packet *pack, entity *target)
 	{
+		world *w = target->get_world ();
+		if (w)
+			{
+				// only players that observe the target's chunk can see it.
+				chunk_pos cpos = target->pos;
+				w->get_interest ().observers (cpos.x, cpos.z,
+					[pack, target] (player *pl)
+						{
+							if (pl != target)
+								pl->send (pack->share ());
+						});
+				packet::release (pack);
+				return;
+			}
+		
 		std::lock_guard<std::mutex> guard {this->lock};
 		
 		for (auto itr = this->players.begin (); itr != this->players.end (); ++itr)
 			{
 				player *pl = itr->second;
-				if (pl != target && pl->visible_to (target))
+				if (pl != target && target->visible_to (pl))
 					{
-						pl->send (new packet (*pack));
+						pl->send (pack->share ());
 					}
 			}
 		
-		delete pack;
+		packet::release (pack);
 	}
 }
 
@@ -112,28 +112,11 @@ namespace hCraft {
 	void
 	window::notify (packet *pack)
 	{
-		bool pack_released = false;
-		
 		std::lock_guard<std::mutex> guard {this->w_lock};
-		for (auto itr  = std::begin (this->w_subscribers);
-							itr != std::end (this->w_subscribers);
-							++itr)
-			{
-				player *pl = *itr;
-				
-				bool is_last = (itr + 1) == std::end (this->w_subscribers);
-				if (is_last)
-					{
-						// this is the last player, send the packet directly, do not copy it.
-						pl->send (pack);
-						pack_released = true;
-					}
-				else
-					pl->send (new packet (*pack));
-			}
+		for (player *pl : this->w_subscribers)
+			pl->send (pack->share ());
 		
-		if (!pack_released)
-			delete pack;
+		packet::release (pack);
 	}
 	
 	/* 
@@ -17,6 +17,7 @@
  */
 
 #include "system/packet.hpp"
+#include "system/packet_pool.hpp"
 #include "world/chunk.hpp"
 #include "entities/entity.hpp"
 #include "util/utils.hpp"
@@ -45,8 +46,9 @@ namespace hCraft {
 	{
 		this->size = 0;
 		this->pos  = 0;
-		this->cap  = size;
-		this->data = new unsigned char[size];
+		this->data = packet_pool::alloc (size, this->cap);
+		this->refs = 1;
+		this->disconnect = false;
 	}
 	
 	/* 
@@ -56,10 +58,11 @@ namespace hCraft {
 	{
 		this->size = other.size;
 		this->pos  = other.pos;
-		this->cap  = other.cap;
 		
-		this->data = new unsigned char [other.cap];
+		this->data = packet_pool::alloc (other.cap, this->cap);
 		std::memcpy (this->data, other.data, other.size);
+		this->refs = 1;
+		this->disconnect = other.disconnect;
 	}
 	
 	/* 
@@ -67,7 +70,38 @@ namespace hCraft {
 	 */
 	packet::~packet ()
 	{
-		delete[] this->data;
+		packet_pool::free (this->data, this->cap);
+	}
+	
+	
+	
+	/* 
+	 * Packet objects and their buffers are taken from the packet pool.
+	 */
+	
+	void*
+	packet::operator new (std::size_t size)
+	{
+		return packet_pool::alloc_object (size);
+	}
+	
+	void
+	packet::operator delete (void *ptr, std::size_t size)
+	{
+		packet_pool::free_object (ptr, size);
+	}
+	
+	
+	
+	/* 
+	 * Drops one reference to the specified packet, destroying it once no
+	 * owners are left.
+	 */
+	void
+	packet::release (packet *pack)
+	{
+		if (pack->refs.fetch_sub (1, std::memory_order_acq_rel) == 1)
+			delete pack;
 	}
 	
 	
@@ -299,16 +333,17 @@ namespace hCraft {
 	void
 	packet::resize (unsigned int new_size)
 	{
-		unsigned char *d = new unsigned char[new_size];
-		int m = utils::max (new_size, this->size);
+		unsigned int new_cap;
+		unsigned char *d = packet_pool::alloc (new_size, new_cap);
+		unsigned int m = utils::min (new_size, this->size);
 		std::memcpy (d, this->data, m);
-		delete[] this->data;
+		packet_pool::free (this->data, this->cap);
 		this->data = d;
 		if (new_size < this->size)
 			this->size = new_size;
 		if (new_size < this->pos)
 			this->pos = new_size;
-		this->cap = new_size;
+		this->cap = new_cap;
 	}
 	
 	void 
@@ -1562,6 +1597,7 @@ namespace hCraft {
 				pack->put_varint (1 + msg_len);
 				pack->put_varint (0x40);
 				pack->put_string (msg);
+				pack->disconnect = true;
 				
 				return pack;
 			}
@@ -1604,7 +1640,15 @@ namespace hCraft {
 			packet*
 			make_disconnect (const char *js)
 			{
-				return nullptr;
+				int js_len = mc_str_len (js);
+				packet *pack = new packet (5 + js_len);
+				
+				pack->put_varint (1 + js_len);
+				pack->put_varint (0x00); // opcode
+				pack->put_string (js);
+				pack->disconnect = true;
+				
+				return pack;
 			}
 			
 			packet*
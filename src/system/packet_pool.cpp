@@ -0,0 +1,193 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system/packet_pool.hpp"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <new>
+
+
+namespace hCraft {
+	
+	namespace {
+		
+		/* 
+		 * A free list for a single size class.
+		 */
+		struct size_class
+		{
+			unsigned int size;
+			unsigned int max_free;
+			
+			std::mutex lock;
+			std::vector<unsigned char *> free;
+			
+			size_class (unsigned int size, unsigned int max_free)
+				: size (size), max_free (max_free)
+			{
+				this->free.reserve (max_free);
+			}
+		};
+		
+		
+		// buffer sizes. most packets (movement, entity looks, block changes,
+		// chat) fall in the first two classes.  free lists are bounded to roughly
+		// 4MB per class, so that bursts of large packets do not pin memory.
+		static size_class classes[] = {
+			{    64, 16384 },
+			{   256, 16384 },
+			{  1024,  4096 },
+			{  4096,  1024 },
+			{ 16384,   256 },
+			{ 65536,    64 },
+		};
+		static const int class_count = sizeof classes / sizeof classes[0];
+		
+		
+		struct pool_counters
+		{
+			std::atomic<unsigned long long> requests;
+			std::atomic<unsigned long long> hits;
+			std::atomic<unsigned long long> heap_allocs;
+			std::atomic<unsigned long long> heap_frees;
+			std::atomic<unsigned long long> oversized;
+			std::atomic<long long> cached;
+		};
+		
+		static pool_counters counters {};
+	}
+	
+	
+	
+	static int
+	_class_of (unsigned int size)
+	{
+		for (int i = 0; i < class_count; ++i)
+			if (size <= classes[i].size)
+				return i;
+		return -1;
+	}
+	
+	
+	
+	/* 
+	 * Returns a buffer that can hold at least @{size} bytes.
+	 * The buffer's actual capacity is stored in @{cap}, and must be passed
+	 * back to free ().
+	 */
+	unsigned char*
+	packet_pool::alloc (unsigned int size, unsigned int& cap)
+	{
+		counters.requests.fetch_add (1, std::memory_order_relaxed);
+		
+		int ci = _class_of (size);
+		if (ci == -1)
+			{
+				counters.oversized.fetch_add (1, std::memory_order_relaxed);
+				counters.heap_allocs.fetch_add (1, std::memory_order_relaxed);
+				cap = size;
+				return new unsigned char [size];
+			}
+		
+		size_class& sc = classes[ci];
+		cap = sc.size;
+		
+		{
+			std::lock_guard<std::mutex> guard {sc.lock};
+			if (!sc.free.empty ())
+				{
+					unsigned char *data = sc.free.back ();
+					sc.free.pop_back ();
+					
+					counters.hits.fetch_add (1, std::memory_order_relaxed);
+					counters.cached.fetch_sub (sc.size, std::memory_order_relaxed);
+					return data;
+				}
+		}
+		
+		counters.heap_allocs.fetch_add (1, std::memory_order_relaxed);
+		return new unsigned char [sc.size];
+	}
+	
+	/* 
+	 * Returns the specified buffer to the pool.
+	 */
+	void
+	packet_pool::free (unsigned char *data, unsigned int cap)
+	{
+		if (!data)
+			return;
+		
+		int ci = _class_of (cap);
+		if (ci != -1 && classes[ci].size == cap)
+			{
+				size_class& sc = classes[ci];
+				
+				std::lock_guard<std::mutex> guard {sc.lock};
+				if (sc.free.size () < sc.max_free)
+					{
+						sc.free.push_back (data);
+						counters.cached.fetch_add (sc.size, std::memory_order_relaxed);
+						return;
+					}
+			}
+		
+		counters.heap_frees.fetch_add (1, std::memory_order_relaxed);
+		delete[] data;
+	}
+	
+	
+	
+	/* 
+	 * Storage for packet objects themselves.
+	 */
+	
+	void*
+	packet_pool::alloc_object (std::size_t size)
+	{
+		unsigned int cap;
+		return packet_pool::alloc ((unsigned int)size, cap);
+	}
+	
+	void
+	packet_pool::free_object (void *ptr, std::size_t size)
+	{
+		packet_pool::free (static_cast<unsigned char *> (ptr),
+			classes[_class_of ((unsigned int)size)].size);
+	}
+	
+	
+	
+	/* 
+	 * Fills the specified structure with the pool's allocation counters.
+	 */
+	void
+	packet_pool::get_stats (packet_pool_stats& st)
+	{
+		st.requests = counters.requests.load (std::memory_order_relaxed);
+		st.hits = counters.hits.load (std::memory_order_relaxed);
+		st.heap_allocs = counters.heap_allocs.load (std::memory_order_relaxed);
+		st.heap_frees = counters.heap_frees.load (std::memory_order_relaxed);
+		st.oversized = counters.oversized.load (std::memory_order_relaxed);
+		
+		long long cached = counters.cached.load (std::memory_order_relaxed);
+		st.cached = (cached < 0) ? 0 : cached;
+	}
+}
+
@@ -129,6 +129,7 @@ namespace hCraft {
 			std::bind (std::mem_fn (&hCraft::server::destroy_irc), this)));
 		
 		this->running = false;
+		this->headless = false;
 		this->ircc = nullptr;
 	}
 	
@@ -267,12 +268,15 @@ namespace hCraft {
 		srv.log (LT_SYSTEM) << "Saving all loaded worlds [Autosave]" << std::endl;
 		srv.get_players ().message (
 			"§5Autosave: §dSaving all loaded worlds");
+		
+		// chunks are copied and then written out in the background, the
+		// worlds log when they are done.
 		srv.get_worlds ().all (
-			[] (world *w) {
-				w->save_all ();
+			[&srv] (world *w) {
+				if (!w->save_all_async ())
+					srv.log (LT_WARNING) << "Autosave: World \"" << w->get_name ()
+						<< "\" is still being saved, skipping" << std::endl;
 			});
-		srv.get_players ().message (
-			"§5Autosave: §dAll worlds have been saved");
 	}
 	
 	/* 
@@ -614,6 +618,17 @@ namespace hCraft {
 		out.irc_chan = "#channel";
 		out.irc_nick = "hCraftBot";
 		
+		out.ph_world_budget = 4000;
+		out.ph_world_max_pending = 250000;
+		
+		out.view_min = 2;
+		out.view_max = player::chunk_radius ();
+		out.stream_chunks_per_tick = 2;
+		out.teleport_timeout = 5000;
+		out.save_chunks_per_tick = 4;
+		out.save_bytes_per_tick = 64 * 1024;
+		out.save_max_dirty_age = 60;
+		
 		out.dcmds.clear ();
 		out.dcmds.insert ("realm");
 		out.dcmds.insert ("money");
@@ -681,6 +696,36 @@ namespace hCraft {
 			root.add ("irc", grp_irc);
 		}
 		
+		{
+			cfg::group *grp_physics = new cfg::group ();
+			
+			grp_physics->add_integer ("world-updates-per-tick", in.ph_world_budget);
+			grp_physics->add_integer ("world-max-pending", in.ph_world_max_pending);
+			
+			root.add ("physics", grp_physics);
+		}
+		
+		{
+			cfg::group *grp_streaming = new cfg::group ();
+			
+			grp_streaming->add_integer ("min-view-distance", in.view_min);
+			grp_streaming->add_integer ("max-view-distance", in.view_max);
+			grp_streaming->add_integer ("chunks-per-tick", in.stream_chunks_per_tick);
+			grp_streaming->add_integer ("teleport-timeout", in.teleport_timeout);
+			
+			root.add ("streaming", grp_streaming);
+		}
+		
+		{
+			cfg::group *grp_saving = new cfg::group ();
+			
+			grp_saving->add_integer ("chunks-per-tick", in.save_chunks_per_tick);
+			grp_saving->add_integer ("bytes-per-tick", in.save_bytes_per_tick);
+			grp_saving->add_integer ("max-dirty-age", in.save_max_dirty_age);
+			
+			root.add ("saving", grp_saving);
+		}
+		
 		{
 			cfg::array *arr_dcmds = new cfg::array ();
 			
@@ -1022,6 +1067,131 @@ namespace hCraft {
 			}
 	}
 	
+	static void
+	_cfg_read_physics_grp (logger& log, cfg::group *grp_physics, server_config& out)
+	{
+		long long int num;
+		bool error = false;
+		
+		// world-updates-per-tick
+		if (grp_physics->try_get_integer ("world-updates-per-tick", num) && (num > 0))
+			out.ph_world_budget = num;
+		else
+			{
+				if (!error)
+					log (LT_ERROR) << "Config: at group \"physics\":" << std::endl;
+				log (LT_INFO) << " - \"world-updates-per-tick\" is either invalid or does not exist." << std::endl;
+				error = true;
+			}
+		
+		// world-max-pending
+		if (grp_physics->try_get_integer ("world-max-pending", num) && (num > 0))
+			out.ph_world_max_pending = num;
+		else
+			{
+				if (!error)
+					log (LT_ERROR) << "Config: at group \"physics\":" << std::endl;
+				log (LT_INFO) << " - \"world-max-pending\" is either invalid or does not exist." << std::endl;
+				error = true;
+			}
+	}
+	
+	static void
+	_cfg_read_streaming_grp (logger& log, cfg::group *grp_streaming, server_config& out)
+	{
+		long long int num;
+		bool error = false;
+		
+		// max-view-distance
+		if (grp_streaming->try_get_integer ("max-view-distance", num) &&
+			(num >= 1) && (num <= player::chunk_radius ()))
+			out.view_max = num;
+		else
+			{
+				if (!error)
+					log (LT_ERROR) << "Config: at group \"streaming\":" << std::endl;
+				log (LT_INFO) << " - \"max-view-distance\" is either invalid or does not exist." << std::endl;
+				error = true;
+			}
+		
+		// min-view-distance
+		if (grp_streaming->try_get_integer ("min-view-distance", num) &&
+			(num >= 1) && (num <= out.view_max))
+			out.view_min = num;
+		else
+			{
+				if (!error)
+					log (LT_ERROR) << "Config: at group \"streaming\":" << std::endl;
+				log (LT_INFO) << " - \"min-view-distance\" is either invalid or does not exist." << std::endl;
+				error = true;
+				
+				if (out.view_min > out.view_max)
+					out.view_min = out.view_max;
+			}
+		
+		// chunks-per-tick
+		if (grp_streaming->try_get_integer ("chunks-per-tick", num) && (num > 0))
+			out.stream_chunks_per_tick = num;
+		else
+			{
+				if (!error)
+					log (LT_ERROR) << "Config: at group \"streaming\":" << std::endl;
+				log (LT_INFO) << " - \"chunks-per-tick\" is either invalid or does not exist." << std::endl;
+				error = true;
+			}
+		
+		// teleport-timeout
+		if (grp_streaming->try_get_integer ("teleport-timeout", num) && (num >= 0))
+			out.teleport_timeout = num;
+		else
+			{
+				if (!error)
+					log (LT_ERROR) << "Config: at group \"streaming\":" << std::endl;
+				log (LT_INFO) << " - \"teleport-timeout\" is either invalid or does not exist." << std::endl;
+				error = true;
+			}
+	}
+	
+	static void
+	_cfg_read_saving_grp (logger& log, cfg::group *grp_saving, server_config& out)
+	{
+		long long int num;
+		bool error = false;
+		
+		// chunks-per-tick
+		if (grp_saving->try_get_integer ("chunks-per-tick", num) && (num >= 0))
+			out.save_chunks_per_tick = num;
+		else
+			{
+				if (!error)
+					log (LT_ERROR) << "Config: at group \"saving\":" << std::endl;
+				log (LT_INFO) << " - \"chunks-per-tick\" is either invalid or does not exist." << std::endl;
+				error = true;
+			}
+		
+		// bytes-per-tick
+		if (grp_saving->try_get_integer ("bytes-per-tick", num) && (num > 0))
+			out.save_bytes_per_tick = num;
+		else
+			{
+				if (!error)
+					log (LT_ERROR) << "Config: at group \"saving\":" << std::endl;
+				log (LT_INFO) << " - \"bytes-per-tick\" is either invalid or does not exist." << std::endl;
+				error = true;
+			}
+		
+		// max-dirty-age
+		if (grp_saving->try_get_integer ("max-dirty-age", num) && (num > 0))
+			out.save_max_dirty_age = num;
+		else
+			{
+				if (!error)
+					log (LT_ERROR) << "Config: at group \"saving\":" << std::endl;
+				log (LT_INFO) << " - \"max-dirty-age\" is either invalid or does not exist." << std::endl;
+				error = true;
+			}
+	}
+	
 	static void
 	_cfg_read_dcmds_arr (logger& log, cfg::array *arr_dcmds, server_config& out)
 	{
@@ -1094,6 +1264,39 @@ namespace hCraft {
 				log (LT_WARNING) << "Config: Group \"irc\" not found or invalid, using defaults" << std::endl;
 			}
 		
+		try
+			{
+				cfg::group *grp_physics = root->find_group ("physics");
+				if (!grp_physics) throw server_error ("not found");
+				_cfg_read_physics_grp (log, grp_physics, out);
+			}
+		catch (const std::exception& ex)
+			{
+				log (LT_WARNING) << "Config: Group \"physics\" not found or invalid, using defaults" << std::endl;
+			}
+		
+		try
+			{
+				cfg::group *grp_streaming = root->find_group ("streaming");
+				if (!grp_streaming) throw server_error ("not found");
+				_cfg_read_streaming_grp (log, grp_streaming, out);
+			}
+		catch (const std::exception& ex)
+			{
+				log (LT_WARNING) << "Config: Group \"streaming\" not found or invalid, using defaults" << std::endl;
+			}
+		
+		try
+			{
+				cfg::group *grp_saving = root->find_group ("saving");
+				if (!grp_saving) throw server_error ("not found");
+				_cfg_read_saving_grp (log, grp_saving, out);
+			}
+		catch (const std::exception& ex)
+			{
+				log (LT_WARNING) << "Config: Group \"saving\" not found or invalid, using defaults" << std::endl;
+			}
+		
 		try
 			{
 				cfg::array *arr_dcmds = root->find_array ("disabled-commands");
@@ -1341,6 +1544,27 @@ namespace hCraft {
 	
 	
 	
+	/* 
+	 * Prepares the server to host worlds without starting any of its
+	 * subsystems (configuration file, database, network, commands...).
+	 * Used by offline tools such as the physics benchmark.
+	 */
+	void
+	server::start_headless ()
+	{
+		if (this->running || this->headless)
+			throw server_error ("server already running");
+		
+		default_config (this->cfg);
+		this->entity_id_counter = 0;
+		this->world_id_counter = 0;
+		physics_block::init_blocks ();
+		
+		this->headless = true;
+	}
+	
+	
+	
 //---
 	// init_sql (), destroy_sql ():
 	/* 
@@ -1593,6 +1817,7 @@ namespace hCraft {
 		_add_command (this->perms, this->commands, this->cfg.dcmds, "realm");
 		_add_command (this->perms, this->commands, this->cfg.dcmds, "rules");
 		_add_command (this->perms, this->commands, this->cfg.dcmds, "players");
+		_add_command (this->perms, this->commands, this->cfg.dcmds, "netstats");
 		_add_command (this->perms, this->commands, this->cfg.dcmds, "warn");
 		_add_command (this->perms, this->commands, this->cfg.dcmds, "warnlog");
 		_add_command (this->perms, this->commands, this->cfg.dcmds, "worlds");
@@ -1714,6 +1939,7 @@ namespace hCraft {
 		grp_admin->add ("command.admin.rank");
 		grp_admin->add ("command.info.status.*");
 		grp_admin->add ("command.info.money.*");
+		grp_admin->add ("command.info.netstats");
 		grp_admin->add ("command.admin.kick");
 		grp_admin->add ("command.admin.ban");
 		grp_admin->add ("command.misc.kill.others");
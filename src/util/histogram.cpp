@@ -0,0 +1,103 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/histogram.hpp"
+
+
+namespace hCraft {
+	
+	latency_histogram::latency_histogram ()
+	{
+		for (int i = 0; i < bucket_count; ++i)
+			this->buckets[i] = 0;
+		this->total_us = 0;
+	}
+	
+	
+	
+	/* 
+	 * Records a single sample.
+	 */
+	void
+	latency_histogram::record (std::chrono::steady_clock::duration d)
+	{
+		long long us = std::chrono::duration_cast<std::chrono::microseconds> (d).count ();
+		if (us < 0)
+			us = 0;
+		
+		int b = 0;
+		for (long long v = us; v > 0 && b < (bucket_count - 1); v >>= 1)
+			++ b;
+		
+		this->buckets[b].fetch_add (1, std::memory_order_relaxed);
+		this->total_us.fetch_add (us, std::memory_order_relaxed);
+	}
+	
+	
+	
+	/* 
+	 * Returns the number of recorded samples.
+	 */
+	unsigned long long
+	latency_histogram::count () const
+	{
+		unsigned long long n = 0;
+		for (int i = 0; i < bucket_count; ++i)
+			n += this->buckets[i].load (std::memory_order_relaxed);
+		return n;
+	}
+	
+	/* 
+	 * Returns the average sample, in microseconds.
+	 */
+	double
+	latency_histogram::mean_us () const
+	{
+		unsigned long long n = this->count ();
+		if (n == 0)
+			return 0.0;
+		return (double)this->total_us.load (std::memory_order_relaxed) / n;
+	}
+	
+	/* 
+	 * Returns an upper bound (in microseconds) for the specified percentile
+	 * (0.0 - 1.0) of the recorded samples.
+	 */
+	unsigned long long
+	latency_histogram::percentile_us (double p) const
+	{
+		unsigned long long n = this->count ();
+		if (n == 0)
+			return 0;
+		
+		unsigned long long target = (unsigned long long)(p * n);
+		if (target >= n)
+			target = n - 1;
+		
+		unsigned long long seen = 0;
+		for (int i = 0; i < bucket_count; ++i)
+			{
+				seen += this->buckets[i].load (std::memory_order_relaxed);
+				if (seen > target)
+					return 1ULL << i;
+			}
+		
+		return 1ULL << (bucket_count - 1);
+	}
+}
+
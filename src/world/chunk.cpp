@@ -736,6 +736,22 @@ namespace hCraft {
 		return ch;
 	}
 	
+	/* 
+	 * Returns a copy of this chunk that can be written to disk while the
+	 * original keeps changing.  Unlike duplicate (), signs and the generated
+	 * flag are copied as well.
+	 */
+	chunk*
+	chunk::snapshot ()
+	{
+		chunk *ch = this->duplicate ();
+		ch->generated = this->generated;
+		
+		std::lock_guard<std::mutex> guard {this->ly_signs.lock};
+		ch->ly_signs.signs = this->ly_signs.signs;
+		return ch;
+	}
+	
 	
 	
 //------------------------------------------------------------------------------
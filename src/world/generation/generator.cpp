@@ -21,6 +21,7 @@
 #include "world/chunk.hpp"
 #include "player/player.hpp"
 #include "system/server.hpp"
+#include "util/utils.hpp"
 #include <functional>
 #include <chrono>
 
@@ -31,6 +32,8 @@ namespace hCraft {
 	{
 		this->th = nullptr;
 		this->_running = false;
+		this->backlog_size = 0;
+		this->prefetch_rr = 0;
 	}
 	
 	chunk_generator::~chunk_generator ()
@@ -71,6 +74,7 @@ namespace hCraft {
 			delete q;
 		this->queues.clear ();
 		this->index_map.clear ();
+		this->backlog_size = 0;
 	}
 	
 	
@@ -97,6 +101,59 @@ namespace hCraft {
 				++ q->counter;
 	}
 	
+	// maximum number of prefetch requests kept per player.  older ones are
+	// dropped first, since the player has most likely changed course since.
+	static const size_t max_prefetch_queue = 96;
+	
+	/* 
+	 * Pops the next prefetch request, taking turns between players.
+	 * request_mutex must be held.
+	 */
+	bool
+	chunk_generator::pop_prefetch (gen_request& req)
+	{
+		size_t count = this->queues.size ();
+		for (size_t i = 0; i < count; ++i)
+			{
+				generator_queue *q = this->queues[(this->prefetch_rr + i) % count];
+				if (!q->prefetch.empty ())
+					{
+						req = q->prefetch.front ();
+						q->prefetch.pop_front ();
+						this->prefetch_rr += i + 1;
+						return true;
+					}
+			}
+		
+		return false;
+	}
+	
+	/* 
+	 * Loads the chunk a prefetch request refers to, together with its
+	 * neighbours (the same area stream_chunks () asks for), so that a later
+	 * regular request finds them in memory.
+	 */
+	static void
+	_serve_prefetch (const gen_request& req)
+	{
+		world *w = req.w;
+		player *pl = w->get_server ().player_by_id (req.pid);
+		if (!pl || pl->get_world () != w)
+			return;
+		
+		// too far away from where the player currently is, the prediction that
+		// led to this request is stale.
+		chunk_pos cp = pl->pos;
+		int reach = player::chunk_radius () * 3;
+		if ((utils::iabs (cp.x - req.cx) > reach) || (utils::iabs (cp.z - req.cz) > reach))
+			return;
+		
+		for (int xx = (req.cx - 1); xx <= (req.cx + 1); ++xx)
+			for (int zz = (req.cz - 1); zz <= (req.cz + 1); ++zz)
+				if (!w->get_chunk (xx, zz))
+					w->load_chunk (xx, zz);
+	}
+	
 	/* 
 	 * Where everything happens.
 	 */
@@ -116,7 +173,20 @@ namespace hCraft {
 				should_rest = false;
 				++ counter;
 				
-				if (!this->queues.empty ())
+				if (!this->queues.empty () && (this->backlog_size.load () == 0))
+					{
+						// nothing urgent to do, warm up chunks ahead of moving players.
+						gen_request req;
+						bool got;
+						{
+							std::lock_guard<std::mutex> guard {this->request_mutex};
+							got = this->pop_prefetch (req);
+						}
+						
+						if (got)
+							_serve_prefetch (req);
+					}
+				else if (!this->queues.empty ())
 					{
 						std::lock_guard<std::mutex> guard {this->request_mutex};
 						_increment_counters (this->queues);
@@ -128,6 +198,7 @@ namespace hCraft {
 								// pop request
 								gen_request req = q->requests.front ();
 								q->requests.pop ();
+								-- this->backlog_size;
 								++ req_counter;
 								
 								world *w = req.w;
@@ -186,7 +257,16 @@ namespace hCraft {
 		else
 			q = this->queues[itr->second];
 		
+		if (flags & GFL_PREFETCH)
+			{
+				if (q->prefetch.size () >= max_prefetch_queue)
+					q->prefetch.pop_front ();
+				q->prefetch.push_back ({pid, w, cx, cz, flags, extra});
+				return;
+			}
+		
 		q->requests.push ({pid, w, cx, cz, flags, extra});
+		++ this->backlog_size;
 	}
 	
 	
@@ -209,9 +289,19 @@ namespace hCraft {
 				
 						if (req.w != w)
 							valid_reqs.push (req);
+						else
+							-- this->backlog_size;
 					}
 		
 				q->requests = valid_reqs;
+				
+				for (auto itr = q->prefetch.begin (); itr != q->prefetch.end (); )
+					{
+						if (itr->w == w)
+							itr = q->prefetch.erase (itr);
+						else
+							++ itr;
+					}
 			}
 	}
 }
@@ -0,0 +1,140 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "world/interest.hpp"
+#include <algorithm>
+
+
+namespace hCraft {
+	
+	static inline unsigned long long
+	_cell_key (int x, int z)
+		{ return ((unsigned long long)((unsigned int)z) << 32)
+			| (unsigned long long)((unsigned int)x); }
+	
+	
+	
+	void
+	interest_grid::add_nolock (player *pl, int cx, int cz)
+	{
+		this->cells[_cell_key (cx, cz)].push_back (pl);
+	}
+	
+	void
+	interest_grid::remove_nolock (player *pl, int cx, int cz)
+	{
+		auto itr = this->cells.find (_cell_key (cx, cz));
+		if (itr == this->cells.end ())
+			return;
+		
+		std::vector<player *>& obs = itr->second;
+		auto pitr = std::find (obs.begin (), obs.end (), pl);
+		if (pitr != obs.end ())
+			{
+				// order does not matter
+				*pitr = obs.back ();
+				obs.pop_back ();
+			}
+		
+		if (obs.empty ())
+			this->cells.erase (itr);
+	}
+	
+	
+	
+	/* 
+	 * Makes the specified player observe all chunks within @{radius} chunks
+	 * of chunk (@{cx}, @{cz}).
+	 */
+	void
+	interest_grid::add (player *pl, int cx, int cz, int radius)
+	{
+		std::lock_guard<std::mutex> guard {this->lock};
+		for (int x = cx - radius; x <= cx + radius; ++x)
+			for (int z = cz - radius; z <= cz + radius; ++z)
+				this->add_nolock (pl, x, z);
+	}
+	
+	/* 
+	 * Undoes a previous call to add ().
+	 */
+	void
+	interest_grid::remove (player *pl, int cx, int cz, int radius)
+	{
+		std::lock_guard<std::mutex> guard {this->lock};
+		for (int x = cx - radius; x <= cx + radius; ++x)
+			for (int z = cz - radius; z <= cz + radius; ++z)
+				this->remove_nolock (pl, x, z);
+	}
+	
+	/* 
+	 * Moves a player's view from chunk (@{ox}, @{oz}) to (@{nx}, @{nz}),
+	 * touching only the chunks that entered or left the view.
+	 */
+	void
+	interest_grid::move (player *pl, int ox, int oz, int nx, int nz, int radius)
+	{
+		if (ox == nx && oz == nz)
+			return;
+		
+		std::lock_guard<std::mutex> guard {this->lock};
+		
+		// chunks that went out of view
+		for (int x = ox - radius; x <= ox + radius; ++x)
+			for (int z = oz - radius; z <= oz + radius; ++z)
+				if (x < (nx - radius) || x > (nx + radius) ||
+					z < (nz - radius) || z > (nz + radius))
+					this->remove_nolock (pl, x, z);
+		
+		// chunks that came into view
+		for (int x = nx - radius; x <= nx + radius; ++x)
+			for (int z = nz - radius; z <= nz + radius; ++z)
+				if (x < (ox - radius) || x > (ox + radius) ||
+					z < (oz - radius) || z > (oz + radius))
+					this->add_nolock (pl, x, z);
+	}
+	
+	
+	
+	/* 
+	 * Calls @{f} on every player that observes chunk (@{cx}, @{cz}).
+	 * The grid is locked while @{f} runs.
+	 */
+	void
+	interest_grid::observers (int cx, int cz, std::function<void (player *)> f)
+	{
+		std::lock_guard<std::mutex> guard {this->lock};
+		auto itr = this->cells.find (_cell_key (cx, cz));
+		if (itr == this->cells.end ())
+			return;
+		
+		for (player *pl : itr->second)
+			f (pl);
+	}
+	
+	/* 
+	 * Returns true if any player observes chunk (@{cx}, @{cz}).
+	 */
+	bool
+	interest_grid::observed (int cx, int cz)
+	{
+		std::lock_guard<std::mutex> guard {this->lock};
+		return this->cells.find (_cell_key (cx, cz)) != this->cells.end ();
+	}
+}
+
@@ -0,0 +1,797 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "world/providers/hwlprovider.hpp"
+#include "world/providers/hwprovider.hpp"
+#include "world/world.hpp"
+#include "world/chunk.hpp"
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+#include <vector>
+#include <iterator>
+#include <functional>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace hCraft {
+	
+	#define HWL_RECORD_MAGIC			0x48574C52 // "HWLR"
+	#define HWL_RECORD_HEADER_SIZE		20
+	#define HWL_MAX_RECORD_DATA		 524288
+	
+	// segments are sealed once they grow past this size.
+	#define HWL_SEGMENT_SIZE		 (32 * 1024 * 1024)
+	
+	
+	
+	static unsigned long long
+	_make_key (int x, int z)
+	{
+		return ((unsigned long long)(unsigned int)x << 32) | (unsigned int)z;
+	}
+	
+	static void
+	_split_key (unsigned long long key, int *x, int *z)
+	{
+		*x = (int)(unsigned int)(key >> 32);
+		*z = (int)(unsigned int)(key & 0xFFFFFFFFU);
+	}
+	
+	static void
+	_put_int (unsigned char *data, unsigned int val)
+	{
+		data[0] = (val >> 24) & 0xFF;
+		data[1] = (val >> 16) & 0xFF;
+		data[2] = (val >>  8) & 0xFF;
+		data[3] = (val      ) & 0xFF;
+	}
+	
+	static unsigned int
+	_get_int (const unsigned char *data)
+	{
+		return ((unsigned int)data[0] << 24) | ((unsigned int)data[1] << 16)
+			| ((unsigned int)data[2] << 8) | (unsigned int)data[3];
+	}
+	
+	static std::string
+	_segment_path (const std::string& dir, unsigned int id)
+	{
+		char name[24];
+		std::snprintf (name, sizeof name, "%08u.seg", id);
+		return dir + name;
+	}
+	
+	static bool
+	_read_fully (int fd, unsigned char *data, size_t size, unsigned long long offset)
+	{
+		while (size > 0)
+			{
+				ssize_t n = ::pread (fd, data, size, offset);
+				if (n <= 0)
+					return false;
+				data += n;
+				size -= n;
+				offset += n;
+			}
+		return true;
+	}
+	
+	static bool
+	_write_fully (int fd, const unsigned char *data, size_t size,
+		unsigned long long offset)
+	{
+		while (size > 0)
+			{
+				ssize_t n = ::pwrite (fd, data, size, offset);
+				if (n <= 0)
+					return false;
+				data += n;
+				size -= n;
+				offset += n;
+			}
+		return true;
+	}
+	
+	
+	
+	struct hwl_read_guard
+	{
+		pthread_rwlock_t *lock;
+		hwl_read_guard (pthread_rwlock_t *lock) : lock (lock)
+			{ pthread_rwlock_rdlock (lock); }
+		~hwl_read_guard ()
+			{ pthread_rwlock_unlock (this->lock); }
+	};
+	
+	struct hwl_write_guard
+	{
+		pthread_rwlock_t *lock;
+		hwl_write_guard (pthread_rwlock_t *lock) : lock (lock)
+			{ pthread_rwlock_wrlock (lock); }
+		~hwl_write_guard ()
+			{ pthread_rwlock_unlock (this->lock); }
+	};
+	
+	
+	
+	/* 
+	 * Constructs a new world provider for the HWL format.
+	 */
+	hwl_provider::hwl_provider (const char *path, const char *world_name)
+		: out_path (path)
+	{
+		if (this->out_path[this->out_path.size () - 1] != '/')
+			this->out_path.push_back ('/');
+		this->out_path.append (hwl_provider_naming ().make_name (world_name));
+		this->out_path.push_back ('/');
+		
+		this->meta = new hw_provider (this->out_path.c_str (), "meta");
+		this->inf = this->meta->info ();
+		
+		this->active = 0;
+		this->compact_wanted = false;
+		this->stopping = false;
+		pthread_rwlock_init (&this->lock, nullptr);
+		
+		// rebuild the index if the world already exists
+		this->replay ();
+		this->inf.chunk_count = this->index.size ();
+		
+		this->compactor = std::thread (
+			std::bind (std::mem_fn (&hwl_provider::compact_worker), this));
+	}
+	
+	/* 
+	 * Class destructor.
+	 */
+	hwl_provider::~hwl_provider ()
+	{
+		{
+			std::lock_guard<std::mutex> guard {this->compact_lock};
+			this->stopping = true;
+		}
+		this->compact_cv.notify_all ();
+		if (this->compactor.joinable ())
+			this->compactor.join ();
+		
+		this->close ();
+		for (auto& p : this->segs)
+			::close (p.second.fd);
+		delete this->meta;
+		pthread_rwlock_destroy (&this->lock);
+	}
+	
+	
+	
+	/* 
+	 * Reads in all segments, oldest first, so that later records of the same
+	 * chunk replace earlier ones in the index.
+	 */
+	void
+	hwl_provider::replay ()
+	{
+		DIR *dir = opendir (this->out_path.c_str ());
+		if (!dir)
+			return; // new world
+		
+		struct dirent *ent;
+		while ((ent = readdir (dir)))
+			{
+				const char *name = ent->d_name;
+				if ((std::strlen (name) != 12) || (std::strcmp (name + 8, ".seg") != 0))
+					continue;
+				
+				bool digits = true;
+				for (int i = 0; i < 8; ++i)
+					if (!std::isdigit (name[i]))
+						digits = false;
+				if (!digits)
+					continue;
+				
+				unsigned int id = std::strtoul (name, nullptr, 10);
+				if (id == 0)
+					continue;
+				
+				int fd = ::open (_segment_path (this->out_path, id).c_str (), O_RDWR);
+				if (fd == -1)
+					continue;
+				
+				hwl_segment seg;
+				seg.id = id;
+				seg.fd = fd;
+				seg.size = seg.live = 0;
+				seg.dirty = false;
+				this->segs[id] = seg;
+			}
+		closedir (dir);
+		
+		for (auto itr = this->segs.begin (); itr != this->segs.end (); ++itr)
+			{
+				bool last = (std::next (itr) == this->segs.end ());
+				if (!this->replay_segment (itr->second, last))
+					this->compact_wanted = true;
+				else if (itr->second.live * 2 < itr->second.size)
+					this->compact_wanted = true;
+			}
+		
+		// keep appending to the newest segment if there is room left in it.
+		if (!this->segs.empty ())
+			{
+				hwl_segment& seg = this->segs.rbegin ()->second;
+				if (seg.size < HWL_SEGMENT_SIZE)
+					this->active = seg.id;
+			}
+	}
+	
+	/* 
+	 * Adds the records of a single segment to the index.  Returns false if
+	 * the segment ends with a torn or corrupt record, which can happen if the
+	 * server went down mid-write.  Anything past such a record is dropped.
+	 */
+	bool
+	hwl_provider::replay_segment (hwl_segment& seg, bool last)
+	{
+		struct stat st;
+		if (fstat (seg.fd, &st) != 0)
+			return false;
+		unsigned long long file_size = st.st_size;
+		
+		std::vector<unsigned char> data;
+		unsigned char hdr[HWL_RECORD_HEADER_SIZE];
+		unsigned long long offset = 0;
+		bool good = true;
+		while (offset < file_size)
+			{
+				if ((file_size - offset < HWL_RECORD_HEADER_SIZE) ||
+					!_read_fully (seg.fd, hdr, HWL_RECORD_HEADER_SIZE, offset) ||
+					(_get_int (hdr) != HWL_RECORD_MAGIC))
+					{ good = false; break; }
+				
+				int x = (int)_get_int (hdr + 4);
+				int z = (int)_get_int (hdr + 8);
+				unsigned int size = _get_int (hdr + 12);
+				unsigned int crc = _get_int (hdr + 16);
+				if ((size > HWL_MAX_RECORD_DATA) ||
+					(file_size - offset - HWL_RECORD_HEADER_SIZE < size))
+					{ good = false; break; }
+				
+				data.resize (size);
+				if (!_read_fully (seg.fd, data.data (), size, offset + HWL_RECORD_HEADER_SIZE) ||
+					(crc32 (0, data.data (), size) != crc))
+					{ good = false; break; }
+				
+				unsigned long long key = _make_key (x, z);
+				auto itr = this->index.find (key);
+				if (itr != this->index.end ())
+					this->segs[itr->second.seg].live -= HWL_RECORD_HEADER_SIZE + itr->second.size;
+				this->index[key] = {seg.id, offset, size};
+				seg.live += HWL_RECORD_HEADER_SIZE + size;
+				
+				offset += HWL_RECORD_HEADER_SIZE + size;
+			}
+		
+		seg.size = offset;
+		if (!good)
+			{
+				if (last)
+					{
+						// cut off the torn record so that new records can be appended.
+						if (ftruncate (seg.fd, offset) != 0)
+							seg.size = file_size;
+					}
+				else
+					seg.size = file_size;
+			}
+		
+		return good;
+	}
+	
+	
+	
+	/* 
+	 * Appends a chunk record to the active segment and points the index at
+	 * it.  lock must be held for writing.
+	 */
+	void
+	hwl_provider::append (const unsigned char *data, unsigned int size, int x, int z)
+	{
+		if (size > HWL_MAX_RECORD_DATA)
+			throw std::runtime_error ("chunk record too large");
+		
+		if (this->active == 0)
+			{
+				unsigned int id = this->segs.empty () ? 1 : (this->segs.rbegin ()->first + 1);
+				int fd = ::open (_segment_path (this->out_path, id).c_str (),
+					O_RDWR | O_CREAT | O_TRUNC, 0644);
+				if (fd == -1)
+					throw std::runtime_error ("failed to create segment file");
+				
+				hwl_segment seg;
+				seg.id = id;
+				seg.fd = fd;
+				seg.size = seg.live = 0;
+				seg.dirty = false;
+				this->segs[id] = seg;
+				this->active = id;
+			}
+		hwl_segment& seg = this->segs[this->active];
+		
+		// header and data are written with a single call, so that a crash can
+		// only leave a torn record at the very end of the segment.
+		static thread_local std::vector<unsigned char> rec;
+		rec.resize (HWL_RECORD_HEADER_SIZE + size);
+		_put_int (rec.data (), HWL_RECORD_MAGIC);
+		_put_int (rec.data () + 4, (unsigned int)x);
+		_put_int (rec.data () + 8, (unsigned int)z);
+		_put_int (rec.data () + 12, size);
+		_put_int (rec.data () + 16, crc32 (0, data, size));
+		std::memcpy (rec.data () + HWL_RECORD_HEADER_SIZE, data, size);
+		
+		if (!_write_fully (seg.fd, rec.data (), rec.size (), seg.size))
+			{
+				// whatever did make it out is cut off on the next replay.
+				throw std::runtime_error ("failed to write chunk record");
+			}
+		
+		unsigned long long key = _make_key (x, z);
+		auto itr = this->index.find (key);
+		if (itr != this->index.end ())
+			{
+				hwl_segment& old = this->segs[itr->second.seg];
+				old.live -= HWL_RECORD_HEADER_SIZE + itr->second.size;
+				if ((old.id != seg.id) && (old.live * 2 < old.size))
+					this->compact_wanted = true;
+			}
+		this->index[key] = {seg.id, seg.size, size};
+		seg.size += rec.size ();
+		seg.live += rec.size ();
+		seg.dirty = true;
+		this->inf.chunk_count = this->index.size ();
+		
+		if (seg.size >= HWL_SEGMENT_SIZE)
+			this->active = 0;
+	}
+	
+	/* 
+	 * Makes sure that all appended records have reached the disk.
+	 */
+	void
+	hwl_provider::sync_segments ()
+	{
+		std::vector<unsigned int> ids;
+		{
+			hwl_write_guard guard {&this->lock};
+			for (auto& p : this->segs)
+				if (p.second.dirty)
+					{
+						ids.push_back (p.first);
+						p.second.dirty = false;
+					}
+		}
+		if (ids.empty ())
+			return;
+		
+		// segments are only closed with the lock held for writing, so loads can
+		// go on while this waits for the disk.
+		hwl_read_guard guard {&this->lock};
+		for (unsigned int id : ids)
+			{
+				auto itr = this->segs.find (id);
+				if (itr != this->segs.end ())
+					fdatasync (itr->second.fd);
+			}
+	}
+	
+	
+	
+	void
+	hwl_provider::compact_worker ()
+	{
+		std::unique_lock<std::mutex> guard {this->compact_lock};
+		while (!this->stopping)
+			{
+				this->compact_cv.wait_for (guard, std::chrono::seconds (10),
+					[this] { return this->stopping || this->compact_wanted; });
+				if (this->stopping)
+					break;
+				if (!this->compact_wanted)
+					continue;
+				this->compact_wanted = false;
+				
+				guard.unlock ();
+				while (!this->stopping)
+					{
+						std::lock_guard<std::mutex> run_guard {this->compact_run};
+						if (!this->compact_one ())
+							break;
+					}
+				guard.lock ();
+			}
+	}
+	
+	/* 
+	 * Picks the sealed segment with the most outdated records, copies its
+	 * live records to the active segment, and deletes it.  Returns false if
+	 * there was nothing worth compacting.
+	 */
+	bool
+	hwl_provider::compact_one ()
+	{
+		unsigned int victim = 0;
+		std::vector<unsigned long long> keys;
+		{
+			hwl_read_guard guard {&this->lock};
+			double best = 0.5;
+			for (auto& p : this->segs)
+				{
+					const hwl_segment& seg = p.second;
+					if ((seg.id == this->active) || (seg.size == 0))
+						continue;
+					
+					double garbage = 1.0 - ((double)seg.live / seg.size);
+					if (garbage >= best)
+						{
+							best = garbage;
+							victim = seg.id;
+						}
+				}
+			if (victim == 0)
+				return false;
+			
+			for (auto& p : this->index)
+				if (p.second.seg == victim)
+					keys.push_back (p.first);
+		}
+		
+		std::vector<unsigned char> data;
+		for (unsigned long long key : keys)
+			{
+				if (this->stopping)
+					return false; // copies made so far are harmless
+				
+				// records in sealed segments never change, so they can be read
+				// without blocking saves.
+				hwl_entry ent;
+				int fd;
+				{
+					hwl_read_guard guard {&this->lock};
+					auto itr = this->index.find (key);
+					if ((itr == this->index.end ()) || (itr->second.seg != victim))
+						continue;
+					ent = itr->second;
+					fd = this->segs.at (victim).fd;
+					
+					data.resize (ent.size);
+					if (!_read_fully (fd, data.data (), ent.size,
+						ent.offset + HWL_RECORD_HEADER_SIZE))
+						return false;
+				}
+				
+				int x, z;
+				_split_key (key, &x, &z);
+				try
+					{
+						hwl_write_guard guard {&this->lock};
+						auto itr = this->index.find (key);
+						if ((itr == this->index.end ()) || (itr->second.seg != victim))
+							continue; // saved again in the meantime
+						this->append (data.data (), ent.size, x, z);
+					}
+				catch (const std::exception&)
+					{
+						return false;
+					}
+			}
+		
+		// the copies must be on disk before the originals go away.
+		this->sync_segments ();
+		
+		{
+			hwl_write_guard guard {&this->lock};
+			auto itr = this->segs.find (victim);
+			if (itr->second.live > 0)
+				return true; // should not happen, try again later
+			
+			::close (itr->second.fd);
+			std::remove (_segment_path (this->out_path, victim).c_str ());
+			this->segs.erase (itr);
+		}
+		
+		return true;
+	}
+	
+	
+	
+	/* 
+	 * Deletes all segments and the metadata file.  The directory itself is
+	 * kept.
+	 */
+	void
+	hwl_provider::clear (world &wr)
+	{
+		// wait for a compaction that is in progress to finish.
+		std::lock_guard<std::mutex> run_guard {this->compact_run};
+		
+		{
+			hwl_write_guard guard {&this->lock};
+			for (auto& p : this->segs)
+				{
+					::close (p.second.fd);
+					std::remove (_segment_path (this->out_path, p.first).c_str ());
+				}
+			this->segs.clear ();
+			this->index.clear ();
+			this->active = 0;
+			this->inf.chunk_count = 0;
+		}
+		
+		this->meta->clear (wr);
+	}
+	
+	
+	
+	/* 
+	 * Returns the filesystem path to the world's directory.
+	 */
+	const char*
+	hwl_provider::get_path ()
+	{
+		return this->out_path.c_str ();
+	}
+	
+	
+	
+	/* 
+	 * Opens the underlying file stream for reading\writing.
+	 */
+	void
+	hwl_provider::open (world &wr)
+	{
+		mkdir (this->out_path.c_str (), 0744);
+		this->meta->open (wr);
+	}
+	
+	/* 
+	 * Closes the underlying file stream, and makes sure that everything
+	 * appended so far has reached the disk.
+	 */
+	void
+	hwl_provider::close ()
+	{
+		this->meta->close ();
+		this->sync_segments ();
+		
+		if (this->compact_wanted)
+			this->compact_cv.notify_one ();
+	}
+	
+	
+	
+	/* 
+	 * Adds required prefixes, suffixes, etc... to the specified world name so
+	 * that the importer's claims_name () function returns true when passed to
+	 * it.
+	 */
+	std::string
+	hwl_provider_naming::make_name (const char *world_name)
+	{
+		std::string out;
+		out.reserve (std::strlen (world_name) + 4);
+		
+		int c;
+		while ((c = (int)(*world_name++)))
+			{
+				if (c == ' ')
+					out.push_back ('_');
+				else
+					out.push_back (std::tolower (c));
+			}
+		
+		out.append (".hwl"); // extension
+		
+		return out;
+	}
+	
+	/* 
+	 * Checks whether the specified path name meets the format required by this
+	 * exporter (could be a name prefix, suffix, extension, etc...).
+	 */
+	bool
+	hwl_provider_naming::claims_name (const char *path)
+	{
+		int len = std::strlen (path);
+		while ((len > 0) && (path[len - 1] == '/'))
+			-- len;
+		return ((len > 5) && (std::strncmp (path + len - 4, ".hwl", 4) == 0));
+	}
+	
+	/* 
+	 * Checks whether the directory located at @{path} holds a world of this
+	 * format.
+	 */
+	bool
+	hwl_provider::claims (const char *path)
+	{
+		struct stat st;
+		if (stat (path, &st) != 0 || !S_ISDIR(st.st_mode))
+			return false;
+		
+		std::string meta_path (path);
+		if (meta_path[meta_path.size () - 1] != '/')
+			meta_path.push_back ('/');
+		meta_path.append (hw_provider_naming ().make_name ("meta"));
+		return this->meta->claims (meta_path.c_str ());
+	}
+	
+	
+	
+	/* 
+	 * Saves only the specified chunk.
+	 */
+	void
+	hwl_provider::save (world& wr, chunk *ch, int x, int z)
+	{
+		std::vector<unsigned char> data;
+		hw_compress_chunk (ch, data);
+		this->save_prepared (wr, data, x, z);
+	}
+	
+	/* 
+	 * Serializes and compresses the specified chunk so that it can be written
+	 * out later by save_prepared ().
+	 */
+	bool
+	hwl_provider::prepare_save (chunk *ch, std::vector<unsigned char>& out)
+	{
+		hw_compress_chunk (ch, out);
+		return true;
+	}
+	
+	/* 
+	 * Writes out a chunk that has been prepared by prepare_save ().
+	 */
+	void
+	hwl_provider::save_prepared (world& wr, const std::vector<unsigned char>& data,
+		int x, int z)
+	{
+		mkdir (this->out_path.c_str (), 0744);
+		
+		hwl_write_guard guard {&this->lock};
+		this->append (data.data (), data.size (), x, z);
+	}
+	
+	/* 
+	 * Saves the specified world without writing out any chunks.
+	 */
+	void
+	hwl_provider::save_empty (world &wr)
+	{
+		mkdir (this->out_path.c_str (), 0744);
+		this->meta->save_empty (wr);
+	}
+	
+	/* 
+	 * Updates world information for a given world. 
+	 */
+	void
+	hwl_provider::save_info (world &w, const world_information &info)
+	{
+		this->meta->save_info (w, info);
+		
+		hwl_write_guard guard {&this->lock};
+		this->inf = info;
+		this->inf.chunk_count = this->index.size ();
+	}
+	
+	
+	
+	/* 
+	 * Attempts to load the chunk located at the specified coordinates into
+	 * @{ch}. Returns true on success, and false if the chunk is not present
+	 * within the world.
+	 */
+	bool
+	hwl_provider::load (world &wr, chunk *ch, int x, int z)
+	{
+		static thread_local std::vector<unsigned char> data;
+		
+		{
+			hwl_read_guard guard {&this->lock};
+			auto itr = this->index.find (_make_key (x, z));
+			if (itr == this->index.end ())
+				return false;
+			
+			const hwl_entry& ent = itr->second;
+			data.resize (ent.size);
+			if (!_read_fully (this->segs.at (ent.seg).fd, data.data (), ent.size,
+				ent.offset + HWL_RECORD_HEADER_SIZE))
+				throw std::runtime_error ("failed to read chunk record");
+		}
+		
+		hw_decompress_chunk (ch, data.data (), data.size ());
+		return true;
+	}
+	
+	
+	
+	/* 
+	 * Saves the specified list of portals to disk.
+	 */
+	void
+	hwl_provider::save_portals (world &wr, const std::vector<portal *>& portals)
+	{
+		this->meta->save_portals (wr, portals);
+	}
+	
+	/* 
+	 * Loads the portal list from disk into the given vector.
+	 */
+	void
+	hwl_provider::load_portals (world &wr, std::vector<portal *>& portals)
+	{
+		this->meta->load_portals (wr, portals);
+	}
+	
+	
+	
+	/* 
+	 * Saves the specified list of zones to disk.
+	 */
+	void
+	hwl_provider::save_zones (world &wr,  const std::vector<zone *>& zones)
+	{
+		this->meta->save_zones (wr, zones);
+	}
+	
+	/* 
+	 * Loads the zone list from disk into the given vector.
+	 */
+	void
+	hwl_provider::load_zones (world &wr, std::vector<zone *>& zones)
+	{
+		this->meta->load_zones (wr, zones);
+	}
+	
+	
+	
+	/* 
+	 * Updates\saves owner\member list, build\join permissions, etc...
+	 */
+	void
+	hwl_provider::save_security (world &w, const world_security& sec)
+	{
+		this->meta->save_security (w, sec);
+	}
+	
+	/* 
+	 * Loads world security information.
+	 */
+	void
+	hwl_provider::load_security (world &w, world_security& sec)
+	{
+		this->meta->load_security (w, sec);
+	}
+}
+
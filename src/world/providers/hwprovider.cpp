@@ -31,6 +31,13 @@
 #include <zlib.h>
 #include <stdexcept>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 
 namespace hCraft {
@@ -44,6 +51,12 @@ namespace hCraft {
 	
 	#define HW_CURR_REV												5
 	
+	#define HW_MAX_CHUNK_DATA						 524288
+	
+	#define HW_SECTOR_UNITS									8 // 4096-byte sectors, in 512-byte units
+	#define HW_FREE_SECTORS_LAYER		"free-sectors"
+	#define HW_CHUNK_INDEX_LAYER		"chunk-index"
+	
 	
 	inline int
 	fast_floor (double x)
@@ -302,8 +315,37 @@ namespace hCraft {
 	
 	
 //----
+	
+	struct map_read_guard
+	{
+		pthread_rwlock_t *lock;
+		map_read_guard (pthread_rwlock_t *lock) : lock (lock)
+			{ pthread_rwlock_rdlock (lock); }
+		~map_read_guard ()
+			{ pthread_rwlock_unlock (this->lock); }
+	};
+	
+	struct map_write_guard
+	{
+		pthread_rwlock_t *lock;
+		map_write_guard (pthread_rwlock_t *lock) : lock (lock)
+			{ pthread_rwlock_wrlock (lock); }
+		~map_write_guard ()
+			{ pthread_rwlock_unlock (this->lock); }
+	};
+	
+	
+	
 		
-	static void read_file (world_information&, hw_superblock **, binary_reader); // forward def
+	static void read_header (world_information&, binary_reader); // forward def
+	static int _write_int (unsigned char *data, unsigned int val); // forward def
+	static int _read_int (const unsigned char *data, unsigned int& pos); // forward def
+	
+	static unsigned long long
+	_chunk_key (int x, int z)
+	{
+		return ((unsigned long long)(unsigned int)x << 32) | (unsigned int)z;
+	}
 	
 	/* 
 	 * Constructs a new world provider for the HWv1 format.
@@ -315,19 +357,32 @@ namespace hCraft {
 			this->out_path.push_back ('/');
 		this->out_path.append (hw_provider_naming ().make_name (world_name));
 		
-		for (int i = 0; i < 4096; ++i)
-			this->sblocks[i] = nullptr;
-		
-		// read tables if the world file already exists
+		// the file is mapped on the first load
+		this->map_fd = -1;
+		this->map_data = nullptr;
+		this->map_size = 0;
+		this->map_stale = true;
+		pthread_rwlock_init (&this->map_lock, nullptr);
+		this->free_dirty = false;
+		this->free_checked = true;
+		
+		// the chunk index is built on first access
+		this->index_ready = false;
+		this->index_dirty = false;
+		this->count_dirty = false;
+		
+		// read the header and layer table if the world file already exists
 		{
 			std::fstream strm (this->out_path, std::ios_base::in
 				| std::ios_base::binary);
 			if (strm.is_open ())
 				{
 					binary_reader reader {strm};
-					read_file (this->inf, this->sblocks, reader);
+					read_header (this->inf, reader);
 					this->read_layer_table (strm);
 					strm.close ();
+					
+					this->load_free_sectors ();
 				}
 		}
 	}
@@ -337,11 +392,95 @@ namespace hCraft {
 	 */
 	hw_provider::~hw_provider ()
 	{
-		for (int i = 0; i < 4096; ++i)
-			delete this->sblocks[i];
+		this->close (); // may still write out layers
 		for (hw_layer& ly : this->layers)
 			delete[] ly.offsets;
-		this->close ();
+		this->unmap ();
+		pthread_rwlock_destroy (&this->map_lock);
+	}
+	
+	
+	
+	/* 
+	 * (Re)maps the world file if it has grown since it was last mapped.
+	 * map_lock must be held for writing.
+	 */
+	void
+	hw_provider::remap ()
+	{
+		this->map_stale = false;
+		
+		if (this->map_fd == -1)
+			{
+				this->map_fd = ::open (this->out_path.c_str (), O_RDONLY);
+				if (this->map_fd == -1)
+					return; // no world file yet
+			}
+		
+		struct stat st;
+		if (fstat (this->map_fd, &st) != 0)
+			return;
+		size_t size = st.st_size;
+		if (this->map_data && (size == this->map_size))
+			return; // writes to a shared mapping are visible without remapping
+		
+		if (this->map_data)
+			munmap (this->map_data, this->map_size);
+		this->map_data = nullptr;
+		this->map_size = 0;
+		if (size == 0)
+			return;
+		
+		void *ptr = mmap (nullptr, size, PROT_READ, MAP_SHARED, this->map_fd, 0);
+		if (ptr == MAP_FAILED)
+			return;
+		
+		this->map_data = static_cast<unsigned char *> (ptr);
+		this->map_size = size;
+	}
+	
+	void
+	hw_provider::unmap ()
+	{
+		if (this->map_data)
+			munmap (this->map_data, this->map_size);
+		this->map_data = nullptr;
+		this->map_size = 0;
+		
+		if (this->map_fd != -1)
+			::close (this->map_fd);
+		this->map_fd = -1;
+		this->map_stale = true;
+	}
+	
+	
+	
+	/* 
+	 * Deletes the world file.
+	 */
+	void
+	hw_provider::clear (world &wr)
+	{
+		map_write_guard guard {&this->map_lock};
+		
+		if (this->strm.is_open ())
+			this->strm.close ();
+		std::remove (this->out_path.c_str ());
+		this->unmap ();
+		
+		for (hw_layer& ly : this->layers)
+			delete[] ly.offsets;
+		this->layers.clear ();
+		
+		this->free_sectors.clear ();
+		this->free_dirty = false;
+		this->free_checked = true;
+		this->chunk_index.clear ();
+		this->table_cache.clear ();
+		this->index_ready = true;
+		this->index_dirty = false;
+		this->count_dirty = false;
+		this->inf.chunk_count = 0;
 	}
 	
 	
@@ -386,6 +525,44 @@ namespace hCraft {
 	{
 		if (this->strm.is_open ())
 			{
+				if (this->free_dirty || this->index_dirty || this->count_dirty)
+					{
+						map_write_guard guard {&this->map_lock};
+						if (this->free_dirty)
+							{
+								std::vector<unsigned char> data = this->free_sectors.serialize ();
+								this->write_layer (HW_FREE_SECTORS_LAYER, data.data (), data.size ());
+								this->free_dirty = false;
+							}
+						
+						if (this->count_dirty)
+							{
+								binary_writer writer {this->strm};
+								writer.seek (44);
+								writer.write_int (this->inf.chunk_count);
+								this->count_dirty = false;
+							}
+						
+						if (this->index_dirty)
+							{
+								// written after the chunk count, so that an index that does
+								// not match the count is never taken for an up to date one.
+								std::vector<unsigned char> data (4 + this->chunk_index.size () * 12);
+								unsigned int pos = 0;
+								pos += _write_int (data.data () + pos, this->chunk_index.size ());
+								for (auto& p : this->chunk_index)
+									{
+										pos += _write_int (data.data () + pos, (unsigned int)(p.first >> 32));
+										pos += _write_int (data.data () + pos, (unsigned int)(p.first & 0xFFFFFFFFU));
+										pos += _write_int (data.data () + pos, p.second);
+									}
+								this->write_layer (HW_CHUNK_INDEX_LAYER, data.data (), data.size ());
+								this->index_dirty = false;
+							}
+						
+						this->map_stale = true;
+					}
+				
 				this->strm.flush ();
 				this->strm.close ();
 			}
@@ -452,233 +629,165 @@ namespace hCraft {
 	
 //----
 	
-	static hw_superblock*
-	find_or_create_superblock (int x, int z, hw_superblock **sblocks,
-		binary_writer writer, bool create = true)
+//----
+	
+	/* 
+	 * Looks up (@{x}, @{z}) in the table of @{slot_count} slots located at
+	 * @{table_pos} (in bytes), and returns the offset it points to.  If it is
+	 * not there, a new child (a table of @{child_slots} slots, or a chunk
+	 * header if that is zero) is appended to the file and linked in.
+	 */
+	unsigned int
+	hw_provider::find_or_create_slot (unsigned int table_pos,
+		unsigned int slot_count, int x, int z, unsigned int child_slots,
+		bool *created)
 	{
-		unsigned int hash = hash_coords (x, z);
-		unsigned int hash_m = hash & 0xFFF;
+		if (created) *created = false;
 		
-		hw_superblock *sblock = sblocks[hash_m];
-		if (sblock != nullptr)
+		auto itr = this->table_cache.find (table_pos);
+		if (itr == this->table_cache.end ())
 			{
-				if (sblock->x == x && sblock->z == z)
-					return sblock;
-				
-				// linear probe
-				int i;
-				for (i = 0; i < 4096; ++i)
+				// read in the occupied slots
+				std::vector<hw_slot> slots;
+				binary_reader reader {this->strm};
+				reader.seek (table_pos);
+				for (unsigned int i = 0; i < slot_count; ++i)
 					{
-						int m = (hash_m + i) & 0xFFF;
-						sblock = sblocks[m];
-						if (sblock == nullptr || (sblock->x == x && sblock->z == z))
-							break;
+						hw_slot slot;
+						slot.index = i;
+						slot.x = reader.read_int ();
+						slot.z = reader.read_int ();
+						slot.offset = reader.read_int ();
+						if (slot.offset != 0xFFFFFFFFU)
+							slots.push_back (slot);
 					}
-				if (i == 4096)
-					return nullptr;
-				hash_m = (hash_m + i) & 0xFFF;
+				if (!this->strm)
+					throw std::runtime_error ("failed to read world file tables");
+				
+				itr = this->table_cache.emplace (table_pos, std::move (slots)).first;
 			}
-		if (sblock) return sblock;
-		
-		if (create)
+		std::vector<hw_slot>& slots = itr->second;
+		
+		// linear probe
+		unsigned int hash_m = hash_coords (x, z) & (slot_count - 1);
+		unsigned int m = 0;
+		std::vector<hw_slot>::iterator pos;
+		unsigned int i;
+		for (i = 0; i < slot_count; ++i)
 			{
-				sblocks[hash_m] = new hw_superblock (x, z);
-				sblock = sblocks[hash_m];
+				m = (hash_m + i) & (slot_count - 1);
+				pos = std::lower_bound (slots.begin (), slots.end (), m,
+					[] (const hw_slot& slot, unsigned int index) { return slot.index < index; });
+				if ((pos == slots.end ()) || (pos->index != m))
+					break; // free
+				if ((pos->x == x) && (pos->z == z))
+					return pos->offset;
+			}
+		if (i == slot_count)
+			return 0xFFFFFFFFU;
 		
-				// create the superblock
-				writer.seek (0, std::ios_base::end);
-				sblock->offset = writer.tell () / 512;
-				for (int i = 0; i < 64; ++i)
+		// create the child
+		binary_writer writer {this->strm};
+		writer.seek (0, std::ios_base::end);
+		writer.pad_to (512);
+		unsigned int offset = writer.tell () / 512;
+		if (child_slots > 0)
+			{
+				for (unsigned int j = 0; j < child_slots; ++j)
 					{
 						writer.write_int (0); // x
 						writer.write_int (0); // z
 						writer.write_int (0xFFFFFFFFU); // offset
 					}
-				writer.pad_to (512);
-		
-				// update file
-				writer.seek (HW_SUPERBLOCK_TABLE_OFFSET + (12 * hash_m));
-				writer.write_int (x);
-				writer.write_int (z);
-				writer.write_int (sblock->offset);
 			}
-		
-		return sblock;
-	}
-	
-	static hw_block*
-	find_or_create_block (int x, int z, hw_superblock **sblocks,
-		binary_writer writer, bool create = true)
-	{
-		hw_superblock *sblock = find_or_create_superblock (
-			fast_floor (x / 8.0), fast_floor (z / 8.0), sblocks,writer, create);
-		if (!sblock) return nullptr;
-		
-		unsigned int hash = hash_coords (x, z);
-		unsigned int hash_m = hash & 0x3F;
-		
-		hw_block *block = sblock->blocks[hash_m];
-		if (block != nullptr)
+		else
 			{
-				if (block->x == x && block->z == z)
-					return block;
-				
-				// linear probe
-				int i;
-				for (i = 0; i < 64; ++i)
-					{
-						int m = (hash_m + i) & 0x3F;
-						block = sblock->blocks[m];
-						if (block == nullptr || (block->x == x && block->z == z))
-							break;
-					}
-				if (i == 64)
-					return nullptr;
-				hash_m = (hash_m + i) & 0x3F;
+				writer.write_int (0); // size
+				for (int j = 0; j < 256; ++j)
+					writer.write_int (0); // sector table
 			}
-		if (block) return block;
-		
-		if (create)
-			{
-				sblock->blocks[hash_m] = new hw_block (x, z);
-				block = sblock->blocks[hash_m];
-		
-				// create the block
-				writer.seek (0, std::ios_base::end);
-				block->offset = writer.tell () / 512;
-				for (int i = 0; i < 1024; ++i)
-					{
-						writer.write_int (0); // x
-						writer.write_int (0); // z
-						writer.write_int (0xFFFFFFFFU); // offset
-					}
-				writer.pad_to (512);
+		writer.pad_to (512);
 		
-				// update file
-				writer.seek ((sblock->offset * 512) + (12 * hash_m));
-				writer.write_int (x);
-				writer.write_int (z);
-				writer.write_int (block->offset);
-			}
+		// link it
+		writer.seek (table_pos + (12 * m));
+		writer.write_int (x);
+		writer.write_int (z);
+		writer.write_int (offset);
 		
-		return block;
+		slots.insert (pos, hw_slot {m, x, z, offset});
+		if (created) *created = true;
+		return offset;
 	}
 	
-	static hw_region*
-	find_or_create_region (int x, int z, hw_superblock **sblocks,
-		binary_writer writer, bool create = true)
+	/* 
+	 * Returns the offset of the header of the chunk at the specified
+	 * coordinates, adding the chunk (and any tables on the way) to the file if
+	 * it is not there yet.  map_lock must be held for writing, and strm must be
+	 * open.
+	 */
+	unsigned int
+	hw_provider::find_or_create_chunk (int x, int z, bool *created)
 	{
-		hw_block *block = find_or_create_block (
-			fast_floor (x / 32.0), fast_floor (z / 32.0), sblocks, writer, create);
-		if (!block) return nullptr;
-		
-		unsigned int hash = hash_coords (x, z);
-		unsigned int hash_m = hash & 0x3FF;
-		
-		hw_region *region = block->regions[hash_m];
-		if (region != nullptr)
-			{
-				if (region->x == x && region->z == z)
-					return region;
-				
-				// linear probe
-				int i;
-				for (i = 0; i < 1024; ++i)
-					{
-						int m = (hash_m + i) & 0x3FF;
-						region = block->regions[m];
-						if (region == nullptr || (region->x == x && region->z == z))
-							break;
-					}
-				if (i == 1024)
-					return nullptr;
-				hash_m = (hash_m + i) & 0x3FF;
-			}
-		if (region) return region;
-		
-		if (create)
-			{
-				block->regions[hash_m] = new hw_region (x, z);
-				region = block->regions[hash_m];
-		
-				// create the region
-				writer.seek (0, std::ios_base::end);
-				region->offset = writer.tell () / 512;
-				for (int i = 0; i < 1024; ++i)
-					{
-						writer.write_int (0); // x
-						writer.write_int (0); // z
-						writer.write_int (0xFFFFFFFFU); // offset
-					}
-				writer.pad_to (512);
-		
-				// update file
-				writer.seek ((block->offset * 512) + (12 * hash_m));
-				writer.write_int (x);
-				writer.write_int (z);
-				writer.write_int (region->offset);
-			}
-		
-		return region;
+		if (created) *created = false;
+		
+		unsigned long long key = _chunk_key (x, z);
+		auto itr = this->chunk_index.find (key);
+		if (itr != this->chunk_index.end ())
+			return itr->second;
+		
+		int rx = fast_floor (x / 32.0), rz = fast_floor (z / 32.0);
+		int bx = fast_floor (rx / 32.0), bz = fast_floor (rz / 32.0);
+		int sx = fast_floor (bx / 8.0), sz = fast_floor (bz / 8.0);
+		
+		unsigned int sb_offset = this->find_or_create_slot (HW_SUPERBLOCK_TABLE_OFFSET,
+			4096, sx, sz, 64, nullptr);
+		if (sb_offset == 0xFFFFFFFFU) return sb_offset;
+		unsigned int b_offset = this->find_or_create_slot (sb_offset * 512,
+			64, bx, bz, 1024, nullptr);
+		if (b_offset == 0xFFFFFFFFU) return b_offset;
+		unsigned int r_offset = this->find_or_create_slot (b_offset * 512,
+			1024, rx, rz, 1024, nullptr);
+		if (r_offset == 0xFFFFFFFFU) return r_offset;
+		unsigned int c_offset = this->find_or_create_slot (r_offset * 512,
+			1024, x, z, 0, created);
+		if (c_offset == 0xFFFFFFFFU) return c_offset;
+		
+		this->chunk_index[key] = c_offset;
+		this->index_dirty = true;
+		return c_offset;
+	}
+	
+	void
+	hw_provider::read_chunk_header (unsigned int offset, hw_chunk& hch)
+	{
+		binary_reader reader {this->strm};
+		reader.seek ((std::streamoff)offset * 512);
+		hch.offset = offset;
+		hch.size = reader.read_int ();
+		for (int i = 0; i < 256; ++i)
+			hch.sector_table[i] = reader.read_int ();
+		if (!this->strm)
+			throw std::runtime_error ("failed to read chunk header");
 	}
 	
-	static hw_chunk*
-	find_or_create_chunk (int x, int z, hw_superblock **sblocks,
-		binary_writer writer, bool create = true, bool* got_created = nullptr)
+	/* 
+	 * Reads a chunk's header straight out of the mapped world file.
+	 */
+	static bool
+	map_chunk_header (const unsigned char *map, size_t map_size,
+		unsigned int offset, hw_chunk& hch)
 	{
-		if (got_created) *got_created = false;
-		hw_region *region = find_or_create_region (
-			fast_floor (x / 32.0), fast_floor (z / 32.0), sblocks, writer, create);
-		if (!region) return nullptr;
-		
-		unsigned int hash = hash_coords (x, z);
-		unsigned int hash_m = hash & 0x3FF;
-		
-		hw_chunk *ch = region->chunks[hash_m];
-		if (ch != nullptr)
-			{
-				if (ch->x == x && ch->z == z)
-					return ch;
-				
-				// linear probe
-				int i;
-				for (i = 0; i < 1024; ++i)
-					{
-						int m = (hash_m + i) & 0x3FF;
-						ch = region->chunks[m];
-						if (ch == nullptr || (ch->x == x && ch->z == z))
-							break;
-					}
-				if (i == 1024)
-					return nullptr;
-				hash_m = (hash_m + i) & 0x3FF;
-			}
-		if (ch) return ch;
-		
-		if (create)
-			{
-				if (got_created) *got_created = true;
-				region->chunks[hash_m] = new hw_chunk (x, z);
-				ch = region->chunks[hash_m];
-		
-				// create the chunk
-				writer.seek (0, std::ios_base::end);
-				ch->offset = writer.tell () / 512;
-				
-				writer.write_int (ch->size);
-				for (int j = 0; j < 256; ++j)
-					writer.write_int (ch->sector_table[j]);
-					
-				writer.pad_to (512);
-		
-				// update file
-				writer.seek ((region->offset * 512) + (12 * hash_m));
-				writer.write_int (x);
-				writer.write_int (z);
-				writer.write_int (ch->offset);
-			}
+		size_t pos = (size_t)offset * 512;
+		if (pos + 1028 > map_size)
+			return false;
 		
-		return ch;
+		const unsigned char *data = map + pos;
+		unsigned int n = 0;
+		hch.offset = offset;
+		hch.size = _read_int (data + n, n);
+		for (int i = 0; i < 256; ++i)
+			hch.sector_table[i] = _read_int (data + n, n);
+		return true;
 	}
 	
 	
@@ -802,6 +911,164 @@ namespace hCraft {
 	
 	
 	
+//----
+	
+	void
+	hw_sector_map::add_run (unsigned int offset, unsigned int count)
+	{
+		this->runs[offset] = count;
+		this->by_size.insert (std::make_pair (count, offset));
+	}
+	
+	void
+	hw_sector_map::remove_run (std::map<unsigned int, unsigned int>::iterator itr)
+	{
+		this->by_size.erase (std::make_pair (itr->second, itr->first));
+		this->runs.erase (itr);
+	}
+	
+	/* 
+	 * Takes @{count} contiguous sectors out of the map, from the smallest run
+	 * that is large enough.  Returns false if no run is.
+	 */
+	bool
+	hw_sector_map::alloc (unsigned int count, unsigned int& offset)
+	{
+		auto itr = this->by_size.lower_bound (std::make_pair (count, 0U));
+		if (itr == this->by_size.end ())
+			return false;
+		
+		unsigned int run_count = itr->first;
+		offset = itr->second;
+		this->remove_run (this->runs.find (offset));
+		if (run_count > count)
+			this->add_run (offset + count * HW_SECTOR_UNITS, run_count - count);
+		return true;
+	}
+	
+	/* 
+	 * Returns @{count} contiguous sectors starting at @{offset} to the map.
+	 */
+	void
+	hw_sector_map::release (unsigned int offset, unsigned int count)
+	{
+		if (count == 0)
+			return;
+		unsigned int end = offset + count * HW_SECTOR_UNITS;
+		
+		auto next = this->runs.lower_bound (offset);
+		if ((next != this->runs.end ()) && (next->first < end))
+			return; // already free
+		if (next != this->runs.begin ())
+			{
+				auto prev = std::prev (next);
+				unsigned int prev_end = prev->first + prev->second * HW_SECTOR_UNITS;
+				if (prev_end > offset)
+					return; // already free
+				if (prev_end == offset)
+					{
+						// merge with the preceding run
+						offset = prev->first;
+						count += prev->second;
+						this->remove_run (prev);
+					}
+			}
+		if ((next != this->runs.end ()) && (next->first == end))
+			{
+				// and with the following one
+				count += next->second;
+				this->remove_run (next);
+			}
+		
+		this->add_run (offset, count);
+	}
+	
+	/* 
+	 * Makes sure that the sector at @{offset} is not considered free.
+	 */
+	void
+	hw_sector_map::claim (unsigned int offset)
+	{
+		unsigned int end = offset + HW_SECTOR_UNITS;
+		
+		auto itr = this->runs.upper_bound (offset);
+		if (itr != this->runs.begin ())
+			-- itr;
+		while ((itr != this->runs.end ()) && (itr->first < end))
+			{
+				unsigned int run_start = itr->first;
+				unsigned int run_end = run_start + itr->second * HW_SECTOR_UNITS;
+				auto next = std::next (itr);
+				if (run_end > offset)
+					{
+						// split the run around the claimed sector
+						this->remove_run (itr);
+						if (run_start < offset)
+							this->add_run (run_start, (offset - run_start) / HW_SECTOR_UNITS);
+						if (run_end > end)
+							{
+								unsigned int rest = run_start + (((end - run_start) + HW_SECTOR_UNITS - 1)
+									/ HW_SECTOR_UNITS) * HW_SECTOR_UNITS;
+								if (rest < run_end)
+									this->add_run (rest, (run_end - rest) / HW_SECTOR_UNITS);
+							}
+					}
+				itr = next;
+			}
+	}
+	
+	void
+	hw_sector_map::clear ()
+	{
+		this->runs.clear ();
+		this->by_size.clear ();
+	}
+	
+	/* 
+	 * Returns the number of free sectors.
+	 */
+	unsigned int
+	hw_sector_map::total () const
+	{
+		unsigned int n = 0;
+		for (auto& p : this->runs)
+			n += p.second;
+		return n;
+	}
+	
+	std::vector<unsigned char>
+	hw_sector_map::serialize () const
+	{
+		std::vector<unsigned char> data (4 + this->runs.size () * 8);
+		unsigned int pos = 0;
+		pos += _write_int (data.data () + pos, this->runs.size ());
+		for (auto& p : this->runs)
+			{
+				pos += _write_int (data.data () + pos, p.first);
+				pos += _write_int (data.data () + pos, p.second);
+			}
+		return data;
+	}
+	
+	void
+	hw_sector_map::deserialize (const unsigned char *data, unsigned int size)
+	{
+		this->clear ();
+		if (size < 4)
+			return;
+		
+		unsigned int pos = 0;
+		unsigned int count = _read_int (data + pos, pos);
+		for (unsigned int i = 0; (i < count) && (pos + 8 <= size); ++i)
+			{
+				unsigned int offset = _read_int (data + pos, pos);
+				unsigned int n = _read_int (data + pos, pos);
+				this->release (offset, n);
+			}
+	}
+	
+	
+	
 //----
 	
 	static unsigned int
@@ -929,65 +1196,80 @@ namespace hCraft {
 	
 	
 	
-	static void
-	write_to_sector (hw_chunk *hch, unsigned int index, unsigned char *data,
-		unsigned int len, binary_writer writer)
+	/* 
+	 * Writes a chunk's compressed data into its sectors.  A chunk that grows is
+	 * moved to the smallest run of free sectors that fits all of it, if there
+	 * is one, so that its sectors stay contiguous; otherwise the extra sectors
+	 * come from the map, or from the end of the file.  Sectors that are no
+	 * longer needed are handed back to @{free_map}.  Returns true if the map
+	 * has been changed.
+	 */
+	static bool
+	write_in_sectors (hw_chunk *hch, unsigned char *data, unsigned int data_size,
+		hw_sector_map& free_map, binary_writer writer)
 	{
+		unsigned int sectors_needed = data_size / 4096;
+		if (data_size % 4096 != 0)
+			++ sectors_needed;
 		unsigned int sectors_used = hch->size / 4096;
 		if (hch->size % 4096 != 0)
 			++ sectors_used;
+		if (sectors_needed > 256)
+			throw std::runtime_error ("chunk too large");
 		
-		if (index >= sectors_used)
+		bool map_changed = false;
+		unsigned int first_new = sectors_used;
+		if (sectors_needed > sectors_used)
 			{
-				int sector_offset;
+				unsigned int extra = sectors_needed - sectors_used;
+				unsigned int run;
+				if (free_map.alloc (sectors_needed, run))
+					{
+						for (unsigned int i = 0; i < sectors_used; ++i)
+							free_map.release (hch->sector_table[i]);
+						for (unsigned int i = 0; i < sectors_needed; ++i)
+							hch->sector_table[i] = run + i * HW_SECTOR_UNITS;
+						first_new = 0;
+						map_changed = true;
+					}
+				else
+					{
+						if (free_map.alloc (extra, run))
+							map_changed = true;
+						else
+							{
+								writer.seek (0, std::ios_base::end);
+								run = ((unsigned int)writer.tell () + 511) / 512;
+							}
+						
+						for (unsigned int i = sectors_used; i < sectors_needed; ++i)
+							hch->sector_table[i] = run + (i - sectors_used) * HW_SECTOR_UNITS;
+					}
+			}
+		
+		// sector data
+		for (unsigned int i = 0; i < sectors_needed; ++i)
+			{
+				unsigned int len = 4096;
+				if ((i == (sectors_needed - 1)) && (data_size % 4096 != 0))
+					len = data_size % 4096;
 				
-				// create the sector
-				writer.seek (0, std::ios_base::end);
-				sector_offset = writer.tell () / 512;
-				writer.write_bytes (data, len);
-				if (len < 4096)
+				writer.seek (hch->sector_table[i] * 512);
+				writer.write_bytes (data + (4096 * i), len);
+				if ((len < 4096) && (i >= first_new))
 					{
 						int rem = 4096 - len;
 						while (rem-- > 0)
 							writer.write_byte (0);
 					}
-				
-				hch->sector_table[index] = sector_offset;
-				
-				// update file
-				writer.seek ((hch->offset * 512) + 4 + (index * 4));
-				writer.write_int (sector_offset);
-			}
-		else
-			{
-				// overwrite existing sector
-				writer.seek (hch->sector_table[index] * 512);
-				writer.write_bytes (data, len);
 			}
-	}
-	
-	static void
-	write_in_sectors (hw_chunk *hch, unsigned char *data, unsigned int data_size,
-		binary_writer writer)
-	{
-		unsigned int sectors_needed = data_size / 4096;
-		if (data_size % 4096 != 0)
-			++ sectors_needed;
 		
-		size_t i, sector_size;
-		
-		for (i = 0; i < sectors_needed; ++i)
+		// sector table entries of new sectors
+		if (first_new < sectors_needed)
 			{
-				if (i == (sectors_needed - 1))
-					{
-						sector_size = data_size % 4096;
-						if (sector_size == 0)
-							sector_size = 4096;
-					}
-				else
-					sector_size = 4096;
-				
-				write_to_sector (hch, i, data + (4096 * i), sector_size, writer);
+				writer.seek ((hch->offset * 512) + 4 + (first_new * 4));
+				for (unsigned int i = first_new; i < sectors_needed; ++i)
+					writer.write_int (hch->sector_table[i]);
 			}
 		
 		if ((unsigned int)hch->size != data_size)
@@ -996,42 +1278,61 @@ namespace hCraft {
 				writer.seek (hch->offset * 512);
 				writer.write_int (data_size);
 			}
+		
+		// sectors the chunk has shrunk out of
+		for (unsigned int i = sectors_needed; i < sectors_used; ++i)
+			{
+				free_map.release (hch->sector_table[i]);
+				map_changed = true;
+			}
+		
+		return map_changed;
 	}
 	
 	static void
-	save_chunk (chunk *ch, int x, int z, hw_superblock **sblocks,
-		world_information& inf, binary_writer writer)
+	compress_chunk (chunk *ch, std::vector<unsigned char>& out)
 	{
-		unsigned char *compressed;
-		unsigned long compressed_size;
-		
 		unsigned int data_size = 0;
 		unsigned char *data = make_chunk_data (ch, &data_size);
 		
-		compressed_size = compressBound (data_size);
-		compressed = new unsigned char[compressed_size];
-		if (compress2 (compressed, &compressed_size, data, data_size,
+		unsigned long compressed_size = compressBound (data_size);
+		out.resize (compressed_size);
+		if (compress2 (out.data (), &compressed_size, data, data_size,
 			Z_BEST_COMPRESSION) != Z_OK)
 			{
 				delete[] data;
-				delete[] compressed;
 				throw std::runtime_error ("failed to compress chunk");
 			}
 		delete[] data;
 		
+		out.resize (compressed_size);
+	}
+	
+	bool
+	hw_provider::write_chunk (const std::vector<unsigned char>& compressed, int x, int z)
+	{
 		bool created = false;
-		hw_chunk *hch = find_or_create_chunk (x, z, sblocks, writer, true, &created);
-		if (hch)
-			write_in_sectors (hch, compressed, compressed_size, writer);
+		unsigned int offset = this->find_or_create_chunk (x, z, &created);
+		if (offset == 0xFFFFFFFFU)
+			return false;
+		
+		hw_chunk hch;
+		hch.x = x;
+		hch.z = z;
+		this->read_chunk_header (offset, hch);
+		
+		binary_writer writer {this->strm};
+		bool map_changed = write_in_sectors (&hch, const_cast<unsigned char *> (compressed.data ()),
+			compressed.size (), this->free_sectors, writer);
 		
 		if (created)
 			{
 				// update chunk count
 				writer.seek (44);
-				writer.write_int (++ (inf.chunk_count));
+				writer.write_int (++ (this->inf.chunk_count));
 			}
 		
-		delete[] compressed;
+		return map_changed;
 	}
 	
 	
@@ -1051,9 +1352,22 @@ namespace hCraft {
 				close_when_done = true;
 			}
 		
-		binary_writer writer {this->strm};
-		save_chunk (ch, x, z, this->sblocks, this->inf, writer);
-		//rewrite_header (wr, strm);
+		std::vector<unsigned char> compressed;
+		compress_chunk (ch, compressed);
+		
+		{
+			map_write_guard guard {&this->map_lock};
+			this->ensure_index ();
+			this->check_free_sectors ();
+			if (this->write_chunk (compressed, x, z))
+				this->free_dirty = true;
+			//rewrite_header (wr, strm);
+			
+			// make the new data visible through the mapping before any load can
+			// look at the updated tables.
+			this->strm.flush ();
+			this->map_stale = true;
+		}
 		
 		if (close_when_done)
 			{
@@ -1062,12 +1376,51 @@ namespace hCraft {
 	}
 	
 	/* 
-	 * Updates world information for a given world. 
+	 * Serializes and compresses the specified chunk so that it can be written
+	 * out later by save_prepared ().
+	 */
+	bool
+	hw_provider::prepare_save (chunk *ch, std::vector<unsigned char>& out)
+	{
+		compress_chunk (ch, out);
+		return true;
+	}
+	
+	/* 
+	 * Writes out a chunk that has been prepared by prepare_save ().
 	 */
 	void
-	hw_provider::save_info (world &w, const world_information &info)
+	hw_provider::save_prepared (world& wr, const std::vector<unsigned char>& data,
+		int x, int z)
+	{
+		bool close_when_done = false;
+		if (!this->strm.is_open ())
+			{
+				this->open (wr);
+				if (!this->strm)
+					return;
+				close_when_done = true;
+			}
+		
+		{
+			map_write_guard guard {&this->map_lock};
+			this->ensure_index ();
+			this->check_free_sectors ();
+			if (this->write_chunk (data, x, z))
+				this->free_dirty = true;
+			this->strm.flush ();
+			this->map_stale = true;
+		}
+		
+		if (close_when_done)
+			{
+				this->close ();
+			}
+	}
+	
+	static void
+	write_info (const world_information &info, binary_writer writer)
 	{
-		binary_writer writer (strm);
 		writer.seek (8);
 		
 		// world dimensions
@@ -1098,7 +1451,21 @@ namespace hCraft {
 		writer.write_byte (info.pvp ? 1 : 0);
 		
 		writer.flush ();
-		this->inf = info;
+	}
+	
+	/* 
+	 * Updates world information for a given world. 
+	 */
+	void
+	hw_provider::save_info (world &w, const world_information &info)
+	{
+		// the chunk count is maintained by the provider itself.
+		world_information ninf = info;
+		ninf.chunk_count = this->inf.chunk_count;
+		
+		binary_writer writer (strm);
+		write_info (ninf, writer);
+		this->inf = ninf;
 	}
 	
 	
@@ -1106,7 +1473,7 @@ namespace hCraft {
 //----
 	
 	static void
-	save_empty_imp (world &wr, std::ostream& strm, hw_superblock **sblock_table)
+	save_empty_imp (world &wr, std::ostream& strm)
 	{
 		binary_writer writer (strm);
 		
@@ -1170,9 +1537,6 @@ namespace hCraft {
 		writer.pad_to (512);
 		
 		writer.flush ();
-		
-		for (int i = 0; i < 4096; ++i)
-			sblock_table[i] = nullptr;
 	}
 	
 	/* 
@@ -1196,8 +1560,19 @@ namespace hCraft {
 		if (!strm)
 			throw std::runtime_error ("failed to open world file");
 		
-		save_empty_imp (wr, strm, this->sblocks);
+		map_write_guard guard {&this->map_lock};
+		save_empty_imp (wr, strm);
 		strm.close ();
+		this->free_sectors.clear ();
+		this->free_dirty = false;
+		this->free_checked = true;
+		this->chunk_index.clear ();
+		this->table_cache.clear ();
+		this->index_ready = true;
+		this->index_dirty = false;
+		this->count_dirty = false;
+		this->inf.chunk_count = 0;
+		this->map_stale = true;
 	}
 	
 	
@@ -1249,99 +1624,154 @@ namespace hCraft {
 			}
 	}	
 	
-	static void
-	read_tables (hw_superblock **sblocks, binary_reader reader)
+	/* 
+	 * Reads in the free sector map.  Sectors in it that chunks turn out to be
+	 * using are dropped by check_free_sectors () before the first allocation.
+	 */
+	void
+	hw_provider::load_free_sectors ()
 	{
-		reader.seek (HW_SUPERBLOCK_TABLE_OFFSET);
+		this->free_sectors.clear ();
+		this->free_checked = true;
 		
-		int sb_x, sb_z;
-		unsigned int sb_offset;
-		for (int i = 0; i < 4096; ++i)
+		std::ifstream in (this->out_path, std::ios_base::in | std::ios_base::binary);
+		if (!in.is_open ())
+			return;
+		unsigned int size;
+		unsigned char *data = this->read_layer (in, HW_FREE_SECTORS_LAYER, size);
+		if (!data)
+			return;
+		
+		this->free_sectors.deserialize (data, size);
+		delete[] data;
+		this->free_checked = (this->free_sectors.total () == 0);
+	}
+	
+	/* 
+	 * Drops sectors used by chunks from the free sector map loaded from disk
+	 * (the map is only written out on close (), so it may be older than the
+	 * chunk tables).  map_lock must be held for writing, and strm must be
+	 * open.
+	 */
+	void
+	hw_provider::check_free_sectors ()
+	{
+		if (this->free_checked)
+			return;
+		
+		hw_chunk hch;
+		for (auto& p : this->chunk_index)
+			{
+				this->read_chunk_header (p.second, hch);
+				unsigned int used = (hch.size + 4095) / 4096;
+				for (unsigned int i = 0; (i < used) && (i < 256); ++i)
+					this->free_sectors.claim (hch.sector_table[i]);
+			}
+		this->free_checked = true;
+	}
+	
+	/* 
+	 * Walks the superblock -> block -> region -> chunk tree, and adds every
+	 * chunk in it to @{index}.  Chunk headers are not read.
+	 */
+	static void
+	walk_tables (std::unordered_map<unsigned long long, unsigned int>& index,
+		binary_reader reader)
+	{
+		struct entry { int x, z; unsigned int offset; };
+		auto read_table = [&reader] (unsigned long long pos, int count, std::vector<entry>& out)
 			{
-				sb_x = reader.read_int ();
-				sb_z = reader.read_int ();
-				sb_offset = reader.read_int ();
-				if (sb_offset == 0xFFFFFFFFU)
+				out.clear ();
+				reader.seek (pos);
+				for (int i = 0; i < count; ++i)
 					{
-						sblocks[i] = nullptr;
-						continue;
+						entry e;
+						e.x = reader.read_int ();
+						e.z = reader.read_int ();
+						e.offset = reader.read_int ();
+						if (e.offset != 0xFFFFFFFFU)
+							out.push_back (e);
 					}
-				
-				hw_superblock *sblock = new hw_superblock (sb_x, sb_z);
-				sblocks[i] = sblock;
-				sblock->offset = sb_offset;
-				
-				int saved_pos = reader.tell ();
-				int b_x, b_z;
-				unsigned int b_offset;
-				reader.seek (sblock->offset * 512);
-				for (int i = 0; i < 64; ++i)
+			};
+		
+		std::vector<entry> sblocks, blocks, regions, chunks;
+		read_table (HW_SUPERBLOCK_TABLE_OFFSET, 4096, sblocks);
+		for (entry& sb : sblocks)
+			{
+				read_table ((unsigned long long)sb.offset * 512, 64, blocks);
+				for (entry& b : blocks)
 					{
-						b_x = reader.read_int ();
-						b_z = reader.read_int ();
-						b_offset = reader.read_int ();
-						if (b_offset == 0xFFFFFFFFU)
+						read_table ((unsigned long long)b.offset * 512, 1024, regions);
+						for (entry& r : regions)
 							{
-								sblock->blocks[i] = nullptr;
-								continue;
+								read_table ((unsigned long long)r.offset * 512, 1024, chunks);
+								for (entry& c : chunks)
+									index[_chunk_key (c.x, c.z)] = c.offset;
 							}
-						
-						hw_block *block = new hw_block (b_x, b_z);
-						sblock->blocks[i] = block;
-						block->offset = b_offset;
-						
-						int saved_pos = reader.tell ();
-						int r_x, r_z;
-						unsigned int r_offset;
-						reader.seek (block->offset * 512);
-						for (int i = 0; i < 1024; ++i)
+					}
+			}
+	}
+	
+	/* 
+	 * Builds the chunk index if that has not been done yet.  The index stored
+	 * in the world file is used if it covers as many chunks as the header says
+	 * the file holds (the count is updated as soon as a chunk is added, the
+	 * index only on close ()); otherwise the tree is walked.
+	 */
+	void
+	hw_provider::ensure_index ()
+	{
+		if (this->index_ready)
+			return;
+		this->chunk_index.clear ();
+		
+		if (this->strm.is_open ())
+			this->strm.flush ();
+		std::ifstream in (this->out_path, std::ios_base::in | std::ios_base::binary);
+		if (!in.is_open ())
+			{
+				// no world file yet
+				this->index_ready = true;
+				return;
+			}
+		
+		unsigned int size;
+		unsigned char *data = this->read_layer (in, HW_CHUNK_INDEX_LAYER, size);
+		if (data)
+			{
+				unsigned int pos = 0;
+				unsigned int count = (size >= 4) ? _read_int (data, pos) : 0;
+				if ((size >= 4) && (size >= 4 + count * 12) && ((int)count == this->inf.chunk_count))
+					{
+						this->chunk_index.reserve (count);
+						for (unsigned int i = 0; i < count; ++i)
 							{
-								r_x = reader.read_int ();
-								r_z = reader.read_int ();
-								r_offset = reader.read_int ();
-								if (r_offset == 0xFFFFFFFFU)
-									{
-										block->regions[i] = nullptr;
-										continue;
-									}
-								
-								hw_region *region = new hw_region (r_x, r_z);
-								block->regions[i] = region;
-								region->offset = r_offset;
-								
-								int saved_pos = reader.tell ();
-								int c_x, c_z;
-								unsigned int c_offset;
-								reader.seek (region->offset * 512);
-								for (int i = 0; i < 1024; ++i)
-									{
-										c_x = reader.read_int ();
-										c_z = reader.read_int ();
-										c_offset = reader.read_int ();
-										if (c_offset == 0xFFFFFFFFU)
-											{
-												region->chunks[i] = nullptr;
-												continue;
-											}
-										
-										hw_chunk *ch = new hw_chunk (c_x, c_z);
-										region->chunks[i] = ch;
-										ch->offset = c_offset;
-										
-										int saved_pos = reader.tell ();
-										reader.seek (c_offset * 512);
-										
-										ch->size = reader.read_int ();
-										for (int i = 0; i < 256; ++i)
-											ch->sector_table[i] = reader.read_int ();
-										
-										reader.seek (saved_pos);
-									}
-								reader.seek (saved_pos);
+								int x = _read_int (data + pos, pos);
+								int z = _read_int (data + pos, pos);
+								unsigned int offset = _read_int (data + pos, pos);
+								this->chunk_index[_chunk_key (x, z)] = offset;
 							}
-						reader.seek (saved_pos);
+						delete[] data;
+						this->index_ready = true;
+						return;
 					}
-				reader.seek (saved_pos);
+				delete[] data;
+			}
+		
+		// missing or out of date
+		in.clear ();
+		walk_tables (this->chunk_index, binary_reader {in});
+		if (!in)
+			{
+				this->chunk_index.clear ();
+				throw world_load_error ("HWv1: failed to read chunk tables");
+			}
+		this->index_ready = true;
+		this->index_dirty = true;
+		if (this->inf.chunk_count != (int)this->chunk_index.size ())
+			{
+				this->inf.chunk_count = this->chunk_index.size ();
+				this->count_dirty = true;
 			}
 	}
 	
@@ -1388,37 +1818,46 @@ namespace hCraft {
 		inf.pvp = (reader.read_byte () != 0);
 	}
 	
-	static void
-	read_file (world_information& inf, hw_superblock **sblocks, binary_reader reader)
-	{
-		read_header (inf, reader);
-		read_tables (sblocks, reader);
-	}
 	
 	
 	
-	static unsigned char*
-	combine_sectors (hw_chunk *hch, binary_reader reader, unsigned int *out_size)
+	/* 
+	 * Decompresses a chunk's data straight from the sectors it occupies in the
+	 * mapped world file into @{out}.
+	 */
+	static void
+	inflate_sectors (const hw_chunk *hch, const unsigned char *map, size_t map_size,
+		unsigned char *out, unsigned int out_size)
 	{
-		unsigned int compressed_size = hch->size;
-		*out_size = compressed_size;
+		z_stream zs;
+		std::memset (&zs, 0, sizeof zs);
+		if (inflateInit (&zs) != Z_OK)
+			throw std::runtime_error ("failed to decompress chunk");
 		
-		unsigned char *compressed = new unsigned char[compressed_size];
-		unsigned int n = 0;
+		zs.next_out = out;
+		zs.avail_out = out_size;
 		
-		int sector_index = 0;
-		while (compressed_size > 0)
+		int ret = Z_OK;
+		unsigned int left = hch->size;
+		for (int sector_index = 0; (left > 0) && (ret == Z_OK); ++sector_index)
 			{
-				int need = (compressed_size >= 4096) ? 4096 : compressed_size;
-				reader.seek (hch->sector_table[sector_index] * 512);
-				reader.read_bytes (compressed + n, need);
+				unsigned int need = (left >= 4096) ? 4096 : left;
+				size_t offset = (size_t)hch->sector_table[sector_index] * 512;
+				if ((sector_index >= 256) || ((offset + need) > map_size))
+					{
+						ret = Z_DATA_ERROR;
+						break;
+					}
 				
-				n += need;
-				compressed_size -= need;
-				++ sector_index;
+				zs.next_in = const_cast<unsigned char *> (map + offset);
+				zs.avail_in = need;
+				ret = inflate (&zs, Z_NO_FLUSH);
+				left -= need;
 			}
 		
-		return compressed;
+		inflateEnd (&zs);
+		if (ret != Z_STREAM_END)
+			throw std::runtime_error ("failed to decompress chunk");
 	}
 	
 	
@@ -1539,6 +1978,33 @@ namespace hCraft {
 		n = _fill_ly_signs (ch, data, n);
 	}
 	
+	/* 
+	 * Serializes and compresses a chunk into the chunk format used by HWv1
+	 * world files.
+	 */
+	void
+	hw_compress_chunk (chunk *ch, std::vector<unsigned char>& out)
+	{
+		compress_chunk (ch, out);
+	}
+	
+	/* 
+	 * Inflates a chunk produced by hw_compress_chunk () into @{ch}.
+	 */
+	void
+	hw_decompress_chunk (chunk *ch, const unsigned char *data, unsigned int size)
+	{
+		static thread_local std::vector<unsigned char> buf;
+		if (buf.size () < HW_MAX_CHUNK_DATA)
+			buf.resize (HW_MAX_CHUNK_DATA);
+		
+		unsigned long out_size = HW_MAX_CHUNK_DATA;
+		if (uncompress (buf.data (), &out_size, data, size) != Z_OK)
+			throw std::runtime_error ("failed to decompress chunk");
+		
+		fill_chunk (ch, buf.data ());
+	}
+	
 	/* 
 	 * Attempts to load the chunk located at the specified coordinates into
 	 * @{ch}. Returns true on success, and false if the chunk is not present
@@ -1547,30 +2013,45 @@ namespace hCraft {
 	bool
 	hw_provider::load (world &wr, chunk *ch, int x, int z)
 	{
-		if (!this->strm.is_open ())
-			return false;
-		
-		binary_writer writer; // not actually used
-		hw_chunk *hch = find_or_create_chunk (x, z, this->sblocks, writer, false);
-		if (!hch) return false;
-		
-		binary_reader reader {this->strm};
-		
-		unsigned int compressed_size = 0;
-		unsigned char *compressed = combine_sectors (hch, reader, &compressed_size);
+		// decompression buffer, reused by all loads made by the same thread.
+		static thread_local std::vector<unsigned char> data;
+		if (data.size () < HW_MAX_CHUNK_DATA)
+			data.resize (HW_MAX_CHUNK_DATA);
 		
-		unsigned long data_size = 524288;
-		unsigned char *data = new unsigned char[data_size];
-		if (uncompress (data, &data_size, compressed, compressed_size) != Z_OK)
+		for (;;)
 			{
-				delete[] compressed;
-				delete[] data;
-				throw std::runtime_error ("failed to decompress chunk");
+				{
+					map_read_guard guard {&this->map_lock};
+					if (!this->map_stale && this->index_ready)
+						{
+							if (!this->map_data)
+								return false;
+							
+							auto itr = this->chunk_index.find (_chunk_key (x, z));
+							if (itr == this->chunk_index.end ())
+								return false;
+							
+							hw_chunk hch;
+							hch.x = x;
+							hch.z = z;
+							if (!map_chunk_header (this->map_data, this->map_size, itr->second, hch))
+								throw std::runtime_error ("chunk header out of bounds");
+							
+							inflate_sectors (&hch, this->map_data, this->map_size, data.data (),
+								HW_MAX_CHUNK_DATA);
+							break;
+						}
+				}
+				
+				// pick up whatever has been written since the last load
+				map_write_guard guard {&this->map_lock};
+				if (!this->index_ready)
+					this->ensure_index ();
+				if (this->map_stale)
+					this->remap ();
 			}
-		delete[] compressed;
 		
-		fill_chunk (ch, data);
-		delete[] data;
+		fill_chunk (ch, data.data ());
 		return true;
 	}
 	
@@ -1712,6 +2193,13 @@ namespace hCraft {
 	
 	unsigned char*
 	hw_provider::read_layer (const char *layer_name, unsigned int& data_size)
+	{
+		return this->read_layer (this->strm, layer_name, data_size);
+	}
+	
+	unsigned char*
+	hw_provider::read_layer (std::istream& in, const char *layer_name,
+		unsigned int& data_size)
 	{
 		int ly_index = -1;
 		for (size_t i = 0; i < this->layers.size (); ++i)
@@ -1727,7 +2215,7 @@ namespace hCraft {
 		unsigned char *data = new unsigned char [this->layers[ly_index].size];
 		
 		hw_layer &ly = this->layers[ly_index];
-		binary_reader reader {this->strm};
+		binary_reader reader {in};
 		
 		int page_index = 0;
 		unsigned int left = ly.size;
@@ -1749,6 +2237,13 @@ namespace hCraft {
 					}
 			}
 		
+		if (!in)
+			{
+				delete[] data;
+				data_size = 0;
+				return nullptr;
+			}
+		
 		data_size = read;
 		return data;
 	}
@@ -2088,5 +2583,211 @@ namespace hCraft {
 		
 		delete[] data;
 	}
+	
+	
+	
+//----
+	
+	/* 
+	 * Interleaves the bits of a chunk's coordinates, so that chunks that are
+	 * close to each other end up close to each other when sorted.
+	 */
+	static unsigned long long
+	morton_code (int x, int z)
+	{
+		unsigned long long code = 0;
+		unsigned int ux = (unsigned int)x ^ 0x80000000U;
+		unsigned int uz = (unsigned int)z ^ 0x80000000U;
+		for (int i = 0; i < 32; ++i)
+			{
+				code |= (unsigned long long)((ux >> i) & 1) << (2 * i);
+				code |= (unsigned long long)((uz >> i) & 1) << (2 * i + 1);
+			}
+		return code;
+	}
+	
+	/* 
+	 * Copies a chunk's compressed data out of the mapped world file.
+	 */
+	static bool
+	gather_sectors (const hw_chunk *hch, const unsigned char *map, size_t map_size,
+		std::vector<unsigned char>& out)
+	{
+		out.resize (hch->size);
+		unsigned int left = hch->size;
+		for (int sector_index = 0; left > 0; ++sector_index)
+			{
+				unsigned int need = (left >= 4096) ? 4096 : left;
+				size_t offset = (size_t)hch->sector_table[sector_index] * 512;
+				if ((sector_index >= 256) || ((offset + need) > map_size))
+					return false;
+				
+				std::memcpy (out.data () + (sector_index * 4096), map + offset, need);
+				left -= need;
+			}
+		return true;
+	}
+	
+	/* 
+	 * Rewrites the world file with all chunk tables first, followed by the
+	 * chunks' data in Morton (Z-order) order.
+	 */
+	bool
+	hw_provider::defragment (world &wr)
+	{
+		map_write_guard guard {&this->map_lock};
+		
+		this->ensure_index ();
+		if (this->strm.is_open ())
+			this->strm.close ();
+		this->remap ();
+		if (!this->map_data)
+			return true; // nothing saved yet
+		
+		std::vector<hw_chunk> chunks;
+		const unsigned char *map = this->map_data;
+		size_t map_size = this->map_size;
+		for (auto& p : this->chunk_index)
+			{
+				hw_chunk hch;
+				hch.x = (int)(p.first >> 32);
+				hch.z = (int)(p.first & 0xFFFFFFFFU);
+				if (!map_chunk_header (map, map_size, p.second, hch))
+					continue;
+				if ((hch.size <= 0) || (hch.size > HW_MAX_CHUNK_DATA))
+					continue;
+				
+				// drop chunks that point outside of the file
+				bool ok = true;
+				unsigned int left = hch.size;
+				for (int i = 0; left > 0; ++i)
+					{
+						unsigned int need = (left >= 4096) ? 4096 : left;
+						if (((size_t)hch.sector_table[i] * 512 + need) > map_size)
+							{ ok = false; break; }
+						left -= need;
+					}
+				if (ok)
+					chunks.push_back (hch);
+			}
+		std::sort (chunks.begin (), chunks.end (),
+			[] (const hw_chunk& a, const hw_chunk& b)
+				{ return morton_code (a.x, a.z) < morton_code (b.x, b.z); });
+		
+		// layers are carried over as they are, except for the free sector map,
+		// since there will not be any free sectors, and the chunk index, which
+		// is rebuilt.
+		std::vector<std::pair<std::string, std::vector<unsigned char>>> layer_data;
+		{
+			std::ifstream in (this->out_path, std::ios_base::in | std::ios_base::binary);
+			for (hw_layer& ly : this->layers)
+				{
+					if ((ly.name.compare (HW_FREE_SECTORS_LAYER) == 0)
+						|| (ly.name.compare (HW_CHUNK_INDEX_LAYER) == 0))
+						continue;
+					
+					unsigned int size;
+					unsigned char *data = this->read_layer (in, ly.name.c_str (), size);
+					if (!data)
+						continue;
+					if (size > 0)
+						layer_data.emplace_back (ly.name, std::vector<unsigned char> (data, data + size));
+					delete[] data;
+				}
+		}
+		
+		std::string tmp_path = this->out_path + ".defrag";
+		std::vector<hw_layer> old_layers;
+		old_layers.swap (this->layers);
+		std::unordered_map<unsigned long long, unsigned int> old_index;
+		old_index.swap (this->chunk_index);
+		std::unordered_map<unsigned int, std::vector<hw_slot>> old_cache;
+		old_cache.swap (this->table_cache);
+		
+		try
+			{
+				this->strm.open (tmp_path, std::ios_base::in | std::ios_base::out
+					| std::ios_base::binary | std::ios_base::trunc);
+				if (!this->strm)
+					throw std::runtime_error ("failed to create temporary world file");
+				
+				save_empty_imp (wr, this->strm);
+				binary_writer writer {this->strm};
+				
+				// chunk tables first...
+				std::vector<unsigned int> placed;
+				for (hw_chunk& hch : chunks)
+					placed.push_back (this->find_or_create_chunk (hch.x, hch.z, nullptr));
+				
+				// ...then all of the data, in the same order.
+				hw_sector_map no_free;
+				std::vector<unsigned char> data;
+				for (size_t i = 0; i < chunks.size (); ++i)
+					{
+						if ((placed[i] == 0xFFFFFFFFU) || !gather_sectors (&chunks[i], map, map_size, data))
+							continue;
+						
+						hw_chunk hch;
+						hch.x = chunks[i].x;
+						hch.z = chunks[i].z;
+						this->read_chunk_header (placed[i], hch);
+						write_in_sectors (&hch, data.data (), data.size (), no_free, writer);
+					}
+				
+				for (auto& ly : layer_data)
+					this->write_layer (ly.first.c_str (), ly.second.data (), ly.second.size ());
+				
+				world_information inf = this->inf;
+				inf.chunk_count = (int)this->chunk_index.size ();
+				{
+					std::vector<unsigned char> idx (4 + this->chunk_index.size () * 12);
+					unsigned int pos = 0;
+					pos += _write_int (idx.data () + pos, this->chunk_index.size ());
+					for (auto& p : this->chunk_index)
+						{
+							pos += _write_int (idx.data () + pos, (unsigned int)(p.first >> 32));
+							pos += _write_int (idx.data () + pos, (unsigned int)(p.first & 0xFFFFFFFFU));
+							pos += _write_int (idx.data () + pos, p.second);
+						}
+					this->write_layer (HW_CHUNK_INDEX_LAYER, idx.data (), idx.size ());
+				}
+				write_info (inf, writer);
+				
+				this->strm.flush ();
+				if (!this->strm)
+					throw std::runtime_error ("failed to write temporary world file");
+				this->strm.close ();
+				
+				if (std::rename (tmp_path.c_str (), this->out_path.c_str ()) != 0)
+					throw std::runtime_error ("failed to replace world file");
+				
+				this->inf.chunk_count = inf.chunk_count;
+			}
+		catch (const std::exception&)
+			{
+				if (this->strm.is_open ())
+					this->strm.close ();
+				std::remove (tmp_path.c_str ());
+				
+				for (hw_layer& ly : this->layers)
+					delete[] ly.offsets;
+				this->layers.swap (old_layers);
+				this->chunk_index.swap (old_index);
+				this->table_cache.swap (old_cache);
+				throw;
+			}
+		
+		for (hw_layer& ly : old_layers)
+			delete[] ly.offsets;
+		this->free_sectors.clear ();
+		this->free_dirty = false;
+		this->free_checked = true;
+		this->index_ready = true;
+		this->index_dirty = false;
+		this->count_dirty = false;
+		
+		// the old file is gone, the next load maps the new one.
+		this->unmap ();
+		return true;
+	}
 }
-
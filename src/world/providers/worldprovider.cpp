@@ -24,6 +24,7 @@
 #include <sys/stat.h>
 
 #include "world/providers/hwprovider.hpp"
+#include "world/providers/hwlprovider.hpp"
 
 #include <iostream> // DEBUG
 
@@ -34,6 +35,10 @@ namespace hCraft {
 	create_hw_provider (const char *path, const char *world_name)
 		{ return new hw_provider (path, world_name); }
 	
+	static world_provider*
+	create_hwl_provider (const char *path, const char *world_name)
+		{ return new hwl_provider (path, world_name); }
+	
 	/* 
 	 * Returns a new instance of the world provider named @{name}.
 	 * @{path} specifies the directory to which the world should be exported to\
@@ -45,6 +50,7 @@ namespace hCraft {
 	{
 		static std::unordered_map<std::string, world_provider* (*) (const char *, const char *)> creators {
 			{ "hw", create_hw_provider },
+			{ "hwl", create_hwl_provider },
 		};
 		
 		auto itr = creators.find (name);
@@ -67,6 +73,7 @@ namespace hCraft {
 		if (!populated)
 			{
 				provs.emplace_back (new hw_provider_naming ());
+				provs.emplace_back (new hwl_provider_naming ());
 				populated = true;
 			}
 		
@@ -105,11 +112,16 @@ namespace hCraft {
 	create_hw_prov_naming ()
 		{ return new hw_provider_naming (); }
 	
+	static world_provider_naming*
+	create_hwl_prov_naming ()
+		{ return new hwl_provider_naming (); }
+	
 	world_provider_naming*
 	world_provider_naming::create (const char *name)
 	{
 		static std::unordered_map<std::string, world_provider_naming* (*) ()> creators {
 			{ "hw", create_hw_prov_naming },
+			{ "hwl", create_hwl_prov_naming },
 		};
 		
 		auto itr = creators.find (name);
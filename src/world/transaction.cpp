@@ -0,0 +1,124 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "world/transaction.hpp"
+
+
+namespace hCraft {
+	
+	world_transaction::world_transaction (world &w)
+		: w (w)
+	{
+		this->inl_count = 0;
+	}
+	
+	
+	
+	const block_update*
+	world_transaction::find (int x, int y, int z) const
+	{
+		for (int i = this->size () - 1; i >= 0; --i)
+			{
+				const block_update &u = this->at (i);
+				if (u.x == x && u.y == y && u.z == z)
+					return &u;
+			}
+		
+		return nullptr;
+	}
+	
+	
+	
+	/* 
+	 * Stages an update to the block at the specified coordinates.
+	 */
+	void
+	world_transaction::set (int x, int y, int z, unsigned short id,
+		unsigned char meta, int extra, int data, void *ptr, player *pl, bool physics)
+	{
+		if (this->inl_count < inline_updates)
+			{
+				this->inl[this->inl_count ++] = block_update (x, y, z, id, meta,
+					extra, data, ptr, pl, physics);
+			}
+		else
+			this->overflow.emplace_back (x, y, z, id, meta, extra, data, ptr, pl, physics);
+	}
+	
+	
+	
+	/* 
+	 * Block queries that take staged updates into account.
+	 */
+	
+	block_data
+	world_transaction::get_block (int x, int y, int z)
+	{
+		const block_update *u = this->find (x, y, z);
+		if (!u)
+			return this->w.get_block (x, y, z);
+		
+		block_data bd = this->w.get_block (x, y, z);
+		bd.id = u->id;
+		bd.meta = u->meta;
+		bd.ex = u->extra;
+		return bd;
+	}
+	
+	unsigned short
+	world_transaction::get_id (int x, int y, int z)
+	{
+		const block_update *u = this->find (x, y, z);
+		if (!u)
+			return this->w.get_id (x, y, z);
+		return u->id;
+	}
+	
+	blocki
+	world_transaction::get_final_block (int x, int y, int z)
+	{
+		const block_update *u = this->find (x, y, z);
+		if (!u)
+			return this->w.get_final_block (x, y, z);
+		return blocki (u->id, u->meta, u->extra);
+	}
+	
+	
+	
+	/* 
+	 * Enqueues all staged updates into the world and resets the
+	 * transaction so that it can be reused.
+	 */
+	void
+	world_transaction::commit ()
+	{
+		this->w.queue_update (this);
+		this->clear ();
+	}
+	
+	/* 
+	 * Discards all staged updates.
+	 */
+	void
+	world_transaction::clear ()
+	{
+		this->inl_count = 0;
+		this->overflow.clear ();
+	}
+}
+
@@ -22,6 +22,8 @@
 #include "player/player.hpp"
 #include "system/packet.hpp"
 #include "system/logger.hpp"
+#include "physics/recorder.hpp"
+#include "world/transaction.hpp"
 #include <stdexcept>
 #include <cassert>
 #include <cstring>
@@ -86,6 +88,12 @@ namespace hCraft {
 		this->depth = 0;
 		
 		this->prov = provider;
+		this->disk_loads = 0;
+		this->reloads = 0;
+		this->pending_saves = 0;
+		this->autosave_running = false;
+		this->trickle_tokens = 0;
+		this->trickle_last = this->dirty_scan_last = std::chrono::steady_clock::now ();
 		this->edge_chunk = nullptr;
 		this->last_chunk = {0, 0, nullptr};
 		
@@ -99,9 +107,15 @@ namespace hCraft {
 		this->def_gm = GT_SURVIVAL;
 		
 		this->ph_state = PHY_OFF;
+		this->ph_recording = false;
 		//this->physics.set_thread_count (0);
+		this->ph_budget = srv.get_config ().ph_world_budget;
+		this->view_min = srv.get_config ().view_min;
+		this->view_max = srv.get_config ().view_max;
+		this->ph_max_pending = srv.get_config ().ph_world_max_pending;
 		
-		_init_sql_tables (this, srv);
+		if (!srv.is_headless ())
+			_init_sql_tables (this, srv);
 	}
 	
 	/* 
@@ -111,6 +125,7 @@ namespace hCraft {
 	{
 		this->srv.deregister_world (this);
 		this->srv.cgen.cancel_requests (this);
+		this->wait_for_saves ();
 		
 		this->stop ();
 		delete this->players;
@@ -233,6 +248,15 @@ namespace hCraft {
 			
 			this->srv.cgen.cancel_requests (this);
 			
+			// wait for loads that read from the provider without holding chunk_lock.
+			// no new ones can start while we hold it, and the ones in progress stop
+			// counting before they take it again.  they notice the reload and
+			// throw away what they have read.
+			while (this->disk_loads.load () > 0)
+				std::this_thread::yield ();
+			++ this->reloads;
+			this->wait_for_saves ();
+			
 			std::string prov_name = world_provider::determine ("data/worlds", name);
 			if (prov_name.empty ())
 				{
@@ -589,6 +613,9 @@ namespace hCraft {
 		int update_count;
 		dense_edit_stage pl_tr {this};
 		
+		// changes made by this thread are the result of other changes.
+		physics_recorder::suppressed = true;
+		
 		this->ticks = 0;
 		while (this->th_running)
 			{
@@ -638,9 +665,12 @@ namespace hCraft {
 							this->get_players ().populate (pl_vc);
 							
 							update_count = 0;
-							while (!this->updates.empty () && (update_count++ < block_update_cap))
+							bool in_unit = false;
+							while (!this->updates.empty () &&
+								(in_unit || (update_count++ < block_update_cap)))
 								{
 									block_update &u = this->updates.front ();
+									in_unit = u.more;
 									
 									if (((this->width > 0) && ((u.x >= this->width) || (u.x < 0))) ||
 										((this->depth > 0) && ((u.z >= this->depth) || (u.z < 0))) ||
@@ -769,6 +799,11 @@ namespace hCraft {
 				 */
 				this->lm.update (light_update_cap);
 				
+				/* 
+				 * Background saving of modified chunks.
+				 */
+				this->trickle_save ();
+				
 				std::this_thread::sleep_for (std::chrono::milliseconds (5));
 				if (!this->wtime_frozen && ((this->ticks % 10) == 0))
 					++ this->wtime;
@@ -834,27 +869,12 @@ namespace hCraft {
 	
 	
 	/* 
-	 * Saves all modified chunks to disk.
+	 * Writes world information, security settings, portals and zones.
+	 * The provider must be open, and portal_lock held.
 	 */
 	void
-	world::save_all ()
+	world::write_meta ()
 	{
-		if (this->prov == nullptr)
-			return;
-		
-		std::lock_guard<std::mutex> ch_guard {this->chunk_lock};
-		std::lock_guard<std::mutex> gen_guard {this->gen_lock};
-		std::lock_guard<std::mutex> ptl_guard {this->portal_lock};
-		std::lock_guard<std::mutex> ent_guard {this->entity_lock};
-		
-		if (this->chunks.empty ())
-			{
-				this->prov->save_empty (*this);
-				return;
-			}
-		
-		this->prov->open (*this);
-		
 		// meta
 		world_information inf = this->prov->info ();
 		this->get_information (inf);
@@ -868,7 +888,128 @@ namespace hCraft {
 		
 		// zones
 		this->prov->save_zones (*this, this->zman.get_all ());
+	}
+	
+	/* 
+	 * Saves all modified chunks to disk.
+	 */
+	void
+	world::save_all ()
+	{
+		if (this->prov == nullptr)
+			return;
+		
+		// counts as a pending save until it is done writing, so that background
+		// saves can neither run alongside it nor write older copies of chunks
+		// over the ones written here.
+		std::lock_guard<std::mutex> ch_guard {this->chunk_lock};
+		{
+			std::unique_lock<std::mutex> guard {this->save_lock};
+			this->save_cv.wait (guard, [this] { return this->pending_saves == 0; });
+			++ this->pending_saves;
+		}
 		
+		try
+			{
+				std::lock_guard<std::mutex> gen_guard {this->gen_lock};
+				std::lock_guard<std::mutex> ptl_guard {this->portal_lock};
+				std::lock_guard<std::mutex> ent_guard {this->entity_lock};
+				
+				if (this->chunks.empty ())
+					this->prov->save_empty (*this);
+				else
+					{
+						this->prov->open (*this);
+						this->write_meta ();
+						
+						for (auto itr = this->chunks.begin (); itr != this->chunks.end (); ++itr)
+							{
+								chunk *ch = itr->second;
+								if (ch->modified)
+									{
+										int x, z;
+										chunk_coords (itr->first, &x, &z);
+										this->prov->save (*this, ch, x, z);
+										ch->modified = false;
+									}
+							}
+						this->prov->close ();
+					}
+			}
+		catch (...)
+			{
+				{
+					std::lock_guard<std::mutex> guard {this->save_lock};
+					this->end_save_nolock ();
+				}
+				this->save_cv.notify_all ();
+				throw;
+			}
+		
+		{
+			std::lock_guard<std::mutex> guard {this->save_lock};
+			this->end_save_nolock ();
+		}
+		this->save_cv.notify_all ();
+	}
+	
+	
+	
+	struct world::async_save
+	{
+		struct entry
+		{
+			int x, z;
+			chunk *ch; // snapshot, null once compressed
+			std::vector<unsigned char> data;
+		};
+		
+		world *w;
+		std::vector<entry> chunks;
+		std::atomic<size_t> next;
+		std::atomic<int> tasks_left;
+		std::chrono::steady_clock::time_point started;
+		bool trickle; // started by trickle_save ()
+	};
+	
+	// maximum number of pool threads a background save compresses chunks on,
+	// the rest are left to handle packets.
+	static const int save_max_tasks = 3;
+	
+	/* 
+	 * Saves all modified chunks to disk in the background.  The world's
+	 * locks are only held while copies of the modified chunks are taken;
+	 * compression and I/O happen on the server's thread pool.  Returns false
+	 * if a previous background save of this world is still running.
+	 */
+	bool
+	world::save_all_async ()
+	{
+		if (this->prov == nullptr)
+			return true;
+		
+		// the save has to be registered while chunk_lock is held (see
+		// pending_saves).
+		std::unique_lock<std::mutex> ch_guard {this->chunk_lock};
+		{
+			std::unique_lock<std::mutex> guard {this->save_lock};
+			if (this->autosave_running)
+				return false;
+			
+			// trickle saves only ever hold a handful of chunks, so wait for the
+			// current one (if any) rather than failing.
+			this->save_cv.wait (guard, [this] { return this->pending_saves == 0; });
+			this->autosave_running = true;
+			++ this->pending_saves;
+		}
+		
+		async_save *job = new async_save ();
+		job->w = this;
+		job->next = 0;
+		job->started = std::chrono::steady_clock::now ();
+		job->trickle = false;
+		
+		bool empty = this->chunks.empty ();
 		for (auto itr = this->chunks.begin (); itr != this->chunks.end (); ++itr)
 			{
 				chunk *ch = itr->second;
@@ -876,14 +1017,321 @@ namespace hCraft {
 					{
 						int x, z;
 						chunk_coords (itr->first, &x, &z);
-						this->prov->save (*this, ch, x, z);
+						job->chunks.push_back ({x, z, ch->snapshot (), {}});
 						ch->modified = false;
 					}
 			}
+		
+		// world information, portals and zones are small enough to be written
+		// out right away.
+		{
+			std::lock_guard<std::mutex> ptl_guard {this->portal_lock};
+			std::lock_guard<std::mutex> guard {this->save_lock};
+			try
+				{
+					if (empty)
+						this->prov->save_empty (*this);
+					else
+						{
+							this->prov->open (*this);
+							this->write_meta ();
+							this->prov->close ();
+						}
+				}
+			catch (const std::exception& ex)
+				{
+					this->log (LT_ERROR) << "World \"" << this->name
+						<< "\": failed to save world information: " << ex.what () << std::endl;
+				}
+		}
+		ch_guard.unlock ();
+		
+		if (job->chunks.empty ())
+			{
+				this->finish_async_save (job);
+				return true;
+			}
+		
+		int tasks = (job->chunks.size () + 15) / 16;
+		if (tasks > save_max_tasks)
+			tasks = save_max_tasks;
+		job->tasks_left = tasks;
+		for (int i = 0; i < tasks; ++i)
+			this->srv.get_thread_pool ().enqueue (&world::compress_save_batch, job);
+		return true;
+	}
+	
+	/* 
+	 * Compresses chunk snapshots until there are none left.  The last task to
+	 * finish writes everything out.
+	 */
+	void
+	world::compress_save_batch (void *ptr)
+	{
+		async_save *job = static_cast<async_save *> (ptr);
+		world_provider *prov = job->w->prov;
+		
+		for (;;)
+			{
+				size_t i = job->next++;
+				if (i >= job->chunks.size ())
+					break;
+				
+				async_save::entry& e = job->chunks[i];
+				try
+					{
+						if (prov->prepare_save (e.ch, e.data))
+							{
+								delete e.ch;
+								e.ch = nullptr;
+							}
+					}
+				catch (const std::exception&)
+					{
+						// leave it to save ()
+					}
+			}
+		
+		if (-- job->tasks_left == 0)
+			job->w->finish_async_save (job);
+	}
+	
+	void
+	world::finish_async_save (async_save *job)
+	{
+		int failed = 0;
+		long long bytes = 0;
+		{
+			std::lock_guard<std::mutex> guard {this->save_lock};
+			if (!job->chunks.empty ())
+				{
+					this->prov->open (*this);
+					for (async_save::entry& e : job->chunks)
+						{
+							try
+								{
+									if (e.ch)
+										{
+											this->prov->save (*this, e.ch, e.x, e.z);
+											bytes += 16 * 1024; // rough guess
+										}
+									else
+										{
+											this->prov->save_prepared (*this, e.data, e.x, e.z);
+											bytes += e.data.size ();
+										}
+								}
+							catch (const std::exception&)
+								{
+									++ failed;
+								}
+							
+							delete e.ch;
+							e.ch = nullptr;
+						}
+					this->prov->close ();
+				}
+			
+			this->end_save_nolock ();
+			if (!job->trickle)
+				this->autosave_running = false;
+		}
+		this->save_cv.notify_all ();
+		
+		if (job->trickle)
+			{
+				this->trickle_tokens -= bytes;
+				if (failed > 0)
+					this->log (LT_ERROR) << "World \"" << this->name << "\": failed to save "
+						<< failed << " chunks" << std::endl;
+			}
+		else if (!job->chunks.empty ())
+			{
+				int ms = std::chrono::duration_cast<std::chrono::milliseconds> (
+					std::chrono::steady_clock::now () - job->started).count ();
+				this->log (LT_SYSTEM) << "World \"" << this->name << "\": saved "
+					<< (job->chunks.size () - failed) << " chunks in the background ("
+					<< ms << "ms)" << std::endl;
+				if (failed > 0)
+					this->log (LT_ERROR) << "World \"" << this->name << "\": failed to save "
+						<< failed << " chunks" << std::endl;
+			}
+		
+		delete job;
+	}
+	
+	/* 
+	 * Called by the world's thread.  Queues chunks that have been modified
+	 * since they were last saved, and writes a few of the oldest ones out
+	 * on the server's thread pool, within the configured budget.
+	 */
+	void
+	world::trickle_save ()
+	{
+		const server_config& cfg = this->srv.get_config ();
+		if (this->prov == nullptr || cfg.save_chunks_per_tick <= 0)
+			return;
+		
+		auto now = std::chrono::steady_clock::now ();
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds> (
+			now - this->trickle_last).count ();
+		if (elapsed < 50)
+			return;
+		this->trickle_last = now;
+		
+		// refill the byte budget, allowing for a small burst.
+		long long cap = (long long)cfg.save_bytes_per_tick * 4;
+		long long tokens = this->trickle_tokens + cfg.save_bytes_per_tick;
+		this->trickle_tokens = (tokens > cap) ? cap : tokens;
+		
+		// look for newly modified chunks about once a second.
+		std::lock_guard<std::mutex> ch_guard {this->chunk_lock};
+		if (now - this->dirty_scan_last >= std::chrono::seconds (1))
+			{
+				this->dirty_scan_last = now;
+				for (auto itr = this->chunks.begin (); itr != this->chunks.end (); ++itr)
+					if (itr->second->modified && this->dirty_keys.insert (itr->first).second)
+						this->dirty_queue.push_back ({itr->first, now});
+			}
+		
+		if (this->dirty_queue.empty () || this->trickle_tokens <= 0)
+			return;
+		
+		{
+			std::lock_guard<std::mutex> guard {this->save_lock};
+			if (this->pending_saves > 0 || this->autosave_running)
+				return;
+			++ this->pending_saves;
+		}
+		
+		async_save *job = new async_save ();
+		job->w = this;
+		job->next = 0;
+		job->started = now;
+		job->trickle = true;
+		
+		// chunks that have been dirty for too long are written out faster.
+		int budget = cfg.save_chunks_per_tick;
+		if (now - this->dirty_queue.front ().since > std::chrono::seconds (cfg.save_max_dirty_age))
+			budget *= 4;
+		
+		while (!this->dirty_queue.empty () && (int)job->chunks.size () < budget)
+			{
+				unsigned long long key = this->dirty_queue.front ().key;
+				this->dirty_queue.pop_front ();
+				this->dirty_keys.erase (key);
+				
+				// unloaded, or saved by a full save in the meantime.
+				auto itr = this->chunks.find (key);
+				if (itr == this->chunks.end () || !itr->second->modified)
+					continue;
+				
+				int x, z;
+				chunk_coords (key, &x, &z);
+				job->chunks.push_back ({x, z, itr->second->snapshot (), {}});
+				itr->second->modified = false;
+			}
+		
+		if (job->chunks.empty ())
+			{
+				this->finish_async_save (job);
+				return;
+			}
+		
+		job->tasks_left = 1;
+		this->srv.get_thread_pool ().enqueue (&world::compress_save_batch, job);
+	}
+	
+	/* 
+	 * Blocks until all background saves of this world have finished.
+	 */
+	void
+	world::wait_for_saves ()
+	{
+		std::unique_lock<std::mutex> guard {this->save_lock};
+		this->save_cv.wait (guard, [this] { return this->pending_saves == 0; });
+	}
+	
+	/* 
+	 * Ends a pending save, writing out the chunks that were unloaded while it
+	 * was in progress if it was the last one.  save_lock must be held; the
+	 * caller notifies save_cv once it is released.
+	 */
+	void
+	world::end_save_nolock ()
+	{
+		if (-- this->pending_saves > 0 || this->unload_queue.empty ())
+			return;
+		
+		int failed = 0;
+		this->prov->open (*this);
+		for (auto& p : this->unload_queue)
+			{
+				int x, z;
+				chunk_coords (p.first, &x, &z);
+				try
+					{
+						this->prov->save (*this, p.second, x, z);
+					}
+				catch (const std::exception&)
+					{
+						++ failed;
+					}
+				delete p.second;
+			}
+		this->unload_queue.clear ();
 		this->prov->close ();
+		
+		if (failed > 0)
+			this->log (LT_ERROR) << "World \"" << this->name << "\": failed to save "
+				<< failed << " unloaded chunks" << std::endl;
 	}
 	
 	/* 
+	 * Has the world's provider rewrite the world file so that chunks are
+	 * stored in spatial order.  Saves are held off until it is done.
+	 */
+	bool
+	world::defragment ()
+	{
+		if (this->prov == nullptr)
+			return false;
+		
+		// counts as a pending save, so that other saves stay away until it is
+		// done.  like every other save, it is registered under chunk_lock (which
+		// also lets a save_all () that is already running finish first), but
+		// does not hold on to it while the file is being rewritten.
+		{
+			std::lock_guard<std::mutex> ch_guard {this->chunk_lock};
+			std::unique_lock<std::mutex> guard {this->save_lock};
+			this->save_cv.wait (guard, [this] { return this->pending_saves == 0; });
+			++ this->pending_saves;
+		}
+		
+		bool done;
+		try
+			{
+				done = this->prov->defragment (*this);
+			}
+		catch (const std::exception&)
+			{
+				{
+					std::lock_guard<std::mutex> guard {this->save_lock};
+					this->end_save_nolock ();
+				}
+				this->save_cv.notify_all ();
+				throw;
+			}
+		
+		{
+			std::lock_guard<std::mutex> guard {this->save_lock};
+			this->end_save_nolock ();
+		}
+		this->save_cv.notify_all ();
+		return done;
+	}
+	
+		/* 
 	 * Saves metadata to disk (width, depth, spawn pos, etc...).
 	 */
 	void
@@ -894,6 +1342,7 @@ namespace hCraft {
 		
 		// we're not modifying any chunks, but we'll still take ahold of this lock...
 		std::lock_guard<std::mutex> guard {this->chunk_lock};
+		this->wait_for_saves ();
 		
 		this->prov->open (*this);
 		
@@ -1100,29 +1549,108 @@ namespace hCraft {
 		if (ch && ch->generated) return ch;
 		else if (!ch)
 			{
+				{
+					// unloaded while a save was in progress, and not written out yet.
+					std::lock_guard<std::mutex> sv_guard {this->save_lock};
+					auto itr = this->unload_queue.find (chunk_key (x, z));
+					if (itr != this->unload_queue.end ())
+						{
+							ch = itr->second;
+							this->unload_queue.erase (itr);
+						}
+				}
+				if (ch && !ch->generated)
+					{
+						delete ch;
+						ch = nullptr;
+					}
+				else if (ch)
+					{
+						ch->modified = true; // still has to be saved
+						ch->recalc_heightmap ();
+						this->put_chunk_nolock (x, z, ch);
+						return ch;
+					}
+				
 				ch = new chunk ();
 				
-				// try to load from disk
-				{
-					std::unique_lock<std::mutex> gen_guard {this->gen_lock, std::defer_lock};
-					if (lock)
-						gen_guard.lock ();
-					
-					this->prov->open (*this);
-					if (this->prov->load (*this, ch, x, z))
+				if (lock && this->prov->concurrent_loads ())
+					{
+						// read from disk without holding any of the world's locks, so that
+						// loads from several threads can run in parallel.
+						++ this->disk_loads;
+						unsigned int reloads = this->reloads;
+						ch_guard.unlock ();
+						
+						bool loaded;
+						try
+							{
+								loaded = this->prov->load (*this, ch, x, z);
+							}
+						catch (...)
+							{
+								-- this->disk_loads;
+								delete ch;
+								throw;
+							}
+						
+						// done with the provider.  this must happen before chunk_lock is
+						// taken again, since reload_world () waits for it while holding it.
+						-- this->disk_loads;
+						
+						loaded = loaded && ch->generated;
+						if (loaded)
+							ch->recalc_heightmap ();
+						
+						ch_guard.lock ();
+						if (this->reloads != reloads)
+							{
+								// read from the world that was there before
+								delete ch;
+								ch_guard.unlock ();
+								return this->load_chunk_nolock (x, z, true);
+							}
+						
+						chunk *other = this->get_chunk_nolock (x, z);
+						if (other)
+							{
+								// someone else got there first
+								delete ch;
+								ch = other;
+								if (ch->generated)
+									return ch;
+							}
+						else
+							{
+								this->put_chunk_nolock (x, z, ch);
+								if (loaded)
+									return ch;
+							}
+					}
+				else
+					{
+						// try to load from disk
 						{
-							if (ch->generated)
+							std::unique_lock<std::mutex> gen_guard {this->gen_lock, std::defer_lock};
+							if (lock)
+								gen_guard.lock ();
+							
+							this->prov->open (*this);
+							if (this->prov->load (*this, ch, x, z))
 								{
-									ch->recalc_heightmap ();
-									this->prov->close ();
-									this->put_chunk_nolock (x, z, ch);
-									return ch;
+									if (ch->generated)
+										{
+											ch->recalc_heightmap ();
+											this->prov->close ();
+											this->put_chunk_nolock (x, z, ch);
+											return ch;
+										}
 								}
+							this->prov->close ();
 						}
-					this->prov->close ();
-				}
-				
-				this->put_chunk_nolock (x, z, ch);
+						
+						this->put_chunk_nolock (x, z, ch);
+					}
 			}
 		
 		if (lock)
@@ -1156,9 +1684,22 @@ namespace hCraft {
 				
 				if (save)
 					{
-						this->prov->open (*this);
-						this->prov->save (*this, ch, x, z);
-						this->prov->close ();
+						std::lock_guard<std::mutex> sv_guard {this->save_lock};
+						if (this->pending_saves > 0)
+							{
+								// a save is in progress, and it might hold an older copy of
+								// this chunk.  have a copy written out after it instead of
+								// waiting for it.
+								chunk *&queued = this->unload_queue[key];
+								delete queued;
+								queued = ch->snapshot ();
+							}
+						else
+							{
+								this->prov->open (*this);
+								this->prov->save (*this, ch, x, z);
+								this->prov->close ();
+							}
 					}
 				
 				this->chunks.erase (itr);
@@ -1177,12 +1718,14 @@ namespace hCraft {
 	world::clear_chunks (bool save, bool del)
 	{
 		std::lock_guard<std::mutex> guard {this->chunk_lock};
+		this->wait_for_saves ();
 		
 		if (save)
 			this->prov->open (*this);
 		else if (del)
 			{
-				std::remove (this->get_path ());
+				this->prov->clear (*this);
+				++ this->reloads; // drop what lock-free loads have read
 			}
 		
 		for (auto itr = this->chunks.begin (); itr != this->chunks.end (); ++itr)
@@ -1257,27 +1800,11 @@ namespace hCraft {
 		
 		// spawn entity to players
 		chunk_pos cpos = e->pos;
-		int cx, cz;
-		for (cx = (cpos.x - player::chunk_radius ());
-				 cx <= (cpos.x + player::chunk_radius ()); ++cx)
-			{
-				for (cz = (cpos.z - player::chunk_radius ());
-						 cz <= (cpos.z + player::chunk_radius ()); ++cz)
-					{
-						chunk *och = this->get_chunk (cx, cz);
-						if (!och) continue;
-						
-						entity *e_this = e;
-						och->all_entities ([e_this] (entity *e)
-							{
-								if (e->get_type () == ET_PLAYER)
-									{
-										player *pl = dynamic_cast<player *> (e);
-										e_this->spawn_to (pl);
-									}
-							});
-					}
-			}
+		this->interest.observers (cpos.x, cpos.z,
+			[e] (player *pl)
+				{
+					e->spawn_to (pl);
+				});
 	  
 	  // physics
 		this->srv.global_physics.queue_physics (this, e->get_eid ());
@@ -1297,27 +1824,11 @@ namespace hCraft {
 		
 		// despawn from players
 		chunk_pos cpos = e->pos;
-		int cx, cz;
-		for (cx = (cpos.x - player::chunk_radius ());
-				 cx <= (cpos.x + player::chunk_radius ()); ++cx)
-			{
-				for (cz = (cpos.z - player::chunk_radius ());
-						 cz <= (cpos.z + player::chunk_radius ()); ++cz)
-					{
-						chunk *och = this->get_chunk (cx, cz);
-						if (!och) continue;
-						
-						entity *e_this = e;
-						och->all_entities ([e_this] (entity *e)
-							{
-								if (e->get_type () == ET_PLAYER)
-									{
-										player *pl = dynamic_cast<player *> (e);
-										e_this->despawn_from (pl);
-									}
-							});
-					}
-			}
+		this->interest.observers (cpos.x, cpos.z,
+			[e] (player *pl)
+				{
+					e->despawn_from (pl);
+				});
 		delete e;
 		
 		auto ret_itr = this->entities.erase (itr);
@@ -1546,20 +2057,71 @@ namespace hCraft {
 					id, meta, (unsigned char)extra, std::time (nullptr)});
 				
 				// update players
+				packet *pack = packets::play::make_block_change (x, y, z, id, meta);
 				this->get_players ().all (
-					[x, y, z, id, meta] (player *pl)
+					[pack] (player *pl)
 						{
-							pl->send (packets::play::make_block_change (x, y, z, id, meta));
+							pl->send (pack->share ());
 						});
+				packet::release (pack);
 				return;
 			}
 		
 		this->updates.emplace_back (x, y, z, id, meta, extra, data, ptr, pl, physics);
 		
+		auto rec = this->active_recorder ();
+		if (rec)
+			rec->record_update (x, y, z, id, meta, extra, data, physics);
+		
 		std::lock_guard<std::mutex> estage_guard {this->estage_lock};
 		this->estage.set (x, y, z, id, meta, extra);
 	}
 	
+	/* 
+	 * Enqueues all updates staged in the specified transaction at once.
+	 * The world thread applies them within a single tick.
+	 */
+	void
+	world::queue_update (world_transaction *tr)
+	{
+		if (tr->empty ()) return;
+		
+		std::lock_guard<std::mutex> guard {this->update_lock};
+		int count = tr->size ();
+		if (this->typ == WT_LIGHT)
+			{
+				for (int i = 0; i < count; ++i)
+					{
+						block_update &u = tr->at (i);
+						this->queue_update_nolock (u.x, u.y, u.z, u.id, u.meta, u.extra,
+							u.data, u.ptr, u.pl, u.physics);
+					}
+				return;
+			}
+		
+		auto rec = this->active_recorder ();
+		block_update *last = nullptr;
+		
+		std::lock_guard<std::mutex> estage_guard {this->estage_lock};
+		for (int i = 0; i < count; ++i)
+			{
+				block_update &u = tr->at (i);
+				if (!this->in_bounds (u.x, u.y, u.z)) continue;
+				
+				this->updates.push_back (u);
+				last = &this->updates.back ();
+				last->more = true;
+				
+				if (rec)
+					rec->record_update (u.x, u.y, u.z, u.id, u.meta, u.extra, u.data,
+						u.physics);
+				this->estage.set (u.x, u.y, u.z, u.id, u.meta, u.extra);
+			}
+		
+		if (last)
+			last->more = false;
+	}
+	
 	void
 	world::queue_physics (int x, int y, int z, int extra, void *ptr,
 		int tick_delay, physics_params *params, physics_block_callback cb)
@@ -1568,10 +2130,11 @@ namespace hCraft {
 		if (this->ph_state == PHY_OFF) return;
 		if (this->typ == WT_LIGHT) return;
 		
-		if (this->physics.get_thread_count () == 0)
-			this->srv.global_physics.queue_physics (this, x, y, z, extra, tick_delay, params, cb);
-		else
-			this->physics.queue_physics (this, x, y, z, extra, tick_delay, params, cb);
+		auto rec = this->active_recorder ();
+		if (rec)
+			rec->record_physics (x, y, z, extra, tick_delay, params, cb, false);
+		
+		this->get_physics_manager ().queue_physics (this, x, y, z, extra, tick_delay, params, cb);
 	}
 	
 	void
@@ -1582,10 +2145,11 @@ namespace hCraft {
 		if (this->ph_state == PHY_OFF) return;
 		if (this->typ == WT_LIGHT) return;
 		
-		if (this->physics.get_thread_count () == 0)
-			this->srv.global_physics.queue_physics_once (this, x, y, z, extra, tick_delay, params, cb);
-		else
-			this->physics.queue_physics_once (this, x, y, z, extra, tick_delay, params, cb);
+		auto rec = this->active_recorder ();
+		if (rec)
+			rec->record_physics (x, y, z, extra, tick_delay, params, cb, true);
+		
+		this->get_physics_manager ().queue_physics_once (this, x, y, z, extra, tick_delay, params, cb);
 	}
 	
 	
@@ -1614,6 +2178,66 @@ namespace hCraft {
 		this->ph_state = PHY_PAUSED;
 	}
 	
+	/* 
+	 * Returns the manager that handles this world's physics: either the
+	 * world's own, or the server's global one if the former has no threads.
+	 */
+	physics_manager&
+	world::get_physics_manager ()
+	{
+		if (this->physics.get_thread_count () == 0)
+			return this->srv.global_physics;
+		return this->physics;
+	}
+	
+	
+	
+	/* 
+	 * Starts recording all block changes and physics updates fed into this
+	 * world from the outside, after taking a snapshot of the chunks within
+	 * @{radius} chunks of the given chunk coordinates.
+	 * Returns false if the world is already being recorded.
+	 */
+	bool
+	world::start_recording (int cx, int cz, int radius)
+	{
+		// no updates must slip in between the snapshot and the start of the
+		// recording.
+		std::lock_guard<std::mutex> guard {this->update_lock};
+		if (this->ph_recording.load ())
+			return false;
+		
+		std::shared_ptr<physics_recorder> rec (new physics_recorder (*this, cx, cz, radius));
+		std::atomic_store (&this->ph_rec, rec);
+		this->ph_recording = true;
+		return true;
+	}
+	
+	/* 
+	 * Stops the current recording and returns the recorder (or null if the
+	 * world was not being recorded).
+	 */
+	std::shared_ptr<physics_recorder>
+	world::stop_recording ()
+	{
+		std::lock_guard<std::mutex> guard {this->update_lock};
+		this->ph_recording = false;
+		return std::atomic_exchange (&this->ph_rec, std::shared_ptr<physics_recorder> ());
+	}
+	
+	/* 
+	 * Returns the active recorder if changes made by the calling thread
+	 * should be recorded, and null otherwise.
+	 */
+	std::shared_ptr<physics_recorder>
+	world::active_recorder ()
+	{
+		if (!this->ph_recording.load (std::memory_order_relaxed)
+			|| physics_recorder::suppressed)
+			return std::shared_ptr<physics_recorder> ();
+		return std::atomic_load (&this->ph_rec);
+	}
+	
 	
 	
 //-----
@@ -0,0 +1,211 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* 
+ * iobench - measures how fast world providers save and load chunks.
+ * 
+ * Every pass saves the same set of chunks (with a few blocks changed each
+ * time, like an autosave would) through each provider, followed by loading
+ * all of them back.
+ * 
+ * Usage: iobench [-n chunks] [-p passes] [provider...]
+ */
+
+#include "system/server.hpp"
+#include "system/logger.hpp"
+#include "world/world.hpp"
+#include "world/chunk.hpp"
+#include "world/providers/worldprovider.hpp"
+#include "slot/blocks.hpp"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <sys/stat.h>
+
+
+static void
+print_usage (const char *prog)
+{
+	std::cout << "Usage: " << prog << " [-n chunks] [-p passes] [provider...]" << std::endl;
+	std::cout << "Providers default to: hw hwl" << std::endl;
+}
+
+/* 
+ * Stone up to y = 60 with some ores and caves mixed in, so that chunks
+ * compress roughly as well as generated terrain does.
+ */
+static hCraft::chunk*
+make_chunk (std::minstd_rand& rnd)
+{
+	hCraft::chunk *ch = new hCraft::chunk ();
+	for (int x = 0; x < 16; ++x)
+		for (int z = 0; z < 16; ++z)
+			{
+				int top = 56 + (rnd () % 5);
+				for (int y = 0; y <= top; ++y)
+					{
+						int r = rnd () % 100;
+						if (r < 3)
+							continue; // cave
+						else if (r < 5)
+							ch->set_id (x, y, z, hCraft::BT_COAL_ORE);
+						else if (r < 6)
+							ch->set_id (x, y, z, hCraft::BT_IRON_ORE);
+						else
+							ch->set_id (x, y, z, (y == top) ? hCraft::BT_GRASS : hCraft::BT_STONE);
+					}
+			}
+	ch->recalc_heightmap ();
+	return ch;
+}
+
+static void
+touch_chunk (hCraft::chunk *ch, std::minstd_rand& rnd)
+{
+	for (int i = 0; i < 16; ++i)
+		ch->set_id (rnd () % 16, 40 + (rnd () % 16), rnd () % 16, hCraft::BT_COBBLE);
+}
+
+static int
+side_of (int count)
+{
+	int side = 1;
+	while (side * side < count)
+		++ side;
+	return side;
+}
+
+
+int
+main (int argc, char *argv[])
+{
+	int count = 1024;
+	int passes = 3;
+	std::vector<std::string> provs;
+	
+	for (int i = 1; i < argc; ++i)
+		{
+			if ((std::strcmp (argv[i], "-n") == 0) && (i + 1 < argc))
+				count = std::atoi (argv[++i]);
+			else if ((std::strcmp (argv[i], "-p") == 0) && (i + 1 < argc))
+				passes = std::atoi (argv[++i]);
+			else if (argv[i][0] != '-')
+				provs.push_back (argv[i]);
+			else
+				{ print_usage (argv[0]); return -1; }
+		}
+	if (count < 1 || passes < 1)
+		{ print_usage (argv[0]); return -1; }
+	if (provs.empty ())
+		{
+			provs.push_back ("hw");
+			provs.push_back ("hwl");
+		}
+	
+	// start from scratch every time
+	if (std::system ("rm -rf data/iobench") != 0)
+		return -1;
+	mkdir ("data", 0744);
+	mkdir ("data/iobench", 0744);
+	
+	hCraft::logger log;
+	hCraft::server srv (log);
+	srv.start_headless ();
+	
+	std::minstd_rand rnd (1234);
+	std::vector<hCraft::chunk *> chunks;
+	for (int i = 0; i < count; ++i)
+		chunks.push_back (make_chunk (rnd));
+	int side = side_of (count);
+	
+	std::cout << std::fixed << std::setprecision (2);
+	std::cout << "Saving " << count << " chunks, " << passes << " pass(es)" << std::endl;
+	for (const std::string& name : provs)
+		{
+			hCraft::world_provider *prov = hCraft::world_provider::create (name.c_str (),
+				"data/iobench", name.c_str ());
+			if (!prov)
+				{
+					std::cerr << "iobench: unknown provider: " << name << std::endl;
+					continue;
+				}
+			
+			hCraft::world *w = new hCraft::world (hCraft::WT_LIGHT, srv, name.c_str (), log,
+				hCraft::world_generator::create ("empty"), prov);
+			prov->save_empty (*w);
+			
+			std::minstd_rand touch_rnd (5678);
+			for (int pass = 1; pass <= passes; ++pass)
+				{
+					if (pass > 1)
+						for (hCraft::chunk *ch : chunks)
+							touch_chunk (ch, touch_rnd);
+					
+					// compression is left out, since it costs the same for all providers
+					std::vector<std::vector<unsigned char>> data (count);
+					bool prepared = true;
+					unsigned long long bytes = 0;
+					for (int i = 0; i < count; ++i)
+						{
+							prepared = prepared && prov->prepare_save (chunks[i], data[i]);
+							bytes += data[i].size ();
+						}
+					
+					auto start = std::chrono::steady_clock::now ();
+					prov->open (*w);
+					for (int i = 0; i < count; ++i)
+						{
+							if (prepared)
+								prov->save_prepared (*w, data[i], i % side, i / side);
+							else
+								prov->save (*w, chunks[i], i % side, i / side);
+						}
+					prov->close ();
+					std::chrono::duration<double> elapsed = std::chrono::steady_clock::now () - start;
+					
+					std::cout << std::setw (4) << name << "  save #" << pass << ": "
+						<< std::setw (8) << elapsed.count () * 1000.0 << "ms  "
+						<< std::setw (9) << (count / elapsed.count ()) << " chunks/s  "
+						<< std::setw (7) << (bytes / elapsed.count () / (1024.0 * 1024.0)) << " MB/s"
+						<< std::endl;
+				}
+			
+			hCraft::chunk tmp;
+			auto start = std::chrono::steady_clock::now ();
+			int loaded = 0;
+			for (int i = 0; i < count; ++i)
+				if (prov->load (*w, &tmp, i % side, i / side))
+					++ loaded;
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now () - start;
+			std::cout << std::setw (4) << name << "  load:    "
+				<< std::setw (8) << elapsed.count () * 1000.0 << "ms  "
+				<< std::setw (9) << (loaded / elapsed.count ()) << " chunks/s  ("
+				<< loaded << " loaded)" << std::endl;
+			
+			delete w;
+		}
+	
+	for (hCraft::chunk *ch : chunks)
+		delete ch;
+	return 0;
+}
@@ -0,0 +1,164 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* 
+ * netbench - measures the per-packet cost of the network path's
+ * stream encryption (AES/CFB8), comparing the old filter pipeline against
+ * ProcessData () on a reused buffer.
+ * 
+ * Usage: netbench [-n packets-per-size]
+ */
+
+#include <cryptopp/aes.h>
+#include <cryptopp/modes.h>
+#include <cryptopp/filters.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+
+typedef CryptoPP::CFB_Mode<CryptoPP::AES>::Encryption encryptor_t;
+
+// packet sizes typical of the protocol: keep alives, player movement,
+// chat messages, multi block changes and compressed chunks.
+static const unsigned int packet_sizes[] = { 6, 42, 180, 1200, 9000 };
+
+
+static void
+print_usage (const char *prog)
+{
+	std::cout << "Usage: " << prog << " [-n packets-per-size]" << std::endl;
+}
+
+
+/* 
+ * The way packets used to be encrypted: copy into a string, run it through
+ * a StreamTransformationFilter into another string, and copy the result
+ * back into the packet.
+ */
+static void
+encrypt_pipeline (encryptor_t& enc, unsigned char *data, unsigned int size)
+{
+	std::string src ((const char *)data, (int)size);
+	std::string tar;
+	
+	CryptoPP::StringSource (src, true,
+		new CryptoPP::StreamTransformationFilter (enc,
+			new CryptoPP::StringSink (tar)));
+	
+	std::memcpy (data, tar.data (), tar.size ());
+}
+
+/* 
+ * Encryption into a per-connection output buffer that is reused between
+ * packets, as player::send () does.
+ */
+static void
+encrypt_buffered (encryptor_t& enc, std::vector<unsigned char>& out,
+	const unsigned char *data, unsigned int size)
+{
+	out.resize (size);
+	enc.ProcessData (out.data (), data, size);
+}
+
+/* 
+ * In-place encryption, as done on the read path.
+ */
+static void
+encrypt_in_place (encryptor_t& enc, unsigned char *data, unsigned int size)
+{
+	enc.ProcessData (data, data, size);
+}
+
+
+template<typename F>
+static double
+time_per_packet (int count, F fn)
+{
+	auto start = std::chrono::steady_clock::now ();
+	for (int i = 0; i < count; ++i)
+		fn ();
+	auto elapsed = std::chrono::steady_clock::now () - start;
+	
+	return std::chrono::duration_cast<std::chrono::nanoseconds> (elapsed).count ()
+		/ (double)count;
+}
+
+
+int
+main (int argc, char *argv[])
+{
+	int count = 200000;
+	
+	for (int i = 1; i < argc; ++i)
+		{
+			if ((std::strcmp (argv[i], "-n") == 0) && (i + 1 < argc))
+				count = std::atoi (argv[++i]);
+			else
+				{ print_usage (argv[0]); return -1; }
+		}
+	if (count <= 0)
+		{ print_usage (argv[0]); return -1; }
+	
+	unsigned char key[16];
+	for (int i = 0; i < 16; ++i)
+		key[i] = (unsigned char)(i * 7 + 3);
+	
+	std::cout << std::setw (8) << "size"
+		<< std::setw (14) << "pipeline"
+		<< std::setw (14) << "buffered"
+		<< std::setw (14) << "in-place"
+		<< std::setw (10) << "speedup" << std::endl;
+	
+	std::vector<unsigned char> out;
+	for (unsigned int size : packet_sizes)
+		{
+			std::vector<unsigned char> data (size);
+			for (unsigned int i = 0; i < size; ++i)
+				data[i] = (unsigned char)i;
+			
+			// each method gets its own cipher, since CFB is stateful.
+			encryptor_t e1 (key, 16, key, 1);
+			encryptor_t e2 (key, 16, key, 1);
+			encryptor_t e3 (key, 16, key, 1);
+			
+			int n = (size > 1000) ? (count / 20) : count;
+			if (n <= 0) n = 1;
+			
+			double t_pipe = time_per_packet (n,
+				[&] { encrypt_pipeline (e1, data.data (), size); });
+			double t_buf = time_per_packet (n,
+				[&] { encrypt_buffered (e2, out, data.data (), size); });
+			double t_inpl = time_per_packet (n,
+				[&] { encrypt_in_place (e3, data.data (), size); });
+			
+			std::cout << std::fixed << std::setprecision (1)
+				<< std::setw (8) << size
+				<< std::setw (11) << t_pipe << " ns"
+				<< std::setw (11) << t_buf << " ns"
+				<< std::setw (11) << t_inpl << " ns"
+				<< std::setw (9) << (t_pipe / t_buf) << "x" << std::endl;
+		}
+	
+	return 0;
+}
+
@@ -0,0 +1,177 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* 
+ * phbench - replays a recorded (or canned) physics workload against a
+ * headless world and reports physics throughput.
+ * 
+ * Usage: phbench [-t threads] [-b budget] [-s settle-seconds] <scenario|file.phr>
+ */
+
+#include "scenarios.hpp"
+#include "physics/recorder.hpp"
+#include "system/server.hpp"
+#include "system/logger.hpp"
+#include "world/world.hpp"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <sys/stat.h>
+
+
+static void
+print_usage (const char *prog)
+{
+	std::cout << "Usage: " << prog << " [-t threads] [-b budget] [-s settle-seconds] <scenario|file.phr>" << std::endl;
+	std::cout << std::endl << "Scenarios:" << std::endl;
+	hCraft::bench::list_scenarios (std::cout);
+}
+
+static double
+percentile (const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty ())
+		return 0.0;
+	std::size_t index = (std::size_t)(p * (sorted.size () - 1) + 0.5);
+	return sorted[index];
+}
+
+
+int
+main (int argc, char *argv[])
+{
+	int threads = 1;
+	int budget = 0;
+	int settle = 30;
+	const char *target = nullptr;
+	
+	for (int i = 1; i < argc; ++i)
+		{
+			if ((std::strcmp (argv[i], "-t") == 0) && (i + 1 < argc))
+				threads = std::atoi (argv[++i]);
+			else if ((std::strcmp (argv[i], "-b") == 0) && (i + 1 < argc))
+				budget = std::atoi (argv[++i]);
+			else if ((std::strcmp (argv[i], "-s") == 0) && (i + 1 < argc))
+				settle = std::atoi (argv[++i]);
+			else if (argv[i][0] != '-' && !target)
+				target = argv[i];
+			else
+				{ print_usage (argv[0]); return -1; }
+		}
+	if (!target || threads < 1 || threads > 20)
+		{ print_usage (argv[0]); return -1; }
+	
+	hCraft::physics_recording rec;
+	if (!hCraft::bench::make_scenario (target, rec))
+		{
+			try
+				{
+					rec.load (target);
+				}
+			catch (const std::exception& ex)
+				{
+					std::cerr << "phbench: " << target << ": " << ex.what () << std::endl;
+					return -1;
+				}
+		}
+	
+	mkdir ("data", 0744);
+	mkdir ("data/phbench", 0744);
+	
+	hCraft::logger log;
+	hCraft::server srv (log);
+	srv.start_headless ();
+	
+	hCraft::world *w = new hCraft::world (hCraft::WT_NORMAL, srv, "phbench", log,
+		hCraft::world_generator::create ("empty"),
+		hCraft::world_provider::create ("hw", "data/phbench", "phbench"));
+	w->auto_lighting = false;
+	if (budget > 0)
+		w->ph_budget = budget;
+	rec.apply_snapshot (*w);
+	srv.register_world (w);
+	
+	std::mutex stat_lock;
+	std::vector<double> tick_times; // in milliseconds
+	unsigned long long total = 0;
+	w->physics.tick_hook =
+		[&] (int updates, std::chrono::steady_clock::duration elapsed)
+			{
+				std::lock_guard<std::mutex> guard {stat_lock};
+				tick_times.push_back (std::chrono::duration<double, std::milli> (elapsed).count ());
+				total += updates;
+			};
+	w->physics.set_thread_count (threads);
+	w->start ();
+	
+	std::cout << "Replaying " << rec.records.size () << " records over "
+		<< rec.chunks.size () << " chunks with " << threads << " thread(s)..." << std::endl;
+	
+	auto start = std::chrono::steady_clock::now ();
+	for (const hCraft::physics_record& r : rec.records)
+		{
+			std::this_thread::sleep_until (start + std::chrono::milliseconds (r.time));
+			hCraft::physics_recording::replay (*w, r);
+		}
+	
+	// wait for physics to settle down
+	auto deadline = std::chrono::steady_clock::now () + std::chrono::seconds (settle);
+	int idle = 0;
+	while (std::chrono::steady_clock::now () < deadline)
+		{
+			std::this_thread::sleep_for (std::chrono::milliseconds (100));
+			
+			hCraft::physics_world_stats ps;
+			if (!w->physics.get_stats (w, ps) || ps.pending == 0)
+				{
+					if (++idle == 5)
+						break;
+				}
+			else
+				idle = 0;
+		}
+	
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now () - start;
+	w->physics.set_thread_count (0);
+	
+	// give the world thread a moment to apply what is left
+	std::this_thread::sleep_for (std::chrono::milliseconds (250));
+	w->stop ();
+	
+	std::sort (tick_times.begin (), tick_times.end ());
+	std::cout << std::fixed << std::setprecision (2);
+	std::cout << "Elapsed:      " << elapsed.count () << "s" << std::endl;
+	std::cout << "Updates:      " << total << " (" << (total / elapsed.count ()) << "/s)" << std::endl;
+	std::cout << "Ticks:        " << tick_times.size () << std::endl;
+	std::cout << "Tick time:    p50 " << percentile (tick_times, 0.5)
+		<< "ms, p90 " << percentile (tick_times, 0.9)
+		<< "ms, p99 " << percentile (tick_times, 0.99)
+		<< "ms, max " << (tick_times.empty () ? 0.0 : tick_times.back ()) << "ms" << std::endl;
+	std::cout << "Checksum:     " << std::hex << std::setw (16) << std::setfill ('0')
+		<< rec.checksum (*w) << std::dec << std::endl;
+	
+	delete w;
+	return 0;
+}
+
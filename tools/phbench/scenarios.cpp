@@ -0,0 +1,207 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scenarios.hpp"
+#include "slot/blocks.hpp"
+#include <cstring>
+
+
+namespace hCraft {
+	namespace bench {
+		
+		/* 
+		 * All scenarios take place in a 9x9 chunk region centered at the origin,
+		 * with a stone floor that has a layer of grass on top (up to y = 3).
+		 */
+		static const int region_radius = 4;
+		static const int floor_top = 3;
+		
+		static void
+		_make_region (physics_recording& out)
+		{
+			out.chunks.clear ();
+			out.records.clear ();
+			out.duration = 0;
+			out.skipped = 0;
+			
+			for (int cx = -region_radius; cx <= region_radius; ++cx)
+				for (int cz = -region_radius; cz <= region_radius; ++cz)
+					{
+						physics_recorded_chunk ch;
+						ch.cx = cx;
+						ch.cz = cz;
+						ch.ids.assign (65536, BT_AIR);
+						ch.meta.assign (65536, 0);
+						ch.extra.assign (65536, 0);
+						for (int i = 0; i < (floor_top << 8); ++i)
+							ch.ids[i] = BT_STONE;
+						for (int i = (floor_top << 8); i < ((floor_top + 1) << 8); ++i)
+							ch.ids[i] = BT_GRASS;
+						
+						out.chunks.push_back (std::move (ch));
+					}
+		}
+		
+		static void
+		_add_update (physics_recording& out, unsigned int time, int x, int y, int z,
+			unsigned short id, unsigned char meta = 0, bool physics = true)
+		{
+			physics_record r;
+			r.type = PRT_UPDATE;
+			r.flags = physics ? PRF_PHYSICS : 0;
+			r.time = time;
+			r.x = x; r.y = y; r.z = z;
+			r.id = id;
+			r.meta = meta;
+			r.extra = 0;
+			r.data = 0;
+			r.tick_delay = 0;
+			out.records.push_back (r);
+			
+			if (time > out.duration)
+				out.duration = time;
+		}
+		
+		static void
+		_add_physics (physics_recording& out, unsigned int time, int x, int y, int z,
+			int tick_delay, const physics_params& params)
+		{
+			physics_record r;
+			r.type = PRT_PHYSICS;
+			r.flags = PRF_PARAMS;
+			r.time = time;
+			r.x = x; r.y = y; r.z = z;
+			r.id = 0;
+			r.meta = r.extra = 0;
+			r.data = 0;
+			r.tick_delay = tick_delay;
+			r.params = params;
+			out.records.push_back (r);
+			
+			if (time > out.duration)
+				out.duration = time;
+		}
+		
+		
+		
+		/* 
+		 * Layers of sand dropped from y = 80 onto the floor, one every two
+		 * ticks.
+		 */
+		static void
+		_scenario_sand (physics_recording& out)
+		{
+			_make_region (out);
+			for (int layer = 0; layer < 40; ++layer)
+				for (int x = -16; x < 16; ++x)
+					for (int z = -16; z < 16; ++z)
+						_add_update (out, layer * 100, x, 80, z, BT_SAND);
+		}
+		
+		/* 
+		 * A 16x8x16 block of water with finite mechanics released a few blocks
+		 * above the floor.
+		 */
+		static void
+		_scenario_water (physics_recording& out)
+		{
+			_make_region (out);
+			
+			physics_params params;
+			physics_params::build ("finite 1", params, 200);
+			
+			for (int y = 10; y < 18; ++y)
+				for (int x = -8; x < 8; ++x)
+					for (int z = -8; z < 8; ++z)
+						_add_update (out, 0, x, y, z, BT_STILL_WATER, 0, false);
+			for (int y = 10; y < 18; ++y)
+				for (int x = -8; x < 8; ++x)
+					for (int z = -8; z < 8; ++z)
+						_add_physics (out, 250, x, y, z, 2, params);
+		}
+		
+		/* 
+		 * A grid of 64 langton's ants walking on the grass floor.
+		 */
+		static void
+		_scenario_ants (physics_recording& out)
+		{
+			_make_region (out);
+			for (int x = -56; x < 56; x += 14)
+				for (int z = -56; z < 56; z += 14)
+					_add_update (out, 0, x, floor_top + 1, z, BT_LANGTONS_ANT);
+		}
+		
+		/* 
+		 * Ten volleys of 36 firework rockets, launched half a second apart.
+		 */
+		static void
+		_scenario_fireworks (physics_recording& out)
+		{
+			_make_region (out);
+			for (int volley = 0; volley < 10; ++volley)
+				for (int x = -30; x <= 30; x += 12)
+					for (int z = -30; z <= 30; z += 12)
+						_add_update (out, volley * 500, x + (volley & 1) * 6,
+							floor_top + 1, z, BT_FIREWORK_ROCKET);
+		}
+		
+		
+		
+		static const struct
+		{
+			const char *name;
+			const char *desc;
+			void (*build) (physics_recording&);
+		} _scenarios[] = {
+			{ "sand", "layers of falling sand", _scenario_sand },
+			{ "water", "a block of finite water spreading out", _scenario_water },
+			{ "ants", "64 langton's ants", _scenario_ants },
+			{ "fireworks", "volleys of firework rockets", _scenario_fireworks },
+		};
+		
+		
+		/* 
+		 * Builds the canned scenario named @{name} into @{out}.
+		 * Returns false if no such scenario exists.
+		 */
+		bool
+		make_scenario (const char *name, physics_recording& out)
+		{
+			for (auto& sc : _scenarios)
+				if (std::strcmp (sc.name, name) == 0)
+					{
+						sc.build (out);
+						return true;
+					}
+			
+			return false;
+		}
+		
+		/* 
+		 * Prints the names and descriptions of all canned scenarios.
+		 */
+		void
+		list_scenarios (std::ostream& strm)
+		{
+			for (auto& sc : _scenarios)
+				strm << "  " << sc.name << " - " << sc.desc << std::endl;
+		}
+	}
+}
+
@@ -0,0 +1,43 @@
+/* 
+ * hCraft - A custom Minecraft server.
+ * Copyright (C) 2012-2013	Jacob Zhitomirsky (BizarreCake)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _hCraft__TOOLS__PHBENCH__SCENARIOS_H_
+#define _hCraft__TOOLS__PHBENCH__SCENARIOS_H_
+
+#include "physics/recorder.hpp"
+#include <ostream>
+
+
+namespace hCraft {
+	namespace bench {
+		
+		/* 
+		 * Builds the canned scenario named @{name} into @{out}.
+		 * Returns false if no such scenario exists.
+		 */
+		bool make_scenario (const char *name, physics_recording& out);
+		
+		/* 
+		 * Prints the names and descriptions of all canned scenarios.
+		 */
+		void list_scenarios (std::ostream& strm);
+	}
+}
+
+#endif
+